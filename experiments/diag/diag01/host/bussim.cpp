@@ -0,0 +1,202 @@
+// I2C bus simulator for the diag01 protocol, comparing the two ways the master can collect changes
+// after a connection detection round:
+// - poll:  read the change block of every module (I2C_GET_CHANGES), most of them only return I2C_TAG_END
+// - attn:  check the attention line, and narrow down with I2C_ATTN_QUERY broadcasts which modules
+//          are holding it, then read only those. When more than half of the modules had changes in the
+//          previous cycle, searching costs more than reading them all, so all are read like in poll
+// Modules follow the same rules as diag01.ino: records are 3 bytes (analog, connection) or 2 bytes (digital),
+// as many as fit in I2C_maxSize with the end tag and flags byte, and the master reads again straight
+// away while the flags say more is pending.
+//
+// Build from the diag01 folder:
+//   g++ -O2 -o bussim host/bussim.cpp
+//
+// Usage: bussim [-n modules] [-c cycles] [-s changes max size] [-f bus clock Hz]
+//   Runs each method at a range of activity levels (chance per module and cycle that a pin changes)
+//   and prints bus time per cycle and the delay before a change is read.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include <deque>
+
+#define I2C_GET_CHANGES        1
+#define I2C_ATTN_QUERY         5
+#define I2C_DETECT             6
+
+#define MODULE_ID_BITS 7
+#define PIN_ID_BITS 6
+
+struct record_t {
+  uint8_t length;
+  long cycle; // when the change happened
+};
+
+struct module_t {
+  uint8_t moduleId;
+  std::deque<record_t> pending;
+  uint8_t attnFirst = 0;
+  uint8_t attnLast = 127;
+
+  bool attention() { return !pending.empty() && moduleId >= attnFirst && moduleId <= attnLast; };
+};
+
+static std::vector<module_t> modules;
+static uint8_t changesMaxSize = 14;
+
+// bus accounting, in bit times: start, 9 bits per byte with ACK, stop (repeated start counted as a start)
+static unsigned long busBits;
+static unsigned long queries;
+static unsigned long reads;
+static unsigned long emptyReads;
+static double delaySum;
+static unsigned long delayCount;
+static long maxDelay;
+
+static void broadcast(uint8_t command, uint8_t a, uint8_t b, int length)
+{
+  busBits += 1 + 9 * (1 + length) + 1;
+  for (module_t &m : modules) {
+    switch (command) {
+      case I2C_DETECT:
+        if (a == 0) {
+          m.attnFirst = 0;
+          m.attnLast = 127;
+        }
+        break;
+      case I2C_ATTN_QUERY:
+        m.attnFirst = a;
+        m.attnLast = b;
+        break;
+    }
+  }
+}
+
+static bool attentionLine()
+{
+  for (module_t &m : modules) {
+    if (m.attention()) return true;
+  }
+  return false;
+}
+
+// read_i2c_block_data(addr, I2C_GET_CHANGES, changesMaxSize) until I2C_MORE_PENDING is clear,
+// module side as in requestEvent()
+static void readChanges(module_t &m, long cycle)
+{
+  if (m.pending.empty()) emptyReads++;
+  do {
+    busBits += 1 + 9 * 2 + 1 + 9 * (1 + changesMaxSize) + 1;
+    reads++;
+    uint8_t len = 0;
+    while (!m.pending.empty() && len + m.pending.front().length + 2 <= changesMaxSize) {
+      len += m.pending.front().length;
+      long delay = cycle - m.pending.front().cycle;
+      delaySum += delay;
+      delayCount++;
+      if (delay > maxDelay) maxDelay = delay;
+      m.pending.pop_front();
+    }
+  } while (!m.pending.empty());
+}
+
+// same as dirtyModules() in arduino-poll.py
+static void dirtyModules(int first, int last, bool known, std::vector<int> &dirty)
+{
+  if (!known) {
+    broadcast(I2C_ATTN_QUERY, modules[first].moduleId, modules[last].moduleId, 3);
+    queries++;
+    if (!attentionLine()) return;
+  }
+  if (first == last) {
+    dirty.push_back(first);
+    return;
+  }
+  int middle = (first + last) / 2;
+  size_t before = dirty.size();
+  dirtyModules(first, middle, false, dirty);
+  dirtyModules(middle + 1, last, dirty.size() == before, dirty);
+}
+
+static void run(bool useAttention, double activity, long cycles, int nbModules)
+{
+  modules.assign(nbModules, module_t());
+  for (int i = 0; i < nbModules; i++) modules[i].moduleId = i + 1;
+  busBits = queries = reads = emptyReads = delayCount = 0;
+  delaySum = 0;
+  maxDelay = 0;
+  srand(1);
+  size_t lastDirty = 0;
+
+  for (long cycle = 0; cycle < cycles; cycle++) {
+    // pins change in the background, mostly knobs
+    for (module_t &m : modules) {
+      if (rand() < activity * RAND_MAX) {
+        int kind = rand() % 10;
+        m.pending.push_back({ (uint8_t)(kind == 0 ? 2 : 3), cycle });
+      }
+    }
+
+    broadcast(I2C_DETECT, 0, PIN_ID_BITS, 3);
+    for (uint8_t step = 1; step <= MODULE_ID_BITS + PIN_ID_BITS; step++) broadcast(I2C_DETECT, step, 0, 2);
+
+    if (useAttention && lastDirty <= modules.size() / 2) {
+      if (!attentionLine()) {
+        lastDirty = 0;
+        continue;
+      }
+      std::vector<int> dirty;
+      dirtyModules(0, nbModules - 1, true, dirty);
+      for (int i : dirty) readChanges(modules[i], cycle);
+      lastDirty = dirty.size();
+    } else {
+      lastDirty = 0;
+      for (module_t &m : modules) lastDirty += !m.pending.empty();
+      for (module_t &m : modules) readChanges(m, cycle);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int nbModules = 64;
+  long cycles = 10000;
+  double busClock = 400000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:c:s:f:")) != -1) {
+    switch (opt) {
+      case 'n': nbModules = atoi(optarg); break;
+      case 'c': cycles = atol(optarg); break;
+      case 's': changesMaxSize = atoi(optarg); break;
+      case 'f': busClock = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-n modules] [-c cycles] [-s changes max size] [-f bus clock Hz]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (nbModules < 1 || nbModules > 126) {
+    fprintf(stderr, "1 to 126 modules\n");
+    return 1;
+  }
+
+  printf("%d modules, %ld cycles, %d byte change blocks, %.0f kHz\n\n", nbModules, cycles, changesMaxSize, busClock / 1000);
+  printf("activity  method  bus ms/cycle  queries/cycle  reads/cycle  empty reads  delay avg/max (cycles)\n");
+
+  double activities[] = { 0, 0.001, 0.01, 0.05, 0.2, 1 };
+  for (double activity : activities) {
+    for (int method = 0; method < 2; method++) {
+      run(method == 1, activity, cycles, nbModules);
+      printf("%8.3f  %-6s  %12.3f  %13.2f  %11.2f  %10.0f%%  %8.2f/%ld\n",
+        activity, method ? "attn" : "poll",
+        busBits / busClock * 1000 / cycles,
+        (double)queries / cycles,
+        (double)reads / cycles,
+        reads ? 100.0 * emptyReads / reads : 0,
+        delayCount ? delaySum / delayCount : 0, maxDelay);
+    }
+  }
+  return 0;
+}
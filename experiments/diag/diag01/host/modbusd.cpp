@@ -0,0 +1,670 @@
+// Module bus daemon: the Linux I2C master for diag01 modules, in place of python/arduino-poll.py, with the
+// same OSC messages (listed at the top of arduino-poll.py): changes go out to the control panel on
+// UDP port 9001, /module/digital, /module/pwm, /reset and /quality come in on port 9002.
+//
+// Each cycle is a detection round (I2C_DETECT steps, or the 32 I2C_TICK of the old protocol with -t)
+// sent as one combined transfer, then the modules with changes are read: found with the attention line
+// and I2C_ATTN_QUERY when it is wired (-a), all of them otherwise. Change reads are I2C_GET_CHANGES
+// written and the block read back after a repeated start, again while I2C_MORE_PENDING is set.
+// Modules are found by probing every address with I2C_SET_CONFIG then I2C_REQUEST_FULLSTATE, at the
+// start, on /reset and every few seconds for the addresses that didn't answer (modules plugged in
+// later). A module that stops answering is dropped until it is found again.
+//
+// Without an I2C bus, -S runs on a simulated bus instead (host/modsim/simbus.h), with diag01.so
+// modules and random cable and knob changes, kept in step with the real time so the OSC side
+// behaves as on the real thing.
+//
+// Every -i seconds: polls (cycles) per second, bus transfers, events sent, and the latency of the
+// events, from the start of the cycle that found them to the OSC message. On the simulated bus, also
+// from the change itself.
+//
+// Build from the diag01 folder:
+//   g++ -O2 -std=gnu++11 -Ihost/modsim -o modbusd host/modbusd.cpp host/modsim/simbus.cpp -ldl
+// (diag01.so for -S: see host/modsim/modsim.cpp)
+//
+// Usage: modbusd [-b i2c bus number] [-a attention gpio] [-o OSC host] [-m changes max size] [-t]
+//                [-i stats seconds] [-d seconds] [-v] [-S diag01.so [-n modules] [-c cable changes/s] [-k knob moves/s]]
+//   The attention line is a GPIO of /dev/gpiochip0, by its line offset (the BCM number on a Pi),
+//   with the internal pull-up.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <linux/gpio.h>
+#include <vector>
+#include <algorithm>
+
+#include "simbus.h"
+
+// diag01 commands and change report tags
+#define I2C_TICK               0
+#define I2C_GET_CHANGES        1
+#define I2C_REQUEST_FULLSTATE  2
+#define I2C_WRITE_DIGITAL      3
+#define I2C_WRITE_PWM          4
+#define I2C_ATTN_QUERY         5
+#define I2C_DETECT             6
+#define I2C_GET_QUALITY        7
+#define I2C_SET_CONFIG         32
+
+#define I2C_TAG_ANALOG_VALUE   0b00000000
+#define I2C_TAG_DIGITAL_VALUE  0b01000000
+#define I2C_TAG_CONNECTION     0b10000000
+#define I2C_TAG_CONNECTION_16  0b11000000
+#define I2C_TAG_END            0b11111111
+#define I2C_TAG_MASK           0b11000000
+#define I2C_MORE_PENDING       0x01
+
+#define MODULE_ID_BITS 7
+#define PIN_ID_BITS 6
+#define MAX_FRAMES 8          // continuation frames read from a module in one polling pass
+#define MAX_ADDRESS 126
+#define DISCOVERY_MICROS 5000000
+#define MAX_FAILURES 3        // transfers in a row a module doesn't answer before it is dropped
+
+#define OSC_OUT_PORT 9001
+#define OSC_IN_PORT 9002
+
+// Master side of the bus, on /dev/i2c-N or simulated
+class MasterBus {
+  public:
+    virtual ~MasterBus() {};
+    // messages to the broadcast address, one transfer with repeated starts between them
+    virtual bool broadcast(const std::vector<std::vector<uint8_t>> &messages) = 0;
+    virtual bool write(uint8_t address, const uint8_t *data, uint8_t length) = 0;
+    virtual bool read(uint8_t address, const uint8_t *txData, uint8_t txLength, uint8_t *rxData, uint8_t rxLength) = 0;
+    virtual bool hasAttention() = 0;
+    virtual bool attention() = 0; // a module holds the line low
+    virtual double micros() = 0;
+    virtual void idle() {}; // between cycles
+    // simulated bus only: time the change behind a report happened, -1 if unknown
+    virtual double connectionChanged(int, int, bool, int, int) { return -1; };
+    virtual double analogChanged(int, int, int) { return -1; };
+
+    unsigned long transfers = 0;
+};
+
+static double monotonicMicros()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+class I2CDevBus : public MasterBus {
+  public:
+    bool begin(int busNumber, int attentionGpio)
+    {
+      char path[32];
+      snprintf(path, sizeof(path), "/dev/i2c-%d", busNumber);
+      _fd = open(path, O_RDWR);
+      if (_fd < 0) {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+      }
+      if (attentionGpio < 0) return true;
+
+      int chip = open("/dev/gpiochip0", O_RDONLY);
+      struct gpio_v2_line_request request;
+      memset(&request, 0, sizeof(request));
+      request.offsets[0] = attentionGpio;
+      request.num_lines = 1;
+      request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+      strcpy(request.consumer, "modbusd attention");
+      if (chip < 0 || ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &request) < 0) {
+        fprintf(stderr, "can't get GPIO %d of /dev/gpiochip0\n", attentionGpio);
+        return false;
+      }
+      close(chip);
+      _attentionFd = request.fd;
+      return true;
+    }
+
+    bool broadcast(const std::vector<std::vector<uint8_t>> &messages)
+    {
+      struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+      int n = std::min((int)messages.size(), I2C_RDWR_IOCTL_MAX_MSGS);
+      for (int i = 0; i < n; i++) {
+        msgs[i].addr = 0;
+        msgs[i].flags = 0;
+        msgs[i].len = messages[i].size();
+        msgs[i].buf = (uint8_t *)messages[i].data();
+      }
+      return transfer(msgs, n);
+    }
+
+    bool write(uint8_t address, const uint8_t *data, uint8_t length)
+    {
+      struct i2c_msg msg = { address, 0, length, (uint8_t *)data };
+      return transfer(&msg, 1);
+    }
+
+    bool read(uint8_t address, const uint8_t *txData, uint8_t txLength, uint8_t *rxData, uint8_t rxLength)
+    {
+      struct i2c_msg msgs[2] = {
+        { address, 0, txLength, (uint8_t *)txData },
+        { address, I2C_M_RD, rxLength, rxData }
+      };
+      return transfer(msgs, 2);
+    }
+
+    bool hasAttention() { return _attentionFd >= 0; };
+
+    bool attention()
+    {
+      struct gpio_v2_line_values values = { 0, 1 };
+      if (ioctl(_attentionFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) return true; // read everything
+      return !(values.bits & 1);
+    }
+
+    double micros() { return monotonicMicros(); };
+
+  private:
+    bool transfer(struct i2c_msg *msgs, int n)
+    {
+      struct i2c_rdwr_ioctl_data data = { msgs, (uint32_t)n };
+      transfers++;
+      return ioctl(_fd, I2C_RDWR, &data) == n;
+    }
+
+    int _fd = -1;
+    int _attentionFd = -1;
+};
+
+class SimulatedBus : public MasterBus {
+  public:
+    bool begin(const char *library, int nbModules, double cableRate, double knobRate)
+    {
+      if (!_bus.begin(library, nbModules, &_host)) return false;
+      _bus.setActivity(cableRate, knobRate);
+      _start = monotonicMicros();
+      return true;
+    }
+
+    bool broadcast(const std::vector<std::vector<uint8_t>> &messages)
+    {
+      for (const std::vector<uint8_t> &m : messages) _bus.broadcast(m.data(), m.size());
+      transfers++;
+      return true;
+    }
+
+    bool write(uint8_t address, const uint8_t *data, uint8_t length)
+    {
+      transfers++;
+      return _bus.write(address, data, length);
+    }
+
+    bool read(uint8_t address, const uint8_t *txData, uint8_t txLength, uint8_t *rxData, uint8_t rxLength)
+    {
+      transfers++;
+      return _bus.read(address, txData, txLength, rxData, rxLength);
+    }
+
+    bool hasAttention() { return true; };
+    bool attention() { return _bus.attention(); };
+    double micros() { return _bus.now; };
+
+    // the simulated time runs as fast as the bus allows, wait for the real time to catch up
+    void idle()
+    {
+      _bus.randomActivity();
+      double ahead = _bus.now - (monotonicMicros() - _start);
+      if (ahead > 1000) usleep(ahead);
+    }
+
+    double connectionChanged(int moduleId, int pinId, bool connected, int fromModuleId, int fromPinId)
+    {
+      return _bus.connectionReported(moduleId, pinId, connected, fromModuleId, fromPinId);
+    }
+
+    double analogChanged(int moduleId, int pinId, int value)
+    {
+      return _bus.analogReported(moduleId, pinId, value);
+    }
+
+    static void console(int moduleId, const char *line);
+    static bool verbose;
+
+  private:
+    SimBus _bus;
+    simHost_t _host = { console, 40 };
+    double _start;
+};
+
+bool SimulatedBus::verbose = false;
+
+void SimulatedBus::console(int moduleId, const char *line)
+{
+  if (verbose) printf("module %d: %s\n", moduleId, line);
+}
+
+// OSC over UDP, int32 ('i') and float ('f') arguments
+
+static int oscOut = -1, oscIn = -1;
+static struct sockaddr_in oscTarget;
+
+static int oscString(uint8_t *packet, int length, const char *s)
+{
+  int n = strlen(s) + 1;
+  memcpy(packet + length, s, n);
+  length += n;
+  while (length & 3) packet[length++] = 0;
+  return length;
+}
+
+static void oscSend(const char *address, const char *types, ...)
+{
+  uint8_t packet[256];
+  char tags[16] = ",";
+  strncat(tags, types, sizeof(tags) - 2);
+  int length = oscString(packet, 0, address);
+  length = oscString(packet, length, tags);
+
+  va_list args;
+  va_start(args, types);
+  for (const char *t = types; *t; t++) {
+    uint32_t v;
+    if (*t == 'f') {
+      float f = va_arg(args, double);
+      memcpy(&v, &f, sizeof(v));
+    } else {
+      v = va_arg(args, int);
+    }
+    packet[length++] = v >> 24;
+    packet[length++] = v >> 16;
+    packet[length++] = v >> 8;
+    packet[length++] = v;
+  }
+  va_end(args);
+  sendto(oscOut, packet, length, 0, (struct sockaddr *)&oscTarget, sizeof(oscTarget));
+}
+
+static bool oscBegin(const char *host)
+{
+  oscOut = socket(AF_INET, SOCK_DGRAM, 0);
+  oscIn = socket(AF_INET, SOCK_DGRAM, 0);
+  memset(&oscTarget, 0, sizeof(oscTarget));
+  oscTarget.sin_family = AF_INET;
+  oscTarget.sin_port = htons(OSC_OUT_PORT);
+  if (oscOut < 0 || oscIn < 0 || inet_pton(AF_INET, host, &oscTarget.sin_addr) != 1) {
+    fprintf(stderr, "can't send OSC to %s\n", host);
+    return false;
+  }
+  struct sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_port = htons(OSC_IN_PORT);
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(oscIn, (struct sockaddr *)&local, sizeof(local)) < 0) {
+    fprintf(stderr, "can't listen to OSC on port %d\n", OSC_IN_PORT);
+    return false;
+  }
+  fcntl(oscIn, F_SETFL, O_NONBLOCK);
+  return true;
+}
+
+// next OSC message waiting, arguments as ints. False if there is none
+static bool oscReceive(char *address, int addressSize, std::vector<int> &args)
+{
+  uint8_t packet[512];
+  ssize_t length;
+  while ((length = recv(oscIn, packet, sizeof(packet) - 1, 0)) > 0) {
+    packet[length] = 0;
+    if (packet[0] != '/') continue; // bundles aren't used by the control panel
+    size_t n = strnlen((char *)packet, addressSize - 1);
+    memcpy(address, packet, n);
+    address[n] = 0;
+    int ptr = (strlen((char *)packet) + 4) & ~3;
+    if (ptr >= length || packet[ptr] != ',') return true;
+    const char *types = (char *)packet + ptr + 1;
+    ptr = (ptr + strlen((char *)packet + ptr) + 4) & ~3;
+    args.clear();
+    for (; *types && ptr + 4 <= length; types++, ptr += 4) {
+      uint32_t v = packet[ptr] << 24 | packet[ptr + 1] << 16 | packet[ptr + 2] << 8 | packet[ptr + 3];
+      if (*types == 'i') {
+        args.push_back((int32_t)v);
+      } else if (*types == 'f') {
+        float f;
+        memcpy(&f, &v, sizeof(f));
+        args.push_back((int)f);
+      } else {
+        break;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+// Master
+
+static MasterBus *bus;
+static std::vector<uint8_t> modules; // addresses, sorted
+static std::vector<uint8_t> failures(MAX_ADDRESS + 1, 0);
+static uint8_t changesMaxSize = 14;
+static bool ticks = false;
+static bool verbose = false;
+static volatile bool stopping = false;
+
+struct stats_t {
+  unsigned long cycles = 0;
+  double maxCycle = 0;
+  unsigned long reads = 0;
+  unsigned long events = 0;
+  double latencySum = 0, latencyMax = 0;
+  double changeLatencySum = 0, changeLatencyMax = 0;
+  unsigned long changeLatencyCount = 0;
+  unsigned long failures = 0; // transfers to known modules that failed
+  unsigned long transfers = 0; // at the start of the period
+};
+
+static stats_t stats;
+static double cycleStart;
+
+static void onSignal(int)
+{
+  stopping = true;
+}
+
+static void sent(double changed)
+{
+  double now = bus->micros();
+  double latency = now - cycleStart;
+  stats.events++;
+  stats.latencySum += latency;
+  stats.latencyMax = std::max(stats.latencyMax, latency);
+  if (changed >= 0) {
+    stats.changeLatencySum += now - changed;
+    stats.changeLatencyMax = std::max(stats.changeLatencyMax, now - changed);
+    stats.changeLatencyCount++;
+  }
+}
+
+// probe the addresses without a module: a module ACKs, takes the block size and sends its full state
+static void discover(bool all)
+{
+  std::vector<uint8_t> found;
+  for (int address = 1; address <= MAX_ADDRESS; address++) {
+    bool known = std::binary_search(modules.begin(), modules.end(), address);
+    if (known && !all) continue;
+    uint8_t config[] = { I2C_SET_CONFIG, changesMaxSize };
+    uint8_t fullState[] = { I2C_REQUEST_FULLSTATE, 0 };
+    if (bus->write(address, config, sizeof(config)) && bus->write(address, fullState, sizeof(fullState))) {
+      if (!known) printf("module %d found\n", address);
+      found.push_back(address);
+      failures[address] = 0;
+    } else if (known) {
+      found.push_back(address); // dropped by answered() if it keeps failing
+    }
+  }
+  if (!all) found.insert(found.end(), modules.begin(), modules.end());
+  std::sort(found.begin(), found.end());
+  found.erase(std::unique(found.begin(), found.end()), found.end());
+  modules = found;
+}
+
+// keeps track of modules that don't answer any more
+static bool answered(uint8_t address, bool ok)
+{
+  if (ok) {
+    failures[address] = 0;
+    return true;
+  }
+  stats.failures++;
+  if (++failures[address] >= MAX_FAILURES) {
+    printf("module %d lost\n", address);
+    modules.erase(std::remove(modules.begin(), modules.end(), address), modules.end());
+  }
+  return false;
+}
+
+static void detectionRound()
+{
+  std::vector<std::vector<uint8_t>> messages;
+  if (ticks) {
+    for (uint8_t tick = 0; tick < 32; tick++) messages.push_back({ I2C_TICK, tick });
+  } else {
+    messages.push_back({ I2C_DETECT, 0, PIN_ID_BITS });
+    for (uint8_t step = 1; step <= MODULE_ID_BITS + PIN_ID_BITS; step++) messages.push_back({ I2C_DETECT, step });
+  }
+  bus->broadcast(messages);
+}
+
+// same as parseChanges() in arduino-poll.py, returns true if the module has more waiting
+static bool parseChanges(uint8_t address, const uint8_t *pdu, uint8_t length)
+{
+  uint8_t ptr = 0;
+  while (ptr < length && pdu[ptr] != I2C_TAG_END) {
+    uint8_t tag = pdu[ptr] & I2C_TAG_MASK;
+    uint8_t pinId = pdu[ptr] & ~I2C_TAG_MASK;
+    if (tag == I2C_TAG_ANALOG_VALUE && ptr + 3 <= length) {
+      int value = pdu[ptr + 1] << 8 | pdu[ptr + 2];
+      if (verbose) printf("analog m%dp%d = %d\n", address, pinId, value);
+      oscSend("/module/analog", "iif", address, pinId, value / 1024.0);
+      sent(bus->analogChanged(address, pinId, value));
+      ptr += 3;
+    } else if (tag == I2C_TAG_DIGITAL_VALUE && ptr + 2 <= length) {
+      if (verbose) printf("digital m%dp%d = %d\n", address, pinId, pdu[ptr + 1]);
+      oscSend("/module/digital", "iii", address, pinId, pdu[ptr + 1]);
+      sent(-1);
+      ptr += 2;
+    } else if ((tag == I2C_TAG_CONNECTION && ptr + 3 <= length) || (tag == I2C_TAG_CONNECTION_16 && ptr + 4 <= length)) {
+      bool connected = pdu[ptr + 1] & 0x80;
+      int fromModule = pdu[ptr + 1] & 0x7F;
+      int fromPort = (tag == I2C_TAG_CONNECTION) ? pdu[ptr + 2] : pdu[ptr + 2] << 8 | pdu[ptr + 3];
+      if (verbose) printf("%s: m%dp%d -> m%dp%d\n", connected ? "connected" : "disconnected", fromModule, fromPort, address, pinId);
+      oscSend(connected ? "/matrix/connect" : "/matrix/disconnect", "iiii", address, pinId, fromModule, fromPort);
+      sent(bus->connectionChanged(address, pinId, connected, fromModule, fromPort));
+      ptr += (tag == I2C_TAG_CONNECTION) ? 3 : 4;
+    } else {
+      break;
+    }
+  }
+  return ptr + 1 < length && pdu[ptr] == I2C_TAG_END && (pdu[ptr + 1] & I2C_MORE_PENDING);
+}
+
+// returns true if the module had changes
+static bool readChanges(uint8_t address)
+{
+  uint8_t command = I2C_GET_CHANGES;
+  uint8_t pdu[32];
+  for (int frame = 0; frame < MAX_FRAMES; frame++) {
+    stats.reads++;
+    if (!answered(address, bus->read(address, &command, 1, pdu, changesMaxSize))) return false;
+    if (frame == 0 && pdu[0] == I2C_TAG_END) return false;
+    if (!parseChanges(address, pdu, changesMaxSize)) break;
+  }
+  return true;
+}
+
+// same as dirtyModules() in arduino-poll.py
+static void dirtyModules(int first, int last, bool known, std::vector<uint8_t> &dirty)
+{
+  if (!known) {
+    bus->broadcast({ { I2C_ATTN_QUERY, modules[first], modules[last] } });
+    if (!bus->attention()) return;
+  }
+  if (first == last) {
+    dirty.push_back(modules[first]);
+    return;
+  }
+  int middle = (first + last) / 2;
+  size_t before = dirty.size();
+  dirtyModules(first, middle, false, dirty);
+  dirtyModules(middle + 1, last, dirty.size() == before, dirty);
+}
+
+// same as getQuality() in arduino-poll.py
+static void getQuality()
+{
+  std::vector<uint8_t> polled = modules;
+  for (uint8_t address : polled) {
+    uint8_t select[] = { I2C_GET_QUALITY, 0 };
+    if (!answered(address, bus->write(address, select, sizeof(select)))) continue;
+    for (int socket = 0; socket < 64; socket++) {
+      uint8_t command = I2C_GET_QUALITY;
+      uint8_t q[14];
+      if (!answered(address, bus->read(address, &command, 1, q, sizeof(q)))) break;
+      if (q[0] == 0xFF || (socket > 0 && q[0] == 0)) break;
+      int unconfirmed = q[1] << 8 | q[2], glitches = q[3] << 8 | q[4], confirmed = q[5] << 8 | q[6];
+      int rounds = q[7] << 8 | q[8], roundMicros = q[10] << 8 | q[11];
+      double average = confirmed ? (double)rounds / confirmed : 0;
+      printf("module %d socket %d: unconfirmed %d, glitches %d, confirmed %d, rounds to confirm %.1f/%d, %d us per round\n",
+        address, q[0], unconfirmed, glitches, confirmed, average, q[9], roundMicros);
+      oscSend("/module/quality", "iiiiifii", address, q[0], unconfirmed, glitches, confirmed, average, q[9], roundMicros);
+    }
+  }
+}
+
+static void handleOsc()
+{
+  char address[64];
+  std::vector<int> args;
+  while (oscReceive(address, sizeof(address), args)) {
+    if (verbose) printf("OSC %s\n", address);
+    if ((!strcmp(address, "/module/digital") || !strcmp(address, "/module/pwm")) && args.size() >= 3 &&
+        args[0] > 0 && args[0] <= MAX_ADDRESS) {
+      uint8_t message[] = { (uint8_t)(address[8] == 'd' ? I2C_WRITE_DIGITAL : I2C_WRITE_PWM), (uint8_t)args[1], (uint8_t)args[2] };
+      answered(args[0], bus->write(args[0], message, sizeof(message)));
+    } else if (!strcmp(address, "/reset")) {
+      oscSend("/matrix/reset", "");
+      discover(true);
+    } else if (!strcmp(address, "/quality")) {
+      getQuality();
+    }
+  }
+}
+
+static void printStats(double seconds)
+{
+  printf("%.1f polls/s, cycle avg %.2f ms max %.2f ms, %lu modules, %.0f reads/s, %.0f transfers/s, %lu failed, %.1f events/s",
+    stats.cycles / seconds, stats.cycles ? seconds * 1000 / stats.cycles : 0, stats.maxCycle / 1000, modules.size(),
+    stats.reads / seconds, (bus->transfers - stats.transfers) / seconds, stats.failures, stats.events / seconds);
+  if (stats.events) printf(", latency from cycle avg %.2f ms max %.2f ms", stats.latencySum / stats.events / 1000, stats.latencyMax / 1000);
+  if (stats.changeLatencyCount) printf(", from change avg %.2f ms max %.2f ms",
+    stats.changeLatencySum / stats.changeLatencyCount / 1000, stats.changeLatencyMax / 1000);
+  printf("\n");
+  fflush(stdout);
+  stats = stats_t();
+  stats.transfers = bus->transfers;
+}
+
+int main(int argc, char **argv)
+{
+  int busNumber = 1;
+  int attentionGpio = -1;
+  const char *oscHost = "127.0.0.1";
+  const char *library = NULL;
+  int nbModules = 16;
+  double cableRate = 1;
+  double knobRate = 10;
+  double statsInterval = 10;
+  double duration = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:a:o:m:ti:d:vS:n:c:k:")) != -1) {
+    switch (opt) {
+      case 'b': busNumber = atoi(optarg); break;
+      case 'a': attentionGpio = atoi(optarg); break;
+      case 'o': oscHost = optarg; break;
+      case 'm': changesMaxSize = atoi(optarg); break;
+      case 't': ticks = true; break;
+      case 'i': statsInterval = atof(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      case 'v': verbose = SimulatedBus::verbose = true; break;
+      case 'S': library = optarg; break;
+      case 'n': nbModules = atoi(optarg); break;
+      case 'c': cableRate = atof(optarg); break;
+      case 'k': knobRate = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-b i2c bus number] [-a attention gpio] [-o OSC host] [-m changes max size] [-t]\n"
+          "  [-i stats seconds] [-d seconds] [-v] [-S diag01.so [-n modules] [-c cable changes/s] [-k knob moves/s]]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (changesMaxSize < 6 || changesMaxSize > 32) {
+    fprintf(stderr, "changes max size from 6 to 32\n");
+    return 1;
+  }
+  if (library && (nbModules < 1 || nbModules > MAX_ADDRESS)) {
+    fprintf(stderr, "1 to %d modules\n", MAX_ADDRESS);
+    return 1;
+  }
+
+  if (library) {
+    SimulatedBus *sim = new SimulatedBus();
+    srand(1);
+    if (!sim->begin(library, nbModules, cableRate, knobRate)) return 1;
+    bus = sim;
+    printf("simulated bus, %d modules, %.2f cable changes/s, %.1f knob moves/s\n", nbModules, cableRate, knobRate);
+  } else {
+    I2CDevBus *i2c = new I2CDevBus();
+    if (!i2c->begin(busNumber, attentionGpio)) return 1;
+    bus = i2c;
+  }
+  if (!oscBegin(oscHost)) return 1;
+  printf("sending OSC to %s:%d, listening on port %d\n", oscHost, OSC_OUT_PORT, OSC_IN_PORT);
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  oscSend("/matrix/reset", "");
+  bus->broadcast({ { I2C_SET_CONFIG, changesMaxSize } });
+  discover(true);
+  printf("%zu modules\n", modules.size());
+
+  double start = bus->micros();
+  double lastStats = start, lastDiscovery = start;
+  size_t lastDirty = 0;
+
+  while (!stopping && (!duration || bus->micros() - start < duration * 1e6)) {
+    cycleStart = bus->micros();
+    if (cycleStart - lastDiscovery >= DISCOVERY_MICROS) {
+      discover(false);
+      lastDiscovery = cycleStart;
+    }
+    if (modules.empty()) {
+      usleep(100000);
+      bus->idle();
+      continue;
+    }
+
+    detectionRound();
+    // when more than half of the modules had changes last time, finding them costs more than reading them all
+    if (bus->hasAttention() && lastDirty <= modules.size() / 2) {
+      std::vector<uint8_t> dirty;
+      if (bus->attention()) dirtyModules(0, modules.size() - 1, true, dirty);
+      lastDirty = 0;
+      for (uint8_t address : dirty) lastDirty += readChanges(address);
+    } else {
+      std::vector<uint8_t> polled = modules;
+      lastDirty = 0;
+      for (uint8_t address : polled) lastDirty += readChanges(address);
+    }
+    handleOsc();
+
+    double now = bus->micros();
+    stats.cycles++;
+    stats.maxCycle = std::max(stats.maxCycle, now - cycleStart);
+    if (statsInterval > 0 && now - lastStats >= statsInterval * 1e6) {
+      printStats((now - lastStats) / 1e6);
+      lastStats = now;
+    }
+    bus->idle();
+  }
+
+  double now = bus->micros();
+  if (now > lastStats) printStats((now - lastStats) / 1e6);
+  return 0;
+}
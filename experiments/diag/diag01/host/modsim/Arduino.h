@@ -0,0 +1,119 @@
+// Host build of diag01 for the module bus simulator: just enough of the Arduino core for the
+// firmware sources, on an ATmega328 (ports B, C and D, pins numbered like the Nano). Pins, ports,
+// the ADC, the EEPROM and the I2C slave are plain memory of the module, driven by modsim through
+// the entry points in sim.h.
+
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define F_CPU 16000000UL
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *)(s))
+#define PSTR(s) (s)
+#define PROGMEM
+#define pgm_read_word(a) (*(const uint16_t *)(a))
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define DEFAULT 1
+
+#define NUM_PINS 22
+static const uint8_t A0 = 14, A1 = 15, A2 = 16, A3 = 17, A4 = 18, A5 = 19, A6 = 20, A7 = 21;
+
+// Port registers of the module, PINx and PORTx. Inputs are written by modsim from the cables
+// before the module reads them, outputs are read back by modsim after it has written them
+#define NOT_A_PIN 0
+#define PB 2
+#define PC 3
+#define PD 4
+extern volatile uint8_t simPortIn[5];
+extern volatile uint8_t simPortOut[5];
+inline uint8_t digitalPinToPort(uint8_t p) { return p < 8 ? PD : p < 14 ? PB : p < 20 ? PC : NOT_A_PIN; }
+inline uint8_t digitalPinToBitMask(uint8_t p) { return 1 << (p < 8 ? p : p < 14 ? p - 8 : p - 14); }
+#define portInputRegister(p) (&simPortIn[p])
+#define portOutputRegister(p) (&simPortOut[p])
+#define digitalPinHasPWM(p) ((p) == 3 || (p) == 5 || (p) == 6 || (p) == 9 || (p) == 10 || (p) == 11)
+
+extern uint8_t SREG;
+inline void cli() {}
+inline void sei() {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+#define constrain(x, a, b) ((x) < (a) ? (a) : ((x) > (b) ? (b) : (x)))
+#define bitRead(v, b) (((v) >> (b)) & 1)
+#define bitWrite(v, b, x) ((x) ? ((v) |= (1UL << (b))) : ((v) &= ~(1UL << (b))))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+using std::min;
+using std::max;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+// Simulated time: the bus time at which the module was last called, plus the delays it made since
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+class String : public std::string {
+public:
+  String(const char *s = "") : std::string(s) {}
+  String(const std::string &s) : std::string(s) {}
+  String(int v) : std::string(std::to_string(v)) {}
+  String(unsigned v) : std::string(std::to_string(v)) {}
+  String(char c) : std::string(1, c) {}
+  String substring(size_t b, size_t e = std::string::npos) const { return String(substr(b, e == std::string::npos ? e : e - b)); }
+  long toInt() const { return atol(c_str()); }
+  int length() const { return size(); }
+  int indexOf(char c) const { size_t i = find(c); return i == std::string::npos ? -1 : (int)i; }
+  void remove(size_t i) { erase(i); }
+  void trim() {}
+  void toLowerCase() {}
+  friend String operator+(char c, const String &s) { return String(std::string(1, c) + std::string(s)); }
+};
+
+// Console output goes to modsim, which shows it with -v
+class HardwareSerial {
+public:
+  void begin(unsigned long) {}
+  void flush() {}
+  int available() { return 0; }
+  int read() { return -1; }
+  operator bool() { return true; }
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buf, size_t len);
+  size_t print(const char *s);
+  size_t print(const __FlashStringHelper *s) { return print((const char *)s); }
+  size_t print(const String &s) { return print(s.c_str()); }
+  size_t print(char c) { return write(c); }
+  size_t print(long v, int base = DEC);
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned long v, int base = DEC) { return print((long)v, base); }
+  size_t print(uint8_t v, int base = DEC) { return print((long)v, base); }
+  template <typename T> size_t println(T v) { return print(v) + println(); }
+  template <typename T> size_t println(T v, int base) { return print(v, base) + println(); }
+  size_t println() { return write('\n'); }
+};
+extern HardwareSerial Serial;
+
+extern volatile uint8_t TWAR;
@@ -0,0 +1,18 @@
+#pragma once
+#include <Arduino.h>
+
+// 1 KB, erased, like a new ATmega328
+class EEPROMClass {
+public:
+  uint8_t read(int a) { return data[a]; }
+  void write(int a, uint8_t v) { data[a] = v; }
+  void update(int a, uint8_t v) { data[a] = v; }
+  uint16_t length() { return sizeof(data); }
+  uint8_t &operator[](int a) { return data[a]; }
+  template <class T> T &get(int a, T &t) { memcpy(&t, data + a, sizeof(t)); return t; }
+  template <class T> const T &put(int a, const T &t) { memcpy(data + a, &t, sizeof(t)); return t; }
+
+  uint8_t data[1024];
+  EEPROMClass() { memset(data, 0xFF, sizeof(data)); }
+};
+extern EEPROMClass EEPROM;
@@ -0,0 +1,39 @@
+#pragma once
+#include <Arduino.h>
+
+// I2C slave side only: modsim hands the module what the master wrote, and collects what it writes
+// back to a read, through sim_receive() and sim_request()
+#define BUFFER_LENGTH 32
+
+class TwoWire {
+public:
+  void begin(uint8_t address) { this->address = address; }
+  void begin() {}
+  void end() {}
+  void setClock(long) {}
+  void onReceive(void (*handler)(int)) { receiveHandler = handler; }
+  void onRequest(void (*handler)()) { requestHandler = handler; }
+
+  int available() { return rxLength - rxIndex; }
+  int read() { return rxIndex < rxLength ? rxBuffer[rxIndex++] : -1; }
+  size_t write(uint8_t b) {
+    if (txLength >= BUFFER_LENGTH) return 0;
+    txBuffer[txLength++] = b;
+    return 1;
+  }
+  size_t write(const uint8_t *data, size_t length) {
+    size_t n = 0;
+    while (n < length && write(data[n])) n++;
+    return n;
+  }
+
+  uint8_t address = 0;
+  void (*receiveHandler)(int) = NULL;
+  void (*requestHandler)() = NULL;
+  uint8_t rxBuffer[BUFFER_LENGTH];
+  uint8_t rxLength = 0;
+  uint8_t rxIndex = 0;
+  uint8_t txBuffer[BUFFER_LENGTH];
+  uint8_t txLength = 0;
+};
+extern TwoWire Wire;
@@ -0,0 +1,253 @@
+// Mock Arduino core, Wire, EEPROM and ADC for the host build of diag01, and the sim.h entry points.
+// Compiled with the firmware sources into diag01.so, one copy per simulated module.
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "EEPROM.h"
+
+#include "board.h"
+#include "module.h"
+#include "adcengine.h"
+#include "console.h"
+#include "sysinfo.h"
+#include "pinconfig.h"
+#include "sim.h"
+
+extern bool i2c_active;
+void setup_I2C();
+void updateAttention();
+
+static const simHost_t *host;
+static uint8_t simModuleId;
+
+volatile uint8_t simPortIn[5];
+volatile uint8_t simPortOut[5];
+static uint8_t pinModes[NUM_PINS];
+static uint16_t analogValues[NUM_PINS];
+uint8_t SREG;
+volatile uint8_t TWAR;
+
+HardwareSerial Serial;
+TwoWire Wire;
+EEPROMClass EEPROM;
+sysinfoClass sysinfo;
+
+static unsigned long now;       // bus time of the current call
+static unsigned long elapsed;   // delays made by the module since
+
+// Arduino core
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (pin >= NUM_PINS) return;
+  pinModes[pin] = mode;
+  if (mode == INPUT_PULLUP) simPortIn[digitalPinToPort(pin)] |= digitalPinToBitMask(pin);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (pin >= NUM_PINS || digitalPinToPort(pin) == NOT_A_PIN) return;
+  if (value) simPortOut[digitalPinToPort(pin)] |= digitalPinToBitMask(pin);
+  else simPortOut[digitalPinToPort(pin)] &= ~digitalPinToBitMask(pin);
+}
+
+int digitalRead(uint8_t pin)
+{
+  if (pin >= NUM_PINS || digitalPinToPort(pin) == NOT_A_PIN) return LOW;
+  return (simPortIn[digitalPinToPort(pin)] & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+  return pin < NUM_PINS ? analogValues[pin] : 0;
+}
+
+void analogWrite(uint8_t, int) {}
+
+unsigned long micros() { return now + elapsed; }
+unsigned long millis() { return micros() / 1000; }
+void delay(unsigned long ms) { elapsed += ms * 1000; }
+void delayMicroseconds(unsigned int us) { elapsed += us; }
+
+// Console, a line at a time to modsim
+
+static char line[128];
+static uint8_t lineLength;
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  if (c == '\n' || lineLength == sizeof(line) - 1) {
+    line[lineLength] = 0;
+    if (host && host->console) host->console(simModuleId, line);
+    lineLength = 0;
+  }
+  if (c != '\n' && c != '\r') line[lineLength++] = c;
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++) write(buf[i]);
+  return len;
+}
+
+size_t HardwareSerial::print(const char *s)
+{
+  size_t n = 0;
+  while (*s) n += write(*s++);
+  return n;
+}
+
+size_t HardwareSerial::print(long v, int base)
+{
+  char buf[24];
+  if (base == DEC) snprintf(buf, sizeof(buf), "%ld", v);
+  else snprintf(buf, sizeof(buf), "%lx", v);
+  return print(buf);
+}
+
+void xprintf(const __FlashStringHelper *fmt, ...)
+{
+  char buf[64];   // same as console.cpp
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buf, sizeof(buf), (const char *)fmt, args);
+  va_end(args);
+  Serial.print(buf);
+}
+
+// Console input, memory checks and telemetry are not simulated
+
+void pollCLI() {}
+bool consoleActive() { return false; }
+void sysinfoClass::wipeRam() {}
+int sysinfoClass::freeRam() { return 0; }
+int sysinfoClass::unusedRam() { return 0; }
+int sysinfoClass::stackUsage() { return 0; }
+void sysinfoClass::dumpStats() {}
+void sysinfoClass::checkMemory() {}
+
+// ADC engine: each call gets a new sum of ADC_SAMPLES conversions of the knob position
+
+ADCEngineClass ADCEngine;
+
+void ADCEngineClass::start(const uint8_t *pins, uint8_t nbPins)
+{
+  nbChannels = min(nbPins, (uint8_t)ADC_MAX_CHANNELS);
+  memcpy(channels, pins, nbChannels);
+}
+
+void ADCEngineClass::stop()
+{
+  nbChannels = 0;
+}
+
+bool ADCEngineClass::getResult(uint8_t index, uint16_t &sum)
+{
+  if (index >= nbChannels) return false;
+  sum = analogRead(channels[index]) << ADC_SAMPLES_BITS;
+  return true;
+}
+
+void ADCEngineClass::isr() {}
+
+// Entry points
+
+void sim_init(const simHost_t *simHost, uint8_t moduleId)
+{
+  host = simHost;
+  simModuleId = moduleId;
+  for (uint8_t port = 0; port < sizeof(simPortIn); port++) simPortIn[port] = 0xFF;
+#ifdef STATIC_PIN_CONFIG
+  Module.loadStaticConfig();
+#else
+  // A new module configured from the console (ai, di... and w) and restarted: the pinconfig.h layout
+  // is saved to the EEPROM and read back by loadConfig(), as in setup()
+  if (!Module.loadConfig()) {
+    for (uint8_t t = 0; t < NB_PIN_TYPES; t++) {
+      vector<uint8_t> pins;
+      for (uint8_t i = 0; i < STATIC_NB_PINS; i++) {
+        if (staticPinConfig[i].pinType == t) pins.push_back(staticPinConfig[i].pinArduino);
+      }
+      Module.definePins((pinType_t)t, pins);
+    }
+    Module.setModuleId(moduleId);
+    Module.saveConfig();
+    Module.loadConfig();
+  }
+#endif
+  Module.setModuleId(moduleId);
+  setup_I2C();
+}
+
+void sim_set_time(unsigned long micros)
+{
+  now = micros;
+}
+
+unsigned long sim_busy()
+{
+  unsigned long busy = elapsed;
+  elapsed = 0;
+  return busy;
+}
+
+void sim_receive(const uint8_t *data, uint8_t length)
+{
+  length = min(length, (uint8_t)BUFFER_LENGTH);
+  memcpy(Wire.rxBuffer, data, length);
+  Wire.rxLength = length;
+  Wire.rxIndex = 0;
+  if (Wire.receiveHandler) Wire.receiveHandler(length);
+  elapsed += host->handlerMicros;
+}
+
+uint8_t sim_request(uint8_t *data, uint8_t length)
+{
+  Wire.txLength = 0;
+  if (Wire.requestHandler) Wire.requestHandler();
+  elapsed += host->handlerMicros;
+  length = min(length, Wire.txLength);
+  memcpy(data, Wire.txBuffer, length);
+  return length;
+}
+
+// loop() without the console, telemetry and the 10 ms delay, modsim calls it every 10 ms
+void sim_loop()
+{
+  if (!i2c_active) Module.detectConnections();
+  Module.updateAll();
+  if (i2c_active) updateAttention();
+}
+
+uint8_t sim_pins(uint8_t pinType, uint8_t *pins)
+{
+  vector<uint8_t> list = Module.getPins((pinType_t)pinType);
+  for (uint8_t i = 0; i < list.size(); i++) pins[i] = list[i];
+  return list.size();
+}
+
+void sim_set_input(uint8_t pin, uint8_t level)
+{
+  if (pin >= NUM_PINS || digitalPinToPort(pin) == NOT_A_PIN) return;
+  if (level) simPortIn[digitalPinToPort(pin)] |= digitalPinToBitMask(pin);
+  else simPortIn[digitalPinToPort(pin)] &= ~digitalPinToBitMask(pin);
+}
+
+uint8_t sim_get_output(uint8_t pin)
+{
+  if (pin >= NUM_PINS || digitalPinToPort(pin) == NOT_A_PIN) return HIGH;
+  return (simPortOut[digitalPinToPort(pin)] & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+
+void sim_set_analog(uint8_t pin, uint16_t value)
+{
+  if (pin < NUM_PINS) analogValues[pin] = value;
+}
+
+bool sim_attention()
+{
+  return pinModes[ATTN_PIN] == OUTPUT && sim_get_output(ATTN_PIN) == LOW;
+}
@@ -0,0 +1,396 @@
+// Module bus simulator: 1 to 126 diag01 modules running the real firmware (diag01.so, a host build of
+// ModuleClass, the pin tables and the I2C handlers of diag01.ino, see sim.h), on one simulated I2C bus
+// (simbus.h) driven by a master doing what arduino-poll.py and ModuleBus do:
+//   I2C_DETECT round (or 32 I2C_TICK with -t), then the attention line and I2C_ATTN_QUERY searches to
+//   find the modules with changes (or all modules with -p), and I2C_GET_CHANGES reads until the
+//   I2C_MORE_PENDING flag is clear.
+// Cables between socket outputs and inputs and knob positions change at random (-c, -k) or from a
+// script (-s); the master's view of the connections and knobs is checked against them at the end and
+// the program exits with an error if they differ.
+// Bus timing is in simbus.h, -u sets the time a module takes to handle a message besides its own delays.
+//
+// Build from the diag01 folder:
+//   g++ -O2 -std=gnu++11 -shared -fPIC -Wl,-Bsymbolic -DSTATIC_PIN_CONFIG -Ihost/modsim -Iinclude
+//     -o diag01.so host/modsim/mock.cpp src/module.cpp src/pinmapper.cpp src/pinhandler.cpp
+//     src/changeTracker.cpp src/nvmem.cpp src/telemetry.cpp -x c++ src/diag01.ino
+//   g++ -O2 -std=gnu++11 -o modsim host/modsim/modsim.cpp host/modsim/simbus.cpp -ldl
+// Without -DSTATIC_PIN_CONFIG the modules get the same pins through the EEPROM config instead.
+//
+// Usage: modsim [-l diag01.so] [-n modules] [-d seconds] [-f bus clock Hz] [-c cable changes/s]
+//               [-k knob moves/s] [-e bit error chance] [-m changes max size] [-u handler us]
+//               [-s script] [-t] [-p] [-v]
+// Script lines, times in ms from the start, modules by moduleId (1 to n), sockets and inputs by pinId:
+//   <ms> connect <out module> <out socket> <in module> <in socket>
+//   <ms> disconnect <in module> <in socket>
+//   <ms> knob <module> <input> <0-1023>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+#include "simbus.h"
+
+// diag01 commands and change report tags
+#define I2C_TICK               0
+#define I2C_GET_CHANGES        1
+#define I2C_REQUEST_FULLSTATE  2
+#define I2C_ATTN_QUERY         5
+#define I2C_DETECT             6
+#define I2C_SET_CONFIG         32
+
+#define I2C_TAG_ANALOG_VALUE   0b00000000
+#define I2C_TAG_DIGITAL_VALUE  0b01000000
+#define I2C_TAG_CONNECTION     0b10000000
+#define I2C_TAG_CONNECTION_16  0b11000000
+#define I2C_TAG_END            0b11111111
+#define I2C_TAG_MASK           0b11000000
+#define I2C_MORE_PENDING       0x01
+
+#define MODULE_ID_BITS 7
+#define PIN_ID_BITS 6
+#define MAX_FRAMES 8 // continuation frames read from a module in one pass, as arduino-poll.py
+
+#define SETTLE_MICROS 2000000 // after the run, without activity, before checking
+
+struct seen_t {
+  bool connected = false;
+  int moduleId = 0;
+  int pinId = 0;
+};
+
+// what the master has been told, per module
+struct view_t {
+  std::vector<seen_t> cables;
+  std::vector<int> knobs;
+};
+
+struct event_t {
+  double time;
+  char kind; // 'c' connect, 'd' disconnect, 'k' knob
+  int a, b, c, d;
+};
+
+static SimBus bus;
+static std::vector<view_t> views;
+static uint8_t changesMaxSize = 14;
+static bool verbose = false;
+static simHost_t host = { NULL, 40 };
+
+// statistics
+static unsigned long queries;
+static unsigned long reads;
+static unsigned long emptyReads;
+static unsigned long continuations;
+static unsigned long connectionReports;
+static unsigned long analogReports;
+static unsigned long digitalReports;
+static double connectionLatencySum, connectionLatencyMax;
+static unsigned long connectionLatencyCount;
+static double knobLatencySum, knobLatencyMax;
+static unsigned long knobLatencyCount;
+
+static void console(int moduleId, const char *line)
+{
+  if (verbose) printf("%10.3f ms  module %3d: %s\n", bus.now / 1000, moduleId, line);
+}
+
+static void seenConnection(int module, int pinId, bool connected, int fromModuleId, int fromPinId)
+{
+  connectionReports++;
+  if (pinId >= bus.modules[module].nbSocketIn) return;
+  seen_t &s = views[module].cables[pinId];
+  s.connected = connected;
+  s.moduleId = fromModuleId;
+  s.pinId = fromPinId;
+
+  double changed = bus.connectionReported(bus.modules[module].moduleId, pinId, connected, fromModuleId, fromPinId);
+  if (changed >= 0) {
+    double latency = bus.now - changed;
+    connectionLatencySum += latency;
+    connectionLatencyMax = std::max(connectionLatencyMax, latency);
+    connectionLatencyCount++;
+  }
+}
+
+static void seenAnalog(int module, int pinId, int value)
+{
+  analogReports++;
+  if (pinId >= bus.modules[module].nbAnalogIn) return;
+  views[module].knobs[pinId] = value;
+
+  double changed = bus.analogReported(bus.modules[module].moduleId, pinId, value);
+  if (changed >= 0) {
+    double latency = bus.now - changed;
+    knobLatencySum += latency;
+    knobLatencyMax = std::max(knobLatencyMax, latency);
+    knobLatencyCount++;
+  }
+}
+
+// same as parseChanges() in arduino-poll.py, returns true if the module has more waiting
+static bool parseChanges(int module, const uint8_t *pdu, uint8_t length)
+{
+  uint8_t ptr = 0;
+  while (ptr < length && pdu[ptr] != I2C_TAG_END) {
+    uint8_t tag = pdu[ptr] & I2C_TAG_MASK;
+    uint8_t pinId = pdu[ptr] & ~I2C_TAG_MASK;
+    if (tag == I2C_TAG_ANALOG_VALUE && ptr + 3 <= length) {
+      seenAnalog(module, pinId, pdu[ptr + 1] << 8 | pdu[ptr + 2]);
+      ptr += 3;
+    } else if (tag == I2C_TAG_DIGITAL_VALUE && ptr + 2 <= length) {
+      digitalReports++;
+      ptr += 2;
+    } else if (tag == I2C_TAG_CONNECTION && ptr + 3 <= length) {
+      seenConnection(module, pinId, pdu[ptr + 1] & 0x80, pdu[ptr + 1] & 0x7F, pdu[ptr + 2]);
+      ptr += 3;
+    } else if (tag == I2C_TAG_CONNECTION_16 && ptr + 4 <= length) {
+      seenConnection(module, pinId, pdu[ptr + 1] & 0x80, pdu[ptr + 1] & 0x7F, pdu[ptr + 2] << 8 | pdu[ptr + 3]);
+      ptr += 4;
+    } else {
+      break;
+    }
+  }
+  return ptr + 1 < length && pdu[ptr] == I2C_TAG_END && (pdu[ptr + 1] & I2C_MORE_PENDING);
+}
+
+// returns true if the module had changes
+static bool readChanges(int module)
+{
+  uint8_t command = I2C_GET_CHANGES;
+  uint8_t pdu[32];
+  for (int frame = 0; frame < MAX_FRAMES; frame++) {
+    bus.read(bus.modules[module].moduleId, &command, 1, pdu, changesMaxSize);
+    reads++;
+    if (frame == 0 && pdu[0] == I2C_TAG_END) {
+      emptyReads++;
+      return false;
+    }
+    if (!parseChanges(module, pdu, changesMaxSize)) break;
+    continuations++;
+  }
+  return true;
+}
+
+// same as dirtyModules() in arduino-poll.py
+static void dirtyModules(int first, int last, bool known, std::vector<int> &dirty)
+{
+  if (!known) {
+    uint8_t query[] = { I2C_ATTN_QUERY, bus.modules[first].moduleId, bus.modules[last].moduleId };
+    bus.broadcast(query, sizeof(query));
+    queries++;
+    if (!bus.attention()) return;
+  }
+  if (first == last) {
+    dirty.push_back(first);
+    return;
+  }
+  int middle = (first + last) / 2;
+  size_t before = dirty.size();
+  dirtyModules(first, middle, false, dirty);
+  dirtyModules(middle + 1, last, dirty.size() == before, dirty);
+}
+
+static void detectionRound(bool ticks)
+{
+  if (ticks) {
+    for (uint8_t tick = 0; tick < 32; tick++) {
+      uint8_t message[] = { I2C_TICK, tick };
+      bus.broadcast(message, sizeof(message));
+    }
+  } else {
+    uint8_t first[] = { I2C_DETECT, 0, PIN_ID_BITS };
+    bus.broadcast(first, sizeof(first));
+    for (uint8_t step = 1; step <= MODULE_ID_BITS + PIN_ID_BITS; step++) {
+      uint8_t message[] = { I2C_DETECT, step };
+      bus.broadcast(message, sizeof(message));
+    }
+  }
+}
+
+static bool loadScript(const char *path, std::vector<event_t> &events)
+{
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "can't open %s\n", path);
+    return false;
+  }
+  char line[256];
+  int lineNumber = 0;
+  while (fgets(line, sizeof(line), f)) {
+    lineNumber++;
+    char *hash = strchr(line, '#');
+    if (hash) *hash = 0;
+    double ms;
+    char command[16];
+    event_t e = { 0, 0, 0, 0, 0, 0 };
+    int n = sscanf(line, "%lf %15s %d %d %d %d", &ms, command, &e.a, &e.b, &e.c, &e.d);
+    if (n <= 0) continue;
+    e.time = ms * 1000;
+    if (n == 6 && !strcmp(command, "connect")) e.kind = 'c';
+    else if (n == 4 && !strcmp(command, "disconnect")) e.kind = 'd';
+    else if (n == 5 && !strcmp(command, "knob")) e.kind = 'k';
+    else {
+      fprintf(stderr, "%s:%d: bad line\n", path, lineNumber);
+      fclose(f);
+      return false;
+    }
+    events.push_back(e);
+  }
+  fclose(f);
+  std::stable_sort(events.begin(), events.end(), [](const event_t &a, const event_t &b) { return a.time < b.time; });
+  return true;
+}
+
+static void applyEvent(const event_t &e)
+{
+  switch (e.kind) {
+    case 'c': bus.connect(e.a, e.b, e.c, e.d, e.time); break;
+    case 'd': bus.disconnect(e.a, e.b, e.time); break;
+    case 'k': bus.knob(e.a, e.b, e.c, e.time); break;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const char *library = "./diag01.so";
+  const char *script = NULL;
+  int nbModules = 16;
+  double duration = 10;
+  double cableRate = 1;
+  double knobRate = 10;
+  bool ticks = false;
+  bool pollAll = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "l:n:d:f:c:k:e:m:u:s:tpv")) != -1) {
+    switch (opt) {
+      case 'l': library = optarg; break;
+      case 'n': nbModules = atoi(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      case 'f': bus.busClock = atof(optarg); break;
+      case 'c': cableRate = atof(optarg); break;
+      case 'k': knobRate = atof(optarg); break;
+      case 'e': bus.bitErrors = atof(optarg); break;
+      case 'm': changesMaxSize = atoi(optarg); break;
+      case 'u': host.handlerMicros = atol(optarg); break;
+      case 's': script = optarg; break;
+      case 't': ticks = true; break;
+      case 'p': pollAll = true; break;
+      case 'v': verbose = true; break;
+      default:
+        fprintf(stderr, "usage: %s [-l diag01.so] [-n modules] [-d seconds] [-f bus clock Hz] [-c cable changes/s]\n"
+          "  [-k knob moves/s] [-e bit error chance] [-m changes max size] [-u handler us] [-s script] [-t] [-p] [-v]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (nbModules < 1 || nbModules > 126) {
+    fprintf(stderr, "1 to 126 modules\n");
+    return 1;
+  }
+  if (changesMaxSize < 6 || changesMaxSize > 32) {
+    fprintf(stderr, "changes max size from 6 to 32\n");
+    return 1;
+  }
+
+  std::vector<event_t> events;
+  if (script) {
+    if (!loadScript(script, events)) return 1;
+    cableRate = knobRate = 0;
+  }
+
+  host.console = console;
+  srand(1);
+  if (!bus.begin(library, nbModules, &host)) return 1;
+  views.resize(nbModules);
+  for (int i = 0; i < nbModules; i++) {
+    views[i].cables.assign(bus.modules[i].nbSocketIn, seen_t());
+    views[i].knobs.assign(bus.modules[i].nbAnalogIn, -1);
+  }
+
+  printf("%d modules, %s, %.0f kHz, %.0f s, %s, %lu us per handler, %d byte change blocks\n", nbModules,
+    ticks ? "32 ticks" : "detection steps", bus.busClock / 1000, duration, pollAll ? "all modules read" : "attention line",
+    host.handlerMicros, changesMaxSize);
+  if (script) printf("script %s, %zu events\n", script, events.size());
+  else printf("%.2f cable changes/s, %.1f knob moves/s, bit error chance %g\n", cableRate, knobRate, bus.bitErrors);
+
+  uint8_t config[] = { I2C_SET_CONFIG, changesMaxSize };
+  bus.broadcast(config, sizeof(config));
+  uint8_t fullState[] = { I2C_REQUEST_FULLSTATE, 0 };
+  bus.broadcast(fullState, sizeof(fullState));
+  bus.setActivity(cableRate, knobRate);
+
+  double end = duration * 1000000;
+  size_t nextEvent = 0;
+  unsigned long cycles = 0;
+  unsigned long allCycles = 0; // with the settling time, for the per cycle bus figures
+  double maxCycle = 0;
+  double measuredTime = 0;
+  size_t lastDirty = 0;
+
+  while (bus.now < end + SETTLE_MICROS) {
+    bool active = bus.now < end;
+    while (nextEvent < events.size() && events[nextEvent].time <= bus.now) applyEvent(events[nextEvent++]);
+    if (active) bus.randomActivity();
+
+    double cycleStart = bus.now;
+    detectionRound(ticks);
+    if (!pollAll && lastDirty <= bus.modules.size() / 2) {
+      std::vector<int> dirty;
+      if (bus.attention()) dirtyModules(0, nbModules - 1, true, dirty);
+      for (int i : dirty) readChanges(i);
+      lastDirty = dirty.size();
+    } else {
+      lastDirty = 0;
+      for (int i = 0; i < nbModules; i++) lastDirty += readChanges(i);
+    }
+
+    allCycles++;
+    if (active) {
+      cycles++;
+      maxCycle = std::max(maxCycle, bus.now - cycleStart);
+      measuredTime = bus.now;
+    }
+  }
+
+  // the master's view after the settling time must match the cables and knobs
+  int wrongCables = 0, wrongKnobs = 0;
+  for (int module = 0; module < nbModules; module++) {
+    simModule_t &m = bus.modules[module];
+    for (int i = 0; i < m.nbSocketIn; i++) {
+      const simCable_t &c = m.cables[i];
+      const seen_t &s = views[module].cables[i];
+      bool ok = (c.module < 0) ? !s.connected :
+        (s.connected && s.moduleId == bus.modules[c.module].moduleId && s.pinId == c.socket);
+      if (!ok) {
+        wrongCables++;
+        if (verbose) printf("module %d socket %d: master sees %s %d/%d\n", m.moduleId, i, s.connected ? "connected to" : "disconnected", s.moduleId, s.pinId);
+      }
+    }
+    for (int i = 0; i < m.nbAnalogIn; i++) {
+      if (abs(views[module].knobs[i] - m.knobs[i]) > SIM_KNOB_TOLERANCE) {
+        wrongKnobs++;
+        if (verbose) printf("module %d input %d: master sees %d, knob at %d\n", m.moduleId, i, views[module].knobs[i], m.knobs[i]);
+      }
+    }
+  }
+
+  double seconds = measuredTime / 1000000;
+  printf("\ncycles      %lu, %.1f per second, %.3f ms avg, %.3f ms max\n", cycles, cycles / seconds,
+    cycles ? measuredTime / cycles / 1000 : 0, maxCycle / 1000);
+  printf("bus         %.1f%% busy, %.1f%% held by modules, %.1f transactions per cycle\n",
+    100 * bus.busBusy / bus.now, 100 * bus.stretched / bus.now, (double)bus.transactions / allCycles);
+  printf("reads       %lu, %.0f%% empty, %lu continuations, %.2f attention queries per cycle\n", reads,
+    reads ? 100.0 * emptyReads / reads : 0, continuations, (double)queries / allCycles);
+  printf("reports     %lu connections, %lu analog, %lu digital, %.1f per second\n", connectionReports, analogReports,
+    digitalReports, (connectionReports + analogReports + digitalReports) / (bus.now / 1000000));
+  printf("latency     connections %.2f ms avg, %.2f ms max (%lu), knobs %.2f ms avg, %.2f ms max (%lu)\n",
+    connectionLatencyCount ? connectionLatencySum / connectionLatencyCount / 1000 : 0, connectionLatencyMax / 1000,
+    connectionLatencyCount, knobLatencyCount ? knobLatencySum / knobLatencyCount / 1000 : 0, knobLatencyMax / 1000,
+    knobLatencyCount);
+  printf("check       %d wrong connections, %d wrong knobs\n", wrongCables, wrongKnobs);
+  return (wrongCables || wrongKnobs) ? 1 : 0;
+}
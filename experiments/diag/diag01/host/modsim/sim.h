@@ -0,0 +1,44 @@
+// Entry points of the host build of diag01 (diag01.so), used by modsim. Each module on the simulated
+// bus is a separate copy of the library, so the firmware's globals (Module, Wire, EEPROM...) are per
+// module as on the real boards.
+
+#pragma once
+#include <stdint.h>
+
+struct simHost_t {
+  void (*console)(int moduleId, const char *line); // a line printed on the module's serial console
+  unsigned long handlerMicros;                      // time a handler takes besides its own delays
+};
+
+extern "C" {
+  // Pin layout from pinconfig.h (through the EEPROM config when built without STATIC_PIN_CONFIG),
+  // with the given moduleId, then joins the bus like setup() does
+  void sim_init(const simHost_t *host, uint8_t moduleId);
+
+  // Time now on the bus, in us, for micros() and millis() in the next calls
+  void sim_set_time(unsigned long micros);
+  // Time the module spent in the calls since the last sim_busy(), in us
+  unsigned long sim_busy();
+
+  void sim_receive(const uint8_t *data, uint8_t length);  // Master wrote to the module (or broadcast)
+  uint8_t sim_request(uint8_t *data, uint8_t length);     // Master reads, returns the bytes the module wrote
+  void sim_loop();                                        // One run of the main loop, without the delay
+
+  uint8_t sim_pins(uint8_t pinType, uint8_t *pins);       // Arduino pins of a table, returns how many
+  void sim_set_input(uint8_t pin, uint8_t level);         // Level on a digital input (cable, pull-up)
+  uint8_t sim_get_output(uint8_t pin);                    // Level on a digital output
+  void sim_set_analog(uint8_t pin, uint16_t value);       // Knob position, 0 to 1023
+  bool sim_attention();                                   // Module pulls the attention line low
+}
+
+typedef void (*simInit_t)(const simHost_t *, uint8_t);
+typedef void (*simSetTime_t)(unsigned long);
+typedef unsigned long (*simBusy_t)();
+typedef void (*simReceive_t)(const uint8_t *, uint8_t);
+typedef uint8_t (*simRequest_t)(uint8_t *, uint8_t);
+typedef void (*simLoop_t)();
+typedef uint8_t (*simPins_t)(uint8_t, uint8_t *);
+typedef void (*simSetInput_t)(uint8_t, uint8_t);
+typedef uint8_t (*simGetOutput_t)(uint8_t);
+typedef void (*simSetAnalog_t)(uint8_t, uint16_t);
+typedef bool (*simAttention_t)();
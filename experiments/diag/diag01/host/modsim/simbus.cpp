@@ -0,0 +1,287 @@
+// Simulated module bus, see simbus.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <algorithm>
+
+#include "simbus.h"
+
+// pinType_t
+#define ANALOG_INPUT 0
+#define SOCKET_INPUT 3
+#define SOCKET_OUTPUT 4
+
+static double randomUnit()
+{
+  return (double)rand() / ((double)RAND_MAX + 1);
+}
+
+bool SimBus::begin(const char *library, int nbModules, const simHost_t *host)
+{
+  _host = host;
+  modules.resize(nbModules);
+  for (int i = 0; i < nbModules; i++) {
+    if (!loadModule(library, i + 1, modules[i])) return false;
+    modules[i].nextLoop = randomUnit() * SIM_LOOP_MICROS; // modules don't start at the same time
+  }
+  return true;
+}
+
+bool SimBus::loadModule(const char *library, uint8_t moduleId, simModule_t &m)
+{
+  // dlopen() only loads a library once, each module gets its own copy of the file
+  char path[] = "/tmp/modsimXXXXXX";
+  int out = mkstemp(path);
+  FILE *in = fopen(library, "rb");
+  if (out < 0 || !in) {
+    fprintf(stderr, "can't copy %s\n", library);
+    return false;
+  }
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    if (::write(out, buf, n) != (ssize_t)n) return false;
+  }
+  fclose(in);
+  close(out);
+  void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  unlink(path);
+  if (!lib) {
+    fprintf(stderr, "%s\n", dlerror());
+    return false;
+  }
+
+  simInit_t init = (simInit_t)dlsym(lib, "sim_init");
+  simPins_t pins = (simPins_t)dlsym(lib, "sim_pins");
+  m.setTime = (simSetTime_t)dlsym(lib, "sim_set_time");
+  m.busy = (simBusy_t)dlsym(lib, "sim_busy");
+  m.receive = (simReceive_t)dlsym(lib, "sim_receive");
+  m.request = (simRequest_t)dlsym(lib, "sim_request");
+  m.loop = (simLoop_t)dlsym(lib, "sim_loop");
+  m.setInput = (simSetInput_t)dlsym(lib, "sim_set_input");
+  m.getOutput = (simGetOutput_t)dlsym(lib, "sim_get_output");
+  m.setAnalog = (simSetAnalog_t)dlsym(lib, "sim_set_analog");
+  m.attention = (simAttention_t)dlsym(lib, "sim_attention");
+  if (!init || !pins || !m.setTime || !m.busy || !m.receive || !m.request || !m.loop || !m.setInput ||
+      !m.getOutput || !m.setAnalog || !m.attention) {
+    fprintf(stderr, "%s is not a diag01 simulator build\n", library);
+    return false;
+  }
+
+  m.moduleId = moduleId;
+  m.setTime(0);
+  init(_host, moduleId);
+  m.busy();
+  m.nbSocketIn = pins(SOCKET_INPUT, m.socketIn);
+  m.nbSocketOut = pins(SOCKET_OUTPUT, m.socketOut);
+  m.nbAnalogIn = pins(ANALOG_INPUT, m.analogIn);
+  m.cables.assign(m.nbSocketIn, simCable_t());
+  m.cableChanged.assign(m.nbSocketIn, -1);
+  m.knobs.assign(m.nbAnalogIn, 0);
+  m.knobChanged.assign(m.nbAnalogIn, -1);
+  return true;
+}
+
+int SimBus::findModule(int moduleId)
+{
+  for (size_t i = 0; i < modules.size(); i++) {
+    if (modules[i].moduleId == moduleId) return i;
+  }
+  return -1;
+}
+
+// levels on the socket inputs of a module: the output at the other end of the cable, or the pull-up
+void SimBus::readInputs(simModule_t &m, std::vector<uint8_t> &levels)
+{
+  levels.resize(m.nbSocketIn);
+  for (int i = 0; i < m.nbSocketIn; i++) {
+    const simCable_t &c = m.cables[i];
+    levels[i] = (c.module < 0) ? 1 : modules[c.module].getOutput(modules[c.module].socketOut[c.socket]);
+    if (bitErrors > 0 && randomUnit() < bitErrors) levels[i] ^= 1;
+  }
+}
+
+void SimBus::setInputs(simModule_t &m, const std::vector<uint8_t> &levels)
+{
+  for (int i = 0; i < m.nbSocketIn; i++) m.setInput(m.socketIn[i], levels[i]);
+}
+
+void SimBus::runLoops(double until)
+{
+  std::vector<uint8_t> levels;
+  for (simModule_t &m : modules) {
+    while (m.nextLoop <= until) {
+      readInputs(m, levels);
+      setInputs(m, levels);
+      m.setTime(m.nextLoop);
+      m.loop();
+      m.nextLoop += SIM_LOOP_MICROS + m.busy();
+    }
+  }
+}
+
+// transaction on the bus: waits for the module it goes to (all of them with -1, none with -2), then the
+// bits at the bus clock
+void SimBus::busTime(double bits, int module)
+{
+  double start = now;
+  if (module == -1) {
+    for (simModule_t &m : modules) start = std::max(start, m.busyUntil);
+  } else if (module >= 0) {
+    start = std::max(start, modules[module].busyUntil);
+  }
+  runLoops(start);
+  stretched += start - now;
+  double duration = bits * 1000000 / busClock;
+  busBusy += duration;
+  now = start + duration;
+  transactions++;
+}
+
+void SimBus::broadcast(const uint8_t *data, uint8_t length)
+{
+  busTime(1 + 9 * (1 + length) + 1, -1);
+
+  // all modules see the message at the same time, and read their inputs before any of them writes
+  std::vector<std::vector<uint8_t>> levels(modules.size());
+  for (size_t i = 0; i < modules.size(); i++) readInputs(modules[i], levels[i]);
+  for (size_t i = 0; i < modules.size(); i++) {
+    simModule_t &m = modules[i];
+    setInputs(m, levels[i]);
+    m.setTime(now);
+    m.receive(data, length);
+    m.busyUntil = now + m.busy();
+  }
+}
+
+bool SimBus::write(uint8_t address, const uint8_t *data, uint8_t length)
+{
+  int module = findModule(address);
+  if (module < 0) {
+    busTime(1 + 9 + 1, -2); // address NACKed
+    return false;
+  }
+  simModule_t &m = modules[module];
+  busTime(1 + 9 * (1 + length) + 1, module);
+  m.setTime(now);
+  m.receive(data, length);
+  m.busyUntil = now + m.busy();
+  return true;
+}
+
+// missing bytes read as 0xFF, the module doesn't drive SDA
+bool SimBus::read(uint8_t address, const uint8_t *txData, uint8_t txLength, uint8_t *rxData, uint8_t rxLength)
+{
+  int module = findModule(address);
+  memset(rxData, 0xFF, rxLength);
+  if (module < 0) {
+    busTime(1 + 9 + 1, -2);
+    return false;
+  }
+  simModule_t &m = modules[module];
+  busTime(1 + 9 * (1 + txLength) + 1 + 9 * (1 + rxLength) + 1, module);
+  m.setTime(now);
+  m.receive(txData, txLength);
+  m.request(rxData, rxLength);
+  m.busyUntil = now + m.busy();
+  return true;
+}
+
+bool SimBus::attention()
+{
+  runLoops(now);
+  for (simModule_t &m : modules) {
+    if (m.attention()) return true;
+  }
+  return false;
+}
+
+void SimBus::connect(int outModuleId, int outSocket, int inModuleId, int inSocket, double time)
+{
+  int from = findModule(outModuleId), to = findModule(inModuleId);
+  if (from < 0 || to < 0 || outSocket >= modules[from].nbSocketOut || inSocket >= modules[to].nbSocketIn) return;
+  modules[to].cables[inSocket].module = from;
+  modules[to].cables[inSocket].socket = outSocket;
+  modules[to].cableChanged[inSocket] = time;
+}
+
+void SimBus::disconnect(int inModuleId, int inSocket, double time)
+{
+  int to = findModule(inModuleId);
+  if (to < 0 || inSocket >= modules[to].nbSocketIn) return;
+  modules[to].cables[inSocket].module = -1;
+  modules[to].cableChanged[inSocket] = time;
+}
+
+void SimBus::knob(int moduleId, int input, int value, double time)
+{
+  int i = findModule(moduleId);
+  if (i < 0 || input >= modules[i].nbAnalogIn) return;
+  simModule_t &m = modules[i];
+  m.knobs[input] = std::min(std::max(value, 0), 1023);
+  m.knobChanged[input] = time;
+  m.setAnalog(m.analogIn[input], m.knobs[input]);
+}
+
+double SimBus::nextRandom(double rate)
+{
+  return rate > 0 ? now - log(1 - randomUnit()) / rate * 1000000 : INFINITY;
+}
+
+void SimBus::setActivity(double cableRate, double knobRate)
+{
+  _cableRate = cableRate;
+  _knobRate = knobRate;
+  _nextCable = nextRandom(cableRate);
+  _nextKnob = nextRandom(knobRate);
+}
+
+// a random input is unplugged if something is plugged in, or patched from a random output
+void SimBus::randomActivity()
+{
+  int nbModules = modules.size();
+  while (_nextCable <= now) {
+    simModule_t &to = modules[rand() % nbModules];
+    if (to.nbSocketIn) {
+      int in = rand() % to.nbSocketIn;
+      simModule_t &from = modules[rand() % nbModules];
+      if (to.cables[in].module >= 0) disconnect(to.moduleId, in, _nextCable);
+      else if (from.nbSocketOut) connect(from.moduleId, rand() % from.nbSocketOut, to.moduleId, in, _nextCable);
+    }
+    _nextCable = nextRandom(_cableRate);
+  }
+  while (_nextKnob <= now) {
+    simModule_t &m = modules[rand() % nbModules];
+    if (m.nbAnalogIn) knob(m.moduleId, rand() % m.nbAnalogIn, rand() % 1024, _nextKnob);
+    _nextKnob = nextRandom(_knobRate);
+  }
+}
+
+double SimBus::connectionReported(int moduleId, int pinId, bool connected, int fromModuleId, int fromPinId)
+{
+  int i = findModule(moduleId);
+  if (i < 0 || pinId >= modules[i].nbSocketIn) return -1;
+  simModule_t &m = modules[i];
+  const simCable_t &c = m.cables[pinId];
+  bool match = (c.module < 0) ? !connected :
+    (connected && modules[c.module].moduleId == fromModuleId && c.socket == fromPinId);
+  double changed = m.cableChanged[pinId];
+  if (!match || changed < 0) return -1;
+  m.cableChanged[pinId] = -1;
+  return changed;
+}
+
+double SimBus::analogReported(int moduleId, int pinId, int value)
+{
+  int i = findModule(moduleId);
+  if (i < 0 || pinId >= modules[i].nbAnalogIn) return -1;
+  simModule_t &m = modules[i];
+  double changed = m.knobChanged[pinId];
+  if (abs(value - m.knobs[pinId]) > SIM_KNOB_TOLERANCE || changed < 0) return -1;
+  m.knobChanged[pinId] = -1;
+  return changed;
+}
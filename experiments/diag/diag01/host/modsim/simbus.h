@@ -0,0 +1,98 @@
+// Simulated module bus for the host tools (modsim, modbusd): copies of diag01.so (see sim.h) on one I2C
+// bus, the cables between their socket outputs and inputs, and the knobs on their analog inputs.
+//
+// Time only moves with the bus: every transaction takes its bits at the bus clock (start, address and
+// data bytes with their ACK, repeated start, stop). A module handles a message after the stop condition,
+// for its own delays plus the host's handlerMicros, and the next transaction to it is held up until it
+// has finished (clock stretching); broadcasts wait for all modules. Modules read their socket inputs as
+// they were when the message arrived, before any of them writes the next bit. Each module runs its main
+// loop every 10 ms, with the modules' loops spread over the period.
+//
+// The bus knows when each cable and knob last changed, and tells the master when a report it decoded
+// matches the change, to measure how long it took.
+
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+#include "sim.h"
+
+#define SIM_LOOP_MICROS 10000
+#define SIM_KNOB_TOLERANCE 1 // LSB, reported value close enough to the knob position
+
+struct simCable_t {
+  int module = -1; // index of the module driving the input, -1 if nothing is plugged
+  int socket = 0;
+};
+
+struct simModule_t {
+  uint8_t moduleId;
+  simSetTime_t setTime;
+  simBusy_t busy;
+  simReceive_t receive;
+  simRequest_t request;
+  simLoop_t loop;
+  simSetInput_t setInput;
+  simGetOutput_t getOutput;
+  simSetAnalog_t setAnalog;
+  simAttention_t attention;
+
+  uint8_t socketIn[64], nbSocketIn;
+  uint8_t socketOut[64], nbSocketOut;
+  uint8_t analogIn[16], nbAnalogIn;
+
+  double busyUntil = 0;
+  double nextLoop = 0;
+
+  // what is plugged and where the knobs are, and when they last changed (-1 once reported)
+  std::vector<simCable_t> cables;
+  std::vector<double> cableChanged;
+  std::vector<uint16_t> knobs;
+  std::vector<double> knobChanged;
+};
+
+class SimBus {
+  public:
+    // loads nbModules copies of the library, moduleIds (and addresses) 1 to nbModules
+    bool begin(const char *library, int nbModules, const simHost_t *host);
+    int findModule(int moduleId); // index in modules, -1 if there is none
+
+    // master side, each call moves the time on by the transaction
+    void broadcast(const uint8_t *data, uint8_t length);
+    bool write(uint8_t address, const uint8_t *data, uint8_t length); // false if nobody ACKs the address
+    bool read(uint8_t address, const uint8_t *txData, uint8_t txLength, uint8_t *rxData, uint8_t rxLength); // write, repeated start, read
+    bool attention(); // attention line held low by a module
+    void runLoops(double until); // module loops due until then
+
+    // activity, time is when it happened (us)
+    void connect(int outModuleId, int outSocket, int inModuleId, int inSocket, double time);
+    void disconnect(int inModuleId, int inSocket, double time);
+    void knob(int moduleId, int input, int value, double time);
+    void setActivity(double cableRate, double knobRate); // random changes per second
+    void randomActivity(); // random changes due until now
+
+    // a report decoded by the master: time the change happened if it matches the cable or knob now and
+    // wasn't reported yet, -1 otherwise
+    double connectionReported(int moduleId, int pinId, bool connected, int fromModuleId, int fromPinId);
+    double analogReported(int moduleId, int pinId, int value);
+
+    std::vector<simModule_t> modules;
+    double now = 0; // us
+    double busClock = 400000;
+    double bitErrors = 0; // chance a socket input reads the wrong level
+
+    double busBusy = 0; // us with bits on the bus
+    double stretched = 0; // us the bus was held by modules
+    unsigned long transactions = 0;
+
+  private:
+    bool loadModule(const char *library, uint8_t moduleId, simModule_t &m);
+    void readInputs(simModule_t &m, std::vector<uint8_t> &levels);
+    void setInputs(simModule_t &m, const std::vector<uint8_t> &levels);
+    void busTime(double bits, int module);
+    double nextRandom(double rate);
+
+    const simHost_t *_host;
+    double _cableRate = 0, _knobRate = 0;
+    double _nextCable, _nextKnob;
+};
@@ -0,0 +1,224 @@
+// Reader for the diag01 binary telemetry stream (include/telemetry.h), decodes frames to CSV on stdout:
+//   time_us, frame, then per analog input aN_sample, aN_filtered, aN_reported (1/16 LSB),
+//   per digital input dN, per socket input sN_module, sN_pin, sN_connected
+// A new header line is written whenever the number of pins changes. Frames with a bad checksum are
+// skipped and the reader looks for the next sync byte. At the end, counts of frames, bad frames and
+// lost frames (gaps in the frame counter) go to stderr, with the average and largest sample interval.
+//
+// Build from the diag01 folder:
+//   g++ -O2 -o telemetry2csv host/telemetry2csv.cpp
+//
+// Usage: telemetry2csv [-d serial device] [-b baud] [-p period ms] [-n frames] [file]
+//   Reads the file, stdin if none, or the serial device. With -p, the stream is started first: the
+//   T command is sent at the console baud rate, then the line is switched to the telemetry baud rate.
+//   Ctrl-C (or -n frames) stops, and stops the stream on the module if it was started here.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <vector>
+
+#define TELEMETRY_SYNC      0xA5
+#define TELEMETRY_SAMPLE    0x01
+#define TELEMETRY_BAUD      500000
+#define CONSOLE_BAUD        9600
+
+static volatile bool stopping = false;
+
+static void onSignal(int)
+{
+  stopping = true;
+}
+
+static speed_t baudConstant(long baud)
+{
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 2000000: return B2000000;
+  }
+  return 0;
+}
+
+static bool setBaud(int fd, long baud)
+{
+  struct termios tio;
+  speed_t speed = baudConstant(baud);
+  if (!speed || tcgetattr(fd, &tio) < 0) return false;
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 2; // read() returns after 200 ms without data, to notice Ctrl-C
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+struct stats_t {
+  unsigned long frames = 0;
+  unsigned long bad = 0;
+  unsigned long lost = 0;
+  unsigned long intervals = 0;
+  double intervalSum = 0;
+  uint32_t maxInterval = 0;
+};
+
+static void printHeader(int nbAnalog, int nbDigital, int nbSocket)
+{
+  printf("time_us,frame");
+  for (int i = 0; i < nbAnalog; i++) printf(",a%d_sample,a%d_filtered,a%d_reported", i, i, i);
+  for (int i = 0; i < nbDigital; i++) printf(",d%d", i);
+  for (int i = 0; i < nbSocket; i++) printf(",s%d_module,s%d_pin,s%d_connected", i, i, i);
+  printf("\n");
+}
+
+// body is the type byte up to the checksum, length bytes before the checksum. False if it isn't a valid sample
+static bool decode(const uint8_t *body, int length, stats_t &stats)
+{
+  static int nbAnalog = -1, nbDigital = -1, nbSocket = -1;
+  static uint32_t lastTime;
+  static uint8_t lastFrame;
+
+  uint8_t sum = 0;
+  for (int i = 0; i <= length; i++) sum += body[i];
+  if (sum != 0 || length < 8 || body[0] != TELEMETRY_SAMPLE) return false;
+
+  uint32_t time = body[1] | body[2] << 8 | body[3] << 16 | (uint32_t)body[4] << 24;
+  uint8_t frame = body[5];
+  int a = body[6], d = body[7], s = body[8];
+  if (9 + a * 6 + (d + 7) / 8 + s * 3 != length) return false;
+
+  if (a != nbAnalog || d != nbDigital || s != nbSocket) {
+    nbAnalog = a;
+    nbDigital = d;
+    nbSocket = s;
+    printHeader(a, d, s);
+  } else if (stats.frames > 0) {
+    stats.lost += (uint8_t)(frame - lastFrame - 1);
+    uint32_t interval = time - lastTime; // micros() wraps, the difference doesn't
+    stats.intervals++;
+    stats.intervalSum += interval;
+    if (interval > stats.maxInterval) stats.maxInterval = interval;
+  }
+  stats.frames++;
+  lastTime = time;
+  lastFrame = frame;
+
+  const uint8_t *p = body + 9;
+  printf("%lu,%u", (unsigned long)time, frame);
+  for (int i = 0; i < a; i++, p += 6) printf(",%u,%u,%u", get16(p), get16(p + 2), get16(p + 4));
+  for (int i = 0; i < d; i++) printf(",%d", p[i / 8] >> (i % 8) & 1);
+  p += (d + 7) / 8;
+  for (int i = 0; i < s; i++, p += 3) printf(",%d,%u,%d", p[0] & 0x7F, get16(p + 1), p[0] >> 7);
+  printf("\n");
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  const char *device = NULL;
+  long baud = TELEMETRY_BAUD;
+  int period = 0;
+  long maxFrames = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:b:p:n:")) != -1) {
+    switch (opt) {
+      case 'd': device = optarg; break;
+      case 'b': baud = atol(optarg); break;
+      case 'p': period = atoi(optarg); break;
+      case 'n': maxFrames = atol(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-d serial device] [-b baud] [-p period ms] [-n frames] [file]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  int fd = 0;
+  if (device) {
+    fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0 || !setBaud(fd, period ? CONSOLE_BAUD : baud)) {
+      fprintf(stderr, "can't open %s at %ld baud\n", device, period ? CONSOLE_BAUD : baud);
+      return 1;
+    }
+    if (period) {
+      sleep(2); // opening the port resets the Nano
+      char command[32];
+      int length = snprintf(command, sizeof(command), "T %d %ld\n", period, baud);
+      if (write(fd, command, length) != length) return 1;
+      tcdrain(fd);
+      usleep(200000); // let the module answer and switch
+      setBaud(fd, baud);
+      tcflush(fd, TCIFLUSH);
+    }
+  } else if (optind < argc) {
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "can't open %s\n", argv[optind]);
+      return 1;
+    }
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  std::vector<uint8_t> stream;
+  stats_t stats;
+  uint8_t buf[512];
+
+  while (!stopping && (!maxFrames || (long)stats.frames < maxFrames)) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0) break;
+    if (n == 0) {
+      if (device) continue; // timeout
+      break; // end of file
+    }
+    stream.insert(stream.end(), buf, buf + n);
+
+    // sync byte, length, type up to checksum. After a bad frame, look for sync again from the byte
+    // after the false one, it may have been a value
+    size_t pos = 0;
+    while (pos < stream.size()) {
+      if (stream[pos] != TELEMETRY_SYNC) {
+        pos++;
+        continue;
+      }
+      if (pos + 2 > stream.size() || pos + 2 + stream[pos + 1] + 1 > stream.size()) break; // wait for the rest
+      if (decode(&stream[pos + 2], stream[pos + 1], stats)) {
+        pos += 2 + stream[pos + 1] + 1;
+      } else {
+        stats.bad++;
+        pos++;
+      }
+    }
+    stream.erase(stream.begin(), stream.begin() + pos);
+  }
+  fflush(stdout);
+
+  if (device && period) {
+    if (write(fd, "x", 1) != 1) fprintf(stderr, "couldn't stop the stream\n");
+    tcdrain(fd);
+  }
+
+  fprintf(stderr, "%lu frames, %lu bad, %lu lost", stats.frames, stats.bad, stats.lost);
+  if (stats.intervals)
+    fprintf(stderr, ", interval avg %.0f us, max %lu us", stats.intervalSum / stats.intervals, (unsigned long)stats.maxInterval);
+  fprintf(stderr, "\n");
+  return 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Background ADC acquisition: the ADC interrupt goes round all analog input pins, adding up
+// ADC_SAMPLES conversions of each before moving to the next, so the main loop never waits for a
+// conversion and gets oversampled values.
+// On the ATmega328 the samples are added up in the interrupt, and the first conversion after changing
+// channel is thrown away while the sample and hold settles. The ATmega4809 ADC accumulates by itself,
+// the interrupt only fires once per pin.
+// The ADC belongs to the engine while it runs, analogRead() must not be used.
+
+#define ADC_MAX_CHANNELS 16
+#define ADC_SAMPLES_BITS 4
+#define ADC_SAMPLES (1 << ADC_SAMPLES_BITS)   // sum of 16 10-bit samples still fits in 16 bits
+
+class ADCEngineClass {
+public:
+  void start(const uint8_t *pins, uint8_t nbPins);  // Start converting the given pins, in this order
+  void stop();
+  bool getResult(uint8_t index, uint16_t &sum);   // Return true if pins[index] has a new sum of ADC_SAMPLES samples since last call
+
+  void isr();
+
+private:
+  uint8_t channels[ADC_MAX_CHANNELS];
+  uint8_t nbChannels = 0;
+  uint8_t current = 0;        // index in channels of the conversions in progress
+  uint8_t sampleCount = 0;
+  uint16_t accumulator = 0;
+
+  volatile uint16_t results[ADC_MAX_CHANNELS];
+  volatile uint16_t ready = 0;    // bit field, one bit per channel with a result not yet read
+
+  void selectChannel();
+};
+
+extern ADCEngineClass ADCEngine;
@@ -6,3 +6,7 @@
 #define ATMEGA_4809
 #endif
 
+
+// Attention line shared by all modules and the I2C master (wired-OR, open drain, pulled up by the master).
+// A module pulls it low while it has changes the master hasn't read, see I2C_ATTN_QUERY.
+#define ATTN_PIN 12
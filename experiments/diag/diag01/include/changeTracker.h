@@ -0,0 +1,36 @@
+// Change tracking for the pins of a table, for any number of readers (I2C master, console...)
+//
+// Each reader has its own bit field of pins changed since it last looked, and a cursor: next() returns
+// the first changed pin at or after the cursor, so pins are handed out round robin and a reader that
+// only takes a few changes at a time doesn't starve the last pins. The bit fields are scanned a word
+// at a time with find-first-set, so it costs the number of changes, not the number of pins.
+// Storage is fixed size, no heap.
+
+#pragma once
+#include "Arduino.h"
+
+#define CHANGE_READERS      2       // Number of readers, see READER_xxx
+#define CHANGE_MAX_PINS     48      // Pins per table
+#define CHANGE_WORD_BITS    16
+#define CHANGE_WORDS        ((CHANGE_MAX_PINS + CHANGE_WORD_BITS - 1) / CHANGE_WORD_BITS)
+
+#define READER_I2C          0
+#define READER_CONSOLE      1
+
+class changeTracker
+{
+public:
+    changeTracker() { clear(); };
+
+    void clear();                               // Forget all changes and rewind cursors
+    void set(uint8_t id);                       // Pin changed, for all readers
+    void set(uint8_t id, uint8_t reader);       // Pin changed, for one reader only
+    bool any(uint8_t reader);                   // true if the reader has changes to read
+    int8_t next(uint8_t reader);                // Take the next changed pin for the reader, -1 if none
+
+private:
+    uint16_t pending[CHANGE_READERS][CHANGE_WORDS];
+    uint8_t cursor[CHANGE_READERS];
+
+    int8_t findFrom(uint8_t reader, uint8_t from);
+};
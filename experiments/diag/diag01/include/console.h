@@ -7,6 +7,8 @@
 
 #define printf please_use_xprintf
 
+#define CONSOLE_BAUD 9600
+
 #ifndef NO_FLASH_STRING
 void xprintf(const __FlashStringHelper*, ...);
 #else
@@ -14,4 +16,5 @@ void xprintf(const char*, ...);
 #endif
 
 
-extern void pollCLI();
\ No newline at end of file
+extern void pollCLI();
+extern bool consoleActive();  // a command is being typed, waits for confirmation or ran in the last pollCLI()
\ No newline at end of file
@@ -16,16 +16,19 @@ class ModuleClass {
   public:
     
   private:
-    typedef std::map<pinType_t, pinMapper_t *> mapTable_t;
-    mapTable_t mapTable;
+    // One pin table per type, indexed by pinType_t
+    pinMapper_t mapTable[NB_PIN_TYPES] = { analogInput, digitalInput, digitalOutput, socketInput, socketOutput, pwmOutput };
     uint8_t moduleId;
+    uint8_t pinIdBits = 6;
+
+    uint16_t detectRounds = 0;        // Connection detection rounds started
+    unsigned long roundStart = 0;
+    uint16_t roundMicros = 0;         // Smoothed time between two rounds
+    void startRound();
     
     void dumpPins(boolean showValues);
 
   public:
-    ModuleClass();
-    ~ModuleClass();
-
     // Module configuration
 
     void inline setModuleId(uint8_t moduleId) { this->moduleId = moduleId; };
@@ -36,34 +39,51 @@ class ModuleClass {
     vector<byte> getPins(pinType_t t);
 
     void dumpConfig();
+    #ifdef STATIC_PIN_CONFIG
+    void loadStaticConfig();    // Pin layout from pinconfig.h
+    #endif
 
     // EEPROM save/load
 
-    void saveConfig();
+    bool saveConfig();
     bool loadConfig();
-    bool checkConfig() { return NVMEM.CheckCRC(); };
+    bool checkConfig() { return NVMEM.OpenLatest(); };
     
     // I/O methods
 
     void updateAll();
-    void stepConnections(uint8_t stepNumber);
+    void stepConnections(uint8_t stepNumber);   // I2C_TICK: 32 ticks, write and read phase for each of 16 bits
+    void detectStep(uint8_t stepNumber);        // I2C_DETECT: one step per ID bit, plus one
     void detectConnections();
+    void setPinIdBits(uint8_t bits) { pinIdBits = constrain(bits, 1, MAX_PIN_ID_BITS); };
+    uint8_t getPinIdBits() { return pinIdBits; };
+    uint8_t getDetectSteps() { return MODULE_ID_BITS + pinIdBits + 1; };
+    uint16_t getDetectRounds() { return detectRounds; };
+    uint16_t getRoundMicros() { return roundMicros; };
+    bool getConnectionStats(uint8_t id, connectionStats_t &stats);   // Socket input id, false if there is none
+    void clearConnectionStats();
 
     uint16_t getValue(pinType_t t, uint8_t id) {
-      return (id < mapTable[t]->pinTable.size()) ? mapTable[t]->pinTable[id].getValue() : 0; 
+      return (id < mapTable[t].pinTable.size()) ? mapTable[t].pinTable[id].getValue() : 0; 
     };
     
     void setValue(pinType_t t, uint8_t id, uint16_t value) {
-      if (id < mapTable[t]->pinTable.size()) mapTable[t]->pinTable[id].setValue(value);
+      if (id < mapTable[t].pinTable.size()) mapTable[t].pinTable[id].setValue(value);
     };
     
-    uint8_t getNbPins(pinType_t t) { return mapTable[t] ? mapTable[t]->pinTable.size() : 0; }
+    uint8_t getNbPins(pinType_t t) { return mapTable[t].pinTable.size(); }
+    pinTable_t &getPinTable(pinType_t t) { return mapTable[t].pinTable; }
+
+    void setFilter(uint8_t id, filter_t filter) {
+      if (id < mapTable[analogInput].pinTable.size()) mapTable[analogInput].pinTable[id].setFilter(filter);
+    };
 
     // get changes
 
     bool getNextConnectionChange(connectionChangeEvent_t &event);
     bool getNextAnalogInputChange(valueChangeEvent_t &event);
     bool getNextDigitalInputChange(valueChangeEvent_t &event);
+    bool hasChanges();  // true if there is something left for the I2C master to read
 
     void requestFullState();
 
@@ -71,6 +91,8 @@ class ModuleClass {
     
     void dumpValues();
     void dumpChanges();
+    void dumpFilters();
+    void dumpConnectionStats();
     void blinkDigitalOutputs();
 };
 
@@ -3,36 +3,69 @@
 #include <EEPROM.h>
 #include <Arduino.h>
 
+// Config journal: each saveConfig() appends a new record after the previous one instead of rewriting
+// the EEPROM from offset 0, and records wrap around to the start when the end is reached, so writes are
+// spread over the whole EEPROM. A record is
+//   magic, version (2 bytes), sequence number (2 bytes), payload length, payload (TLV), CRC16 (2 bytes)
+// the CRC covering everything after the magic. The magic byte is written last, so a record interrupted
+// by a power cut is never taken for a valid one.
+// At boot, the chain of records is followed from offset 0 using the length fields, and only the record
+// with the highest sequence number is checked and read. If its CRC is bad the next newest is tried.
+
+#define NVMEM_MAGIC         0xC5
+#define NVMEM_HEADER_SIZE   6
+#define NVMEM_CRC_SIZE      2
+#define NVMEM_MAX_RECORD    128     // Header, payload and CRC
+
 class NVMEMClass {
 public:
-	bool CheckCRC(void);
-	void UpdateCRC(void);
+	bool OpenLatest(void);		// Find the latest valid record and get ready to read its payload
+	void BeginRecord(void);		// Get ready to write the payload of a new record
+	bool CommitRecord(void);	// Stamp the new record, false if the payload didn't fit
 
-	void rewind() { p = 0; };
-
-    template< typename T > T &get( T &t ){
+	// False, and t left alone, when the payload ends before it: the reader stops there
+	template< typename T > bool get( T &t ){
+		if (p + sizeof(T) > end) {
+			p = end;
+			return false;
+		}
 		EEPROM.get(p, t);
 		//xprintf(F("get(%d) => %d\n"), p, t);
 		p += sizeof(T);
-		return t;
-    }
-    
-    template< typename T > const T &put( const T &t ){
+		return true;
+	}
+
+	template< typename T > const T &put( const T &t ){
+		if (p + sizeof(T) > end) {
+			overflow = true;
+			return t;
+		}
 		EEPROM.put(p, t);
 		//xprintf(F("put(%d, %d)\n"), p, t);
 		p += sizeof(T);
 		return t;
-    }
+	}
 
-	bool eof()  { return p >= EEPROM.length(); }
+	bool eof()  { return p >= end; }
 
 private:
-	uint16_t p = 0;
-	uint16_t version;
-	const uint16_t _version = 0x07FC;
-	uint16_t eeprom_crc(uint16_t minus = 0);
+	uint16_t p = 0;				// Read/write pointer in the payload
+	uint16_t end = 0;			// End of the payload (read) or of the room left for it (write)
+	bool overflow = false;
+
+	bool scanned = false;		// Records have been looked for since boot
+	uint16_t start;				// Record being read or written
+	uint16_t next = 0;			// Where the next record goes, just after the latest one
+	uint16_t sequence = 0;		// Sequence number of the latest record
 
+	const uint16_t _version = 0x07FD;
+
+	uint16_t maxRecord() { return min((uint16_t)NVMEM_MAX_RECORD, (uint16_t)(EEPROM.length() / 2)); };
+	uint16_t recordSize(uint16_t offset) { return NVMEM_HEADER_SIZE + EEPROM[offset + 5] + NVMEM_CRC_SIZE; };
+	bool isHeader(uint16_t offset);
+	bool checkRecord(uint16_t offset);
+	bool findLatest(bool chain, bool limited, uint16_t below, uint16_t &offset, uint16_t &seq);
+	uint16_t crc(uint16_t from, uint16_t length);
 };
 
 extern NVMEMClass NVMEM;
-
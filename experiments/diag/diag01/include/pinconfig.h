@@ -0,0 +1,36 @@
+#pragma once
+
+// Pin layout fixed at compile time, used instead of the console/EEPROM configuration when built with
+// STATIC_PIN_CONFIG (nanoatmega328static environment). Pin tables then live in one static array sized
+// from this table, nothing is allocated on the heap, and the console can't change them.
+// Layout of the Nano module board, same pins as the commented out defaultConfig() in diag01.ino.
+
+#include "pinhandler.h"
+#include "adcengine.h"
+#include "changeTracker.h"
+
+#define STATIC_MODULE_ID 4
+
+typedef struct {
+  pinType_t pinType;
+  uint8_t pinArduino;
+} pinConfig_t;
+
+constexpr pinConfig_t staticPinConfig[] = {
+  { analogInput, A0 }, { analogInput, A1 }, { analogInput, A2 }, { analogInput, A3 }, { analogInput, A6 }, { analogInput, A7 },
+  { digitalInput, 2 }, { digitalInput, 3 },
+  { digitalOutput, 13 },
+  { socketInput, 4 }, { socketInput, 5 }, { socketInput, 6 }, { socketInput, 7 },
+  { socketOutput, 8 }, { socketOutput, 9 }, { socketOutput, 10 },
+};
+
+constexpr uint8_t STATIC_NB_PINS = sizeof(staticPinConfig) / sizeof(staticPinConfig[0]);
+
+constexpr uint8_t staticNbPins(pinType_t t, uint8_t i = 0)
+{
+  return (i >= STATIC_NB_PINS) ? 0 : (staticPinConfig[i].pinType == t) + staticNbPins(t, i + 1);
+}
+
+static_assert(staticNbPins(analogInput) <= ADC_MAX_CHANNELS, "too many analog inputs");
+static_assert(staticNbPins(digitalInput) <= CHANGE_MAX_PINS, "too many digital inputs");
+static_assert(staticNbPins(socketInput) <= CHANGE_MAX_PINS, "too many socket inputs");
@@ -10,23 +10,45 @@
 using namespace std;
 
 typedef enum { undefined=-1, analogInput, digitalInput, digitalOutput, socketInput, socketOutput, pwmOutput } pinType_t;
+#define NB_PIN_TYPES 6
 
 typedef struct {
   uint8_t moduleId;
-  uint8_t pinId;
+  uint16_t pinId;
   bool isConnected;
 } connection_t;
 
+// Connection IDs are sent one bit per step, moduleId (MODULE_ID_BITS) first then pinId (Module.getPinIdBits()).
+// An unconnected input reads all ones, which is never a valid ID since moduleId is at most 126.
+#define MODULE_ID_BITS 7
+#define MAX_PIN_ID_BITS 16    // Width of connection_t.pinId
+
+#define NO_PORT_GROUP 0xFF
+
+// Connection detection quality of a socket input, to see how reliable detection stays as ticks get faster.
+// A round is one complete ID read (I2C_TICK or I2C_DETECT steps). An ID is only taken once it has been
+// read in two rounds in a row, a glitch is an ID read in one round only.
+typedef struct {
+  uint16_t unconfirmed = 0;       // Rounds that read a different ID from the round before
+  uint16_t glitches = 0;          // IDs that were never read again in the next round
+  uint16_t confirmations = 0;     // New IDs confirmed (connections, disconnections, other module or pin)
+  uint16_t confirmRounds = 0;     // Rounds from the first read of a new ID to its confirmation, in total
+  uint8_t maxConfirmRounds = 0;
+} connectionStats_t;
+
 class connectionManager_t {
 public:
-  uint16_t serialBuffer = 0xFFFF;       // Store the ID for this pin for synchronous serial transmission/reception
-  uint16_t prevSerialBuffer = 0xFFFF;   // Used to confirm connection
-  uint16_t confirmedConnection = 0xFFFF;
+  uint32_t serialBuffer = 0xFFFFFFFF;     // Store the ID for this pin for synchronous serial transmission/reception
+  uint32_t prevSerialBuffer = 0xFFFFFFFF; // Used to confirm connection
+  uint32_t confirmedBuffer = 0xFFFFFFFF;  // Last ID read twice in a row
+  connection_t confirmedConnection = { 0, 0, false };
   bool isConnected = false;
   bool changed[2] = { false, false };   // we have to independant readers: I2C and console
+  connectionStats_t stats;
+  uint8_t changeRound = 0;              // Round the ID started changing, low byte of Module.getDetectRounds()
 
-  connection_t getConnection() { return { (uint8_t)(confirmedConnection >> 8), (uint8_t)(confirmedConnection & 0xFF), isConnected }; };
-  void setId(uint8_t pinId) { serialBuffer = pinId; };
+  connection_t getConnection() { return { confirmedConnection.moduleId, confirmedConnection.pinId, isConnected }; };
+  void setId(uint16_t pinId) { serialBuffer = pinId; };
 };
 
 typedef struct {
@@ -34,29 +56,54 @@ typedef struct {
   uint16_t currentValue = 0;    // Current Value for this pin
 } value_t;
 
+// Analog inputs go through a speed-adaptive low pass filter (1 euro filter): at rest the knob is
+// heavily smoothed, and the faster it moves the more of each new sample is taken, so sweeps don't lag.
+// alpha, out of 256, is the part of the difference between a new sample and the filtered value taken
+// on each ADC round: minAlpha + beta * speed / 16, speed being in LSB per ADC round.
+typedef struct {
+  uint8_t minAlpha = 8;   // Smoothing when the knob rests
+  uint8_t beta = 8;       // Smoothing decrease with speed
+} filter_t;
+
 struct pinHandler_t {
 protected:
   uint8_t pinArduino;           // Physical pin ID
   pinType_t pinType;
-  uint8_t pinId;
+  uint16_t pinId;               // Sent in the connection ID, as wide as connection_t.pinId
+  uint8_t portGroup = NO_PORT_GROUP;  // Index of the pin's port in pinMapper_t::portGroups (digital pins only)
+  uint8_t bitMask = 0;                // Bit of the pin in its port register
 
   connectionManager_t connection;
   value_t value;
 
   uint8_t debounceCounter = 0;
 
+  filter_t filter;
+  uint16_t lastSample = 0;      // Previous ADC sum, to measure the speed
+  int16_t speed = 0;            // Smoothed speed, in 1/16 LSB per ADC round
+  uint8_t stillRounds = 0;      // ADC rounds since the knob came to rest
+
   static uint8_t debounceDelay;       // Delay before successive read of digital input for debouncing
-  static uint8_t denoiseFilterCoeff;  // Anlog filter constant will 1<<analogFilterCoeff 
-  static uint8_t denoiseThreshold;    // Threshold for change detection of analog inputs
+  static uint8_t denoiseThreshold;    // Threshold for change detection of analog inputs, in 1/16 LSB
+  static uint8_t restSpeed;           // Speed under which an analog input is considered at rest
+  static uint8_t settleRounds;        // ADC rounds at rest before the settled value is reported
 
 public:
-  pinHandler_t(pinType_t pinType, uint8_t pinArduino, uint8_t pinId);
+  pinHandler_t() : pinArduino(0), pinType(undefined), pinId(0) {};
+  pinHandler_t(pinType_t pinType, uint8_t pinArduino, uint16_t pinId);
 
-  bool updateValue();   // Return true of value change
+  bool updateValue(uint8_t portValue);   // Return true of value change, portValue is the input register of the pin's port
   uint16_t getValue();
+  uint16_t getSample() { return lastSample; };             // Analog inputs: last ADC sum, 1/16 LSB
+  uint16_t getFiltered() { return value.currentValue; };  // Analog inputs: filtered value, 1/16 LSB
+  uint16_t getReported() { return value.prevValue; };     // Analog inputs: value of the last change reported, 1/16 LSB
   void setValue(uint8_t value);
   
   uint8_t getPinArduino() { return pinArduino; };
+  void setPortGroup(uint8_t group, uint8_t mask) { portGroup = group; bitMask = mask; };
+  uint8_t getPortGroup() { return portGroup; };
+  void setFilter(filter_t filter) { this->filter = filter; };
+  filter_t getFilter() { return filter; };
   #ifdef ATMEGA_4809
   String stringPinArduino() { return (pinType == analogInput) ?  ('A' + String(pinArduino)) : String(pinArduino); };
   #else
@@ -64,10 +111,12 @@ public:
   #endif
 
   connection_t getConnection();
+  connectionStats_t getConnectionStats() { return connection.stats; };
+  void clearConnectionStats() { connection.stats = connectionStats_t(); };
 
   //void setPin(uint8_t value) { digitalWrite(pinArduino, value); };
   //uint8_t getPin() { return digitalRead(pinArduino); };
 
-  void serialOut(uint16_t bitNumber);
-  bool serialIn(uint16_t bitNumber);    // Return true if connection change
+  uint8_t serialOut(uint8_t bitNumber, uint8_t pinIdBits);   // Return the pin's bit mask if the bit to write is 1, the caller writes the port
+  bool serialIn(uint8_t bitNumber, uint8_t nbBits, uint8_t portValue);    // Return true if connection change
 };
@@ -8,7 +8,7 @@
 #include <iterator>
 
 #include "pinhandler.h"
-#include "bitArray.h"
+#include "changeTracker.h"
 
 using namespace std;
 
@@ -22,32 +22,58 @@ typedef struct {
   connection_t from;
 } connectionChangeEvent_t;
 
-typedef vector<valueChangeEvent_t> valueChangeList_t;
-typedef vector<connectionChangeEvent_t> connectionChangeList_t;
+// Digital pins of a table grouped by port, so they can all be read with one read of the port's input
+// register, and written with one masked write of its output register, instead of a digitalRead() or
+// digitalWrite() per pin.
+#define MAX_PORT_GROUPS 6   // ports A to F on the ATmega4809, B to D on the ATmega328
+
+typedef struct {
+  uint8_t port;           // as returned by digitalPinToPort()
+  volatile uint8_t *in;   // input register (PINx, PORTx.IN)
+  volatile uint8_t *out;  // output register (PORTx, PORTx.OUT)
+  uint8_t mask;           // bits of the port used by the table
+  uint8_t value;          // last read of the input register
+} portGroup_t;
+
+
+// Pin handlers of a table: allocated in one block when pins are defined at run time (console, EEPROM),
+// or static storage sized at compile time with STATIC_PIN_CONFIG
+struct pinTable_t {
+  pinHandler_t *handlers = NULL;
+  uint8_t count = 0;
+  bool allocated = false;     // handlers comes from new[] and belongs to the table
+
+  pinHandler_t &operator[](uint8_t i) { return handlers[i]; };
+  uint8_t size() { return count; };
+};
 
 class pinMapper_t {
   protected:
     pinType_t pinType; 
     void printPinType();
+
+    portGroup_t portGroups[MAX_PORT_GROUPS];
+    uint8_t nbPortGroups = 0;
+    void definePortGroups();
+    void readPorts();
+    uint8_t portValue(uint8_t pinId);   // input register value of the pin's port, from the last readPorts()
   public:
-    typedef vector<pinHandler_t> pinTable_t;
     pinTable_t pinTable;
-    bitArray *pinChange[2]; // bit field to track pin state change, 2 tables, one for I2C and one for console
+    changeTracker changes;  // pin state changes, for each reader (I2C and console)
 
-    pinMapper_t(pinType_t pinType) { this->pinType = pinType; this->pinChange[0] = this->pinChange[1] = 0; }
+    pinMapper_t(pinType_t pinType) { this->pinType = pinType; }
     ~pinMapper_t();
 
     // Pins configuration
     void definePins(vector<uint8_t> pins);
+    void definePins(const uint8_t *pins, uint8_t nbPins, pinHandler_t *storage = NULL);  // storage for nbPins handlers, allocated if NULL
     vector<uint8_t> getPins();              // return current pins configuration
     uint8_t getNbPins() { return pinTable.size(); };
 
     // Methods to get changed values and connections
-    valueChangeList_t getValueChangeList(uint8_t readerIndex = 0);  // readerIndeswx should be one for console
-    connectionChangeList_t getConnectionChangeList(uint8_t readerIndex = 0);
-    
-    bool getNextValueChange(valueChangeEvent_t &event, uint8_t readerIndex = 0);
-    bool getNextConnectionChange(connectionChangeEvent_t &event, uint8_t readerIndex = 0);
+    bool getNextValueChange(valueChangeEvent_t &event, uint8_t readerIndex = READER_I2C);
+    bool getNextConnectionChange(connectionChangeEvent_t &event, uint8_t readerIndex = READER_I2C);
+    bool hasChanges(uint8_t readerIndex = READER_I2C) { return changes.any(readerIndex); };
 
     void requestFullState();  // Set all input state to change, used upon I2C client startup
 
@@ -56,10 +82,10 @@ class pinMapper_t {
     void dumpChanges();                     // Dump only pins that has changed
 
     // Input management methods
-    void updateAllPins();                   // Read value of all pins and update pinChange bitfields if change
+    void updateAllPins();                   // Read value of all pins and track the changes
 
     // Connections detection methods
-    void serialOut(uint8_t bitNumber);
-    void serialIn(uint8_t bitNumber);
+    void serialOut(uint8_t bitNumber, uint8_t pinIdBits);
+    void serialIn(uint8_t bitNumber, uint8_t nbBits);
 };
 
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Binary telemetry: instead of the console, the serial line carries a frame with the state of all
+// input pins every period, at a higher baud rate, for host side plotting (host/telemetry2csv.cpp).
+// Nothing is formatted on the module, a frame is copied from the pin tables and written as is.
+//
+// Frame, multi-byte values little endian:
+//   TELEMETRY_SYNC, length of what follows up to the checksum, TELEMETRY_SAMPLE,
+//   micros() when sampled (4 bytes), frame counter (1 byte, gaps are lost frames),
+//   number of analog inputs, of digital inputs and of socket inputs,
+//   per analog input: ADC sum, filtered value and last reported value (2 bytes each, 1/16 LSB),
+//   digital inputs, one bit each, pin 0 in bit 0 of the first byte,
+//   per socket input: from moduleId with bit 7 set if connected, from pinId (2 bytes),
+//   checksum, such that all bytes from the type to the checksum add up to 0.
+// The console is silent while streaming, any character received stops the stream and goes back to
+// CONSOLE_BAUD.
+// The inputs are read once per loop(), every LOOP_PERIOD_MS: a shorter period would only repeat
+// samples, so start() raises it to that.
+
+#define TELEMETRY_SYNC      0xA5
+#define TELEMETRY_SAMPLE    0x01
+#define TELEMETRY_BAUD      500000
+#define TELEMETRY_MAX_FRAME 255
+
+#define LOOP_PERIOD_MS      10
+
+class TelemetryClass {
+public:
+  void start(uint16_t periodMs, unsigned long baud = TELEMETRY_BAUD);
+  void stop();
+  bool isActive() { return active; };
+  void poll();    // Call from loop(), sends a frame when one is due
+
+private:
+  bool active = false;
+  uint16_t period;
+  unsigned long lastSample;
+  uint8_t frameCount;
+  uint8_t frame[TELEMETRY_MAX_FRAME + 3];
+};
+
+extern TelemetryClass Telemetry;
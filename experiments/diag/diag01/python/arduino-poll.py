@@ -7,12 +7,14 @@
 # /matrix/disconnect <dst_module> <dst_port> <src_module> <src_port>
 # /module/analog <module> <channel> <value>
 # /module/digital <module> <channel> <0|1>
+# /module/quality <module> <socket> <unconfirmed> <glitches> <confirmed> <avg rounds to confirm> <max rounds> <us per round>
 # 
 # *** Received by the control panel:
 #
 # /reset
 # /module/digital <module> <channel> <0|1>
 # /module/pwm <module> <channel> <value>
+# /quality                  (connection detection quality of all socket inputs, answered with /module/quality)
 
 import sys
 import time
@@ -29,16 +31,28 @@ import asyncio
 import smbus
 
 bus = smbus.SMBus(1)    # 0 = /dev/i2c-0 (port I2C0), 1 = /dev/i2c-1 (port I2C1)
-modules = [ 4 ];
+modules = [ 4 ];		# sorted by address
 
-changesMaxSize = 4*3    # Up to 4 changes
+# Attention line shared by the modules (ATTN_PIN in diag01), low while any of them has changes to report.
+# Set to the BCM GPIO number it is wired to, or None to poll every module after each detection round.
+ATTN_GPIO = None
+
+if ATTN_GPIO is not None:
+	import RPi.GPIO as GPIO
+	GPIO.setmode(GPIO.BCM)
+	GPIO.setup(ATTN_GPIO, GPIO.IN, pull_up_down=GPIO.PUD_UP)
+
+changesMaxSize = 4*3+2  # Up to 4 changes, end tag and flags
+maxFrames = 8           # Continuation frames read from a module in one polling pass
 
 # Received I2C messages
 I2C_TAG_ANALOG_VALUE   = 0b00000000
 I2C_TAG_DIGITAL_VALUE  = 0b01000000
 I2C_TAG_CONNECTION     = 0b10000000
+I2C_TAG_CONNECTION_16  = 0b11000000
 I2C_TAG_END            = 0b11111111
 I2C_TAG_MASK           = 0b11000000
+I2C_MORE_PENDING       = 0x01	# In the byte after I2C_TAG_END: read again
 
 # Transmitted I2C messages
 
@@ -47,11 +61,20 @@ I2C_GET_CHANGES        = 1
 I2C_REQUEST_FULLSTATE  = 2
 I2C_WRITE_DIGITAL	   = 3
 I2C_WRITE_PWM	       = 4
+I2C_ATTN_QUERY         = 5
+I2C_DETECT             = 6
+I2C_GET_QUALITY        = 7
 I2C_SET_CONFIG         = 32
 
+# Connection IDs are moduleId (7 bits) then pinId, one bit per detection step.
+# 6 bits of pinId are enough for the 63 pins a module can report.
+MODULE_ID_BITS = 7
+PIN_ID_BITS = 6
+
 def testConnections():
-	for tickNum in range(0, 32):
-		bus.write_byte_data(0, I2C_TICK, tickNum)
+	bus.write_i2c_block_data(0, I2C_DETECT, [ 0, PIN_ID_BITS ])
+	for step in range(1, MODULE_ID_BITS + PIN_ID_BITS + 1):
+		bus.write_byte_data(0, I2C_DETECT, step)
 	return
 
 def configureMessageSize():
@@ -60,39 +83,71 @@ def configureMessageSize():
 def requestFullState():
 	bus.write_byte_data(0, I2C_REQUEST_FULLSTATE, 0)
 
+# Modules in modules[first..last] with changes: ask only that range to hold the attention line,
+# and split it until single modules are left. If the first half is quiet, the second half must be
+# the one holding the line, no need to ask.
+def dirtyModules(first, last, known = False):
+	if not known:
+		bus.write_i2c_block_data(0, I2C_ATTN_QUERY, [ modules[first], modules[last] ])
+		if GPIO.input(ATTN_GPIO): return []
+	if first == last: return [ modules[first] ]
+	middle = (first + last) // 2
+	left = dirtyModules(first, middle)
+	return left + dirtyModules(middle + 1, last, left == [])
+
+# When more than half of the modules had changes last time, finding them costs more than reading them all
+lastDirty = 0
+
 def getChanges():
-	for addr in modules:
-		pdu = bus.read_i2c_block_data(addr, I2C_GET_CHANGES, changesMaxSize)
-		ptr = 0
-		while (pdu[ptr] != I2C_TAG_END and ptr < changesMaxSize):
-			oscMessage = []
-			tag = pdu[ptr] & I2C_TAG_MASK
-			if (tag == I2C_TAG_ANALOG_VALUE):
-				pinId = pdu[ptr] & ~I2C_TAG_MASK
-				value = (pdu[ptr+1] << 8) + pdu[ptr+2]
-				ptr += 3
-				#print("Analog m%dp%d = %d" % (addr, pinId, value))
-				oscMessage = [ "/module/analog", [addr, pinId, value/1024.0] ]
-			elif (tag == I2C_TAG_DIGITAL_VALUE):
-				pinId = pdu[ptr] & ~I2C_TAG_MASK
-				value = pdu[ptr+1]
-				ptr += 2
-				#print("Digital m%dp%d = %d" % (addr, pinId, value))
-				oscMessage = [ "/module/digital", [ addr, pinId, value ] ]
-			elif (tag == I2C_TAG_CONNECTION):
-				toModule = addr
-				toPort = pdu[ptr] & ~I2C_TAG_MASK
-				fromModule = pdu[ptr+1] & 0x7F
-				connected = pdu[ptr+1] & 0x80
+	global lastDirty
+	polled = modules
+	if ATTN_GPIO is not None and lastDirty <= len(modules) // 2:
+		if GPIO.input(ATTN_GPIO): return	# step 0 reset the range to all modules, nobody has anything
+		polled = dirtyModules(0, len(modules) - 1, True)
+	lastDirty = 0
+	for addr in polled:
+		for frame in range(maxFrames):
+			pdu = bus.read_i2c_block_data(addr, I2C_GET_CHANGES, changesMaxSize)
+			if (frame == 0 and pdu[0] != I2C_TAG_END): lastDirty += 1
+			if not parseChanges(addr, pdu): break
+
+# Send the records of a change report as OSC messages, return True if the module has more waiting
+def parseChanges(addr, pdu):
+	ptr = 0
+	while (ptr < len(pdu) and pdu[ptr] != I2C_TAG_END):
+		oscMessage = []
+		tag = pdu[ptr] & I2C_TAG_MASK
+		if (tag == I2C_TAG_ANALOG_VALUE):
+			pinId = pdu[ptr] & ~I2C_TAG_MASK
+			value = (pdu[ptr+1] << 8) + pdu[ptr+2]
+			ptr += 3
+			#print("Analog m%dp%d = %d" % (addr, pinId, value))
+			oscMessage = [ "/module/analog", [addr, pinId, value/1024.0] ]
+		elif (tag == I2C_TAG_DIGITAL_VALUE):
+			pinId = pdu[ptr] & ~I2C_TAG_MASK
+			value = pdu[ptr+1]
+			ptr += 2
+			#print("Digital m%dp%d = %d" % (addr, pinId, value))
+			oscMessage = [ "/module/digital", [ addr, pinId, value ] ]
+		elif (tag == I2C_TAG_CONNECTION or tag == I2C_TAG_CONNECTION_16):
+			toModule = addr
+			toPort = pdu[ptr] & ~I2C_TAG_MASK
+			fromModule = pdu[ptr+1] & 0x7F
+			connected = pdu[ptr+1] & 0x80
+			if (tag == I2C_TAG_CONNECTION):
 				fromPort = pdu[ptr+2]
 				ptr += 3
-				#if (connected): print("connected: m%dp%d -> m%dp%d" % (fromModule, fromPort, toModule, toPort))
-				#else: print("disconnected: m%dp%d -> m%dp%d" % (fromModule, fromPort, toModule, toPort))
-				if (connected): oscMessage = [ "/matrix/connect", [toModule, toPort, fromModule, fromPort] ]
-				else: 			oscMessage = [ "/matrix/disconnect" , [toModule, toPort, fromModule, fromPort] ]
-			if (oscMessage != []):
-				 print(oscMessage)
-				 client.send_message(oscMessage[0], oscMessage[1])
+			else:
+				fromPort = (pdu[ptr+2] << 8) + pdu[ptr+3]
+				ptr += 4
+			#if (connected): print("connected: m%dp%d -> m%dp%d" % (fromModule, fromPort, toModule, toPort))
+			#else: print("disconnected: m%dp%d -> m%dp%d" % (fromModule, fromPort, toModule, toPort))
+			if (connected): oscMessage = [ "/matrix/connect", [toModule, toPort, fromModule, fromPort] ]
+			else: 			oscMessage = [ "/matrix/disconnect" , [toModule, toPort, fromModule, fromPort] ]
+		if (oscMessage != []):
+			 print(oscMessage)
+			 client.send_message(oscMessage[0], oscMessage[1])
+	return ptr + 1 < len(pdu) and (pdu[ptr+1] & I2C_MORE_PENDING) != 0
 
 def digitalOutputHandler(address: str, *args: List[Any]) -> None:
 	print(address, args)
@@ -102,6 +157,24 @@ def pwmOutputHandler(address: str, *args: List[Any]) -> None:
 	print(address, args)
 	bus.write_i2c_block_data(args[0], I2C_WRITE_PWM, [ args[1], args[2] ])
 
+# Connection detection quality: select socket 0, then each read returns the next socket input of the
+# module, until it wraps back to 0. pinId 0xFF when the module has no socket inputs
+def getQuality():
+	for addr in modules:
+		bus.write_i2c_block_data(addr, I2C_GET_QUALITY, [ 0 ])
+		for socket in range(64):
+			q = bus.read_i2c_block_data(addr, I2C_GET_QUALITY, 14)
+			if q[0] == 0xFF or (socket > 0 and q[0] == 0): break
+			unconfirmed, glitches, confirmed, rounds = [ q[i] << 8 | q[i+1] for i in (1, 3, 5, 7) ]
+			roundMicros = q[10] << 8 | q[11]
+			average = rounds / confirmed if confirmed else 0
+			print("module %d socket %d: unconfirmed %d, glitches %d, confirmed %d, rounds to confirm %.1f/%d, %d us per round"
+				% (addr, q[0], unconfirmed, glitches, confirmed, average, q[9], roundMicros))
+			client.send_message("/module/quality", [ addr, q[0], unconfirmed, glitches, confirmed, average, q[9], roundMicros ])
+
+def qualityHandler(address: str, *args: List[Any]) -> None:
+	getQuality()
+
 def resetHandler(address: str, *args: List[Any]) -> None:
 	print("reset")
 	client.send_message("/matrix/reset", [])
@@ -129,6 +202,7 @@ if __name__ == "__main__":
 	dispatcher.map("/module/digital", digitalOutputHandler)
 	dispatcher.map("/module/pwm", pwmOutputHandler)
 	dispatcher.map("/reset", resetHandler)
+	dispatcher.map("/quality", qualityHandler)
 	dispatcher.set_default_handler(trashHandler)
 
 	#server = BlockingOSCUDPServer((server_ip, 9001), dispatcher)
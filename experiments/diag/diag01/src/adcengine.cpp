@@ -0,0 +1,102 @@
+#include "board.h"
+#include "adcengine.h"
+
+ADCEngineClass ADCEngine;
+
+#if defined(ATMEGA_4809)
+ISR(ADC0_RESRDY_vect)
+#else
+ISR(ADC_vect)
+#endif
+{
+  ADCEngine.isr();
+}
+
+void ADCEngineClass::start(const uint8_t *pins, uint8_t nbPins)
+{
+  stop();
+
+  nbChannels = 0;
+  for (uint8_t i = 0; i < nbPins && i < ADC_MAX_CHANNELS; i++) {
+    #if defined(ATMEGA_4809)
+    channels[nbChannels++] = digitalPinToAnalogInput(pins[i]);
+    #else
+    channels[nbChannels++] = (pins[i] >= A0) ? pins[i] - A0 : pins[i];
+    #endif
+  }
+  if (nbChannels == 0) return;
+
+  current = 0;
+  sampleCount = 0;
+  accumulator = 0;
+  ready = 0;
+  selectChannel();
+
+  #if defined(ATMEGA_4809)
+  ADC0.CTRLB = ADC_SAMPNUM_ACC16_gc;
+  ADC0.INTCTRL = ADC_RESRDY_bm;
+  ADC0.COMMAND = ADC_STCONV_bm;
+  #else
+  ADCSRA |= _BV(ADIE) | _BV(ADSC);    // ADC enabled and prescaler set by the Arduino core
+  #endif
+}
+
+void ADCEngineClass::stop()
+{
+  #if defined(ATMEGA_4809)
+  ADC0.INTCTRL = 0;
+  while (ADC0.COMMAND & ADC_STCONV_bm);
+  ADC0.CTRLB = ADC_SAMPNUM_ACC1_gc;
+  ADC0.INTFLAGS = ADC_RESRDY_bm;
+  #else
+  ADCSRA &= ~_BV(ADIE);
+  while (ADCSRA & _BV(ADSC));     // let a conversion in progress end, analogRead() would wait for it anyway
+  ADCSRA |= _BV(ADIF);
+  #endif
+}
+
+void ADCEngineClass::selectChannel()
+{
+  #if defined(ATMEGA_4809)
+  ADC0.MUXPOS = channels[current];
+  #else
+  ADMUX = (DEFAULT << 6) | (channels[current] & 0x07);
+  #endif
+}
+
+bool ADCEngineClass::getResult(uint8_t index, uint16_t &sum)
+{
+  if (index >= nbChannels) return false;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  bool isReady = ready & (1U << index);
+  sum = results[index];
+  ready &= ~(1U << index);
+  SREG = oldSREG;
+
+  return isReady;
+}
+
+void ADCEngineClass::isr()
+{
+  #if defined(ATMEGA_4809)
+  results[current] = ADC0.RES;    // also clears the interrupt flag
+  ready |= 1U << current;
+  if (++current >= nbChannels) current = 0;
+  selectChannel();
+  ADC0.COMMAND = ADC_STCONV_bm;
+  #else
+  uint16_t sample = ADC;
+  if (sampleCount > 0) accumulator += sample;   // first conversion after a channel change is thrown away
+  if (++sampleCount > ADC_SAMPLES) {
+    results[current] = accumulator;
+    ready |= 1U << current;
+    accumulator = 0;
+    sampleCount = 0;
+    if (++current >= nbChannels) current = 0;
+    selectChannel();
+  }
+  ADCSRA |= _BV(ADSC);
+  #endif
+}
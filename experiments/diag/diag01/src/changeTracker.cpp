@@ -0,0 +1,74 @@
+#include "changeTracker.h"
+
+// Readers take changes from the I2C interrupt as well as from the main loop, and pins change in
+// both too, so bit fields are only touched with interrupts off
+
+void changeTracker::clear()
+{
+    uint8_t oldSREG = SREG;
+    cli();
+    memset(pending, 0, sizeof(pending));
+    memset(cursor, 0, sizeof(cursor));
+    SREG = oldSREG;
+}
+
+void changeTracker::set(uint8_t id)
+{
+    if (id >= CHANGE_MAX_PINS) return;
+
+    uint8_t oldSREG = SREG;
+    cli();
+    for (uint8_t reader = 0; reader < CHANGE_READERS; reader++) {
+        pending[reader][id / CHANGE_WORD_BITS] |= 1U << (id % CHANGE_WORD_BITS);
+    }
+    SREG = oldSREG;
+}
+
+void changeTracker::set(uint8_t id, uint8_t reader)
+{
+    if (id >= CHANGE_MAX_PINS || reader >= CHANGE_READERS) return;
+
+    uint8_t oldSREG = SREG;
+    cli();
+    pending[reader][id / CHANGE_WORD_BITS] |= 1U << (id % CHANGE_WORD_BITS);
+    SREG = oldSREG;
+}
+
+bool changeTracker::any(uint8_t reader)
+{
+    for (uint8_t w = 0; w < CHANGE_WORDS; w++) {
+        if (pending[reader][w]) return true;
+    }
+    return false;
+}
+
+// First changed pin at or after from, -1 if none
+
+int8_t changeTracker::findFrom(uint8_t reader, uint8_t from)
+{
+    uint8_t w = from / CHANGE_WORD_BITS;
+    uint16_t word = pending[reader][w] & (0xFFFFU << (from % CHANGE_WORD_BITS));
+
+    while (true) {
+        if (word) return w * CHANGE_WORD_BITS + __builtin_ctz(word);
+        if (++w >= CHANGE_WORDS) return -1;
+        word = pending[reader][w];
+    }
+}
+
+int8_t changeTracker::next(uint8_t reader)
+{
+    if (reader >= CHANGE_READERS) return -1;
+
+    uint8_t oldSREG = SREG;
+    cli();
+    int8_t id = findFrom(reader, cursor[reader]);
+    if (id < 0 && cursor[reader] > 0) id = findFrom(reader, 0);   // wrap around
+    if (id >= 0) {
+        pending[reader][id / CHANGE_WORD_BITS] &= ~(1U << (id % CHANGE_WORD_BITS));
+        cursor[reader] = (id + 1 < CHANGE_MAX_PINS) ? id + 1 : 0;
+    }
+    SREG = oldSREG;
+
+    return id;
+}
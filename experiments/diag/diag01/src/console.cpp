@@ -7,6 +7,7 @@
 #include "module.h"
 #include "console.h"
 #include "sysinfo.h"
+#include "telemetry.h"
 
 extern bool trace_mode;
 
@@ -16,6 +17,8 @@ void xprintf(const __FlashStringHelper* fmt, ...)
 void xprintf(const char* fmt, ...)
 #endif
 {
+  if (Telemetry.isActive()) return;   // Serial line carries binary frames
+
   char buf[64];
   va_list args;
   va_start(args, fmt);
@@ -30,60 +33,23 @@ void xprintf(const char* fmt, ...)
   Serial.print(buf);
 }
 
-char readEcho()
-{
-    while (!Serial.available());
-    char c = Serial.read();
-    Serial.write(c);
-    return c;
-}
+// Console input is handled a character at a time from loop(), pollCLI() never waits for the serial line,
+// so pins, connections and I2C keep being served while a command is typed. Characters are echoed and
+// collected in a line buffer (backspace erases), the command runs on '\n'. Commands asking for a y/n
+// confirmation leave an action waiting, run or dropped on the next character.
 
-String readToken()
-{
-    String result;
-    bool done = false;
+#define CONSOLE_LINE_MAX 64
 
-    while (!done) {
-        char c = readEcho();
-        switch (c) {
-            case '\r':
-                done = true;
-                break;
-            case ' ':
-                if (result.length() > 0) done = true;
-                break;
-            default:
-                result += c;
-                break;
-        }
-    }
+static char line[CONSOLE_LINE_MAX];
+static uint8_t lineLength = 0;
 
-    return result;
-}
+static void (*confirmAction)() = NULL;  // waiting for y/n
+static uint8_t confirmArg;
+static bool busy = false;
 
-String readLine()
+static void confirm(void (*action)())
 {
-    String result;
-    bool done = false;
-
-    while (!done) {
-        char c = readEcho();
-        switch (c) {
-            case '\b':
-                result.remove(result.length()-1);
-                break;
-            case '\r':
-                break;
-            case '\n':
-                done = true;
-                break;
-            default:
-                result += c;
-                break;
-        }
-    }
-
-    return result;
+    confirmAction = action;
 }
 
 static void help() {
@@ -96,6 +62,10 @@ static void help() {
     Serial.println(F("m <moduId>:         set Module ID"));
     Serial.println(F("o <pin> <value> :   set digital output pin value"));
     Serial.println(F("p <pin> <value> :   set pwm output pin value"));
+    Serial.println(F("f:                  print analog input filters"));
+    Serial.println(F("f <pin> <min> <beta>: set analog input filter"));
+    Serial.println(F("q:                  print connection detection quality"));
+    Serial.println(F("q r:                reset connection detection quality"));
     Serial.println(F("ai <pin> <pin> ...: define analog inputs"));
     Serial.println(F("ao <pin> <pin> ...: define pwm ouputs"));
     Serial.println(F("di <pin> <pin> ...: define digital inputs"));
@@ -103,11 +73,17 @@ static void help() {
     Serial.println(F("si <pin> <pin> ...: define socket inputs"));
     Serial.println(F("so <pin> <pin> ...: define socket outputs"));
     Serial.println(F("w:                  write config to EEPROM"));
+    Serial.println(F("T <ms> [baud]:      stream binary telemetry, any key stops"));
 }
 
 static void definePins(String cmdline)
 {
     pinType_t pinType = undefined;
+
+    #ifdef STATIC_PIN_CONFIG
+    Serial.println(F("pins are fixed in this build (pinconfig.h)"));
+    return;
+    #endif
     
     switch (cmdline[0]) {
         case 'a':
@@ -152,6 +128,51 @@ static void setOutput(String cmdline)
     }
 }
 
+static void setFilter(String cmdline)
+{
+    char *buf = strdup(cmdline.c_str());
+
+    char *apin = strtok(buf+1, " ");
+    char *aminAlpha = strtok(NULL, " ");
+    char *abeta = strtok(NULL, " ");
+    if (!apin) {
+        Module.dumpFilters();
+    }
+    else if (aminAlpha && abeta) {
+        uint8_t pin = atoi(apin);
+        filter_t filter;
+        filter.minAlpha = atoi(aminAlpha);
+        filter.beta = atoi(abeta);
+        xprintf(F("analogInput[%d] filter <= %d %d\n"), pin, filter.minAlpha, filter.beta);
+        Module.setFilter(pin, filter);
+    }
+    else {
+        Serial.println(F("syntax error"));
+    }
+    free(buf);
+}
+
+static void startTelemetry(String cmdline)
+{
+    char *buf = strdup(cmdline.c_str());
+
+    char *aperiod = strtok(buf+1, " ");
+    char *abaud = strtok(NULL, " ");
+    if (aperiod) {
+        Telemetry.start(atoi(aperiod), abaud ? atol(abaud) : TELEMETRY_BAUD);
+    }
+    else {
+        Serial.println(F("syntax error"));
+    }
+    free(buf);
+}
+
+static void setModuleIdConfirmed()
+{
+    Module.setModuleId(confirmArg);
+    Serial.println(F("\nModule ID updated"));
+}
+
 static void setModuleId(String cmdline)
 {
     uint8_t moduleId = cmdline.substring(1).toInt();
@@ -162,42 +183,39 @@ static void setModuleId(String cmdline)
     }
 
     xprintf(F("Set Module ID to %d (y/n) ?"), moduleId);
-    if (readEcho() == 'y') {
-        Module.setModuleId(moduleId);
-        Serial.println(F("\nModule ID updated"));
-    }
-    else {
-        Serial.println(F("\nAbort"));
-    }
+    confirmArg = moduleId;
+    confirm(setModuleIdConfirmed);
+}
+
+static void writeConfigConfirmed()
+{
+    if (Module.saveConfig())
+        Serial.println(F("\nConfiguration saved"));
+    else
+        Serial.println(F("\nConfiguration not saved"));
 }
 
 static void writeConfig()
 {
     Serial.print(F("Save config (y/n) ?"));
-    if (readEcho() == 'y') {
-        Module.saveConfig();
-        Serial.println(F("\nConfiguration saved"));
-    }
-    else {
-        Serial.println(F("\nAbort"));
-    }
+    confirm(writeConfigConfirmed);
 }
 
-static void restartModule()
+static void restartModuleConfirmed()
 {
     void(* resetFunc) (void) = 0; //declare reset function @ address 0
 
+    Serial.print(F("Restarting module\n"));
+    delay(500);
+    Wire.end();
+    cli();
+    resetFunc();
+}
+
+static void restartModule()
+{
     Serial.print(F("Restart module (y/n) ?"));
-    if (readEcho() == 'y') {
-        Serial.print(F("Restarting module\n"));
-        delay(500);
-        Wire.end();
-        cli();
-        resetFunc();
-    }
-    else {
-        Serial.println(F("\nAbort"));
-    }
+    confirm(restartModuleConfirmed);
 }
 
 void toggleTrace()
@@ -208,12 +226,10 @@ void toggleTrace()
 }
 
 extern void I2C_dump_stats();
+extern void loop_dump_stats();
 
-void pollCLI()
+static void runCommand(String cmdline)
 {
-    if (!Serial.available()) return;
-    String cmdline = readLine();
-
     switch (cmdline[0]) {
         case 'd':
         case 'a':
@@ -224,9 +240,16 @@ void pollCLI()
         case 'p':
             setOutput(cmdline);
             break;
+        case 'f':
+            setFilter(cmdline);
+            break;
         case 'v':
             Module.dumpValues();
             break;
+        case 'q':
+            if (cmdline.indexOf('r') > 0) Module.clearConnectionStats();
+            Module.dumpConnectionStats();
+            break;
         case 'm':
             setModuleId(cmdline);
             break;
@@ -239,14 +262,72 @@ void pollCLI()
         case 'i':
             sysinfo.dumpStats();
             I2C_dump_stats();
+            loop_dump_stats();
             break;
         case 'R':
             restartModule();
+            break;
         case 't':
             toggleTrace();
             break;
+        case 'T':
+            startTelemetry(cmdline);
+            break;
         default:
             help();
             break;
     }
 }
+
+// Handles the characters received since the last call, at most one command is run
+void pollCLI()
+{
+    busy = lineLength > 0 || confirmAction;
+
+    if (Telemetry.isActive()) {
+        if (!Serial.available()) return;
+        while (Serial.available()) Serial.read();
+        Telemetry.stop();
+        busy = true;
+        return;
+    }
+
+    while (Serial.available()) {
+        char c = Serial.read();
+        Serial.write(c);
+        busy = true;
+
+        if (confirmAction) {
+            void (*action)() = confirmAction;
+            confirmAction = NULL;
+            if (c == 'y') action();
+            else Serial.println(F("\nAbort"));
+            return;
+        }
+
+        switch (c) {
+            case '\b':
+            case 0x7F:
+                if (lineLength > 0) {
+                    lineLength--;
+                    Serial.print(F(" \b"));
+                }
+                break;
+            case '\r':
+                break;
+            case '\n':
+                line[lineLength] = 0;
+                lineLength = 0;
+                runCommand(String(line));
+                return;
+            default:
+                if (lineLength < CONSOLE_LINE_MAX - 1) line[lineLength++] = c;
+                break;
+        }
+    }
+}
+
+bool consoleActive()
+{
+    return busy;
+}
@@ -5,16 +5,26 @@
 #include "module.h"
 #include "console.h"
 #include "sysinfo.h"
+#include "telemetry.h"
 
 void receiveEvent(int howMany);
 void requestEvent();
+void updateAttention();
 
 struct {
   uint16_t onReceiveCount = 0;
   uint16_t onRequestCount = 0;
   uint16_t stepConnectionsCount = 0;
+  uint16_t droppedConnectionsCount = 0;  // Connection changes of an input pinId that can't be reported
+  unsigned long stepMicrosTotal = 0;  // Time spent in connection detection steps, to compare builds
+  uint16_t stepMicrosMax = 0;
 } I2C_stats;
 
+// micros() only moves every 64 CPU cycles (4 us at 16 MHz): a step handler is a few ticks of it, so
+// the step times only tell builds apart when they differ by more than that. Counting cycles would take
+// Timer1, which drives PWM outputs.
+#define MICROS_RESOLUTION ((int)(64000000UL / F_CPU))
+
 void setup_I2C() {
 
   #if defined(ATMEGA_4809)
@@ -26,6 +36,7 @@ void setup_I2C() {
   #endif
   Wire.onReceive(receiveEvent);
   Wire.onRequest(requestEvent);
+  updateAttention();
 }
 
 void I2C_dump_stats() {
@@ -33,6 +44,11 @@ void I2C_dump_stats() {
     I2C_stats.onReceiveCount,
     I2C_stats.onRequestCount,
     I2C_stats.stepConnectionsCount);
+  xprintf(F("I2C: step avg=%dus, max=%dus (micros(), %dus resolution)\n"),
+    I2C_stats.stepConnectionsCount ? (int)(I2C_stats.stepMicrosTotal / I2C_stats.stepConnectionsCount) : 0,
+    I2C_stats.stepMicrosMax, MICROS_RESOLUTION);
+  if (I2C_stats.droppedConnectionsCount) xprintf(F("I2C: dropped connections=%d (input pinId too high)\n"),
+    I2C_stats.droppedConnectionsCount);
 }
 
 void defaultConfig()
@@ -47,12 +63,16 @@ void defaultConfig()
 
 void setup() {
   sysinfo.wipeRam();
-  Serial.begin(9600);
+  Serial.begin(CONSOLE_BAUD);
   xprintf(F("Starting\n"));
 
   // Loading config stored in EEPROM
 
+  #ifdef STATIC_PIN_CONFIG
+  Module.loadStaticConfig();
+  #else
   if (!Module.loadConfig()) defaultConfig();
+  #endif
 
   sysinfo.dumpStats();
   Module.dumpConfig();
@@ -66,7 +86,22 @@ uint16_t counter = 0;
 bool i2c_active = false;
 bool trace_mode = true;
 
+// Time loop() spends working (the delay left out), worst case since last shown, separately for the
+// loops where the console was in use
+struct {
+  unsigned long maxMicros = 0;
+  unsigned long maxMicrosConsole = 0;
+} loop_stats;
+
+void loop_dump_stats() {
+  xprintf(F("loop: max=%luus, max with console=%luus\n"), loop_stats.maxMicros, loop_stats.maxMicrosConsole);
+  loop_stats.maxMicros = 0;
+  loop_stats.maxMicrosConsole = 0;
+}
+
 void loop() {
+  unsigned long start = micros();
+
   // Poll socket connections every 100 ms
   // This is for standalone operation only
   // For production system, polling will be done via I2C broadcast messages
@@ -75,6 +110,12 @@ void loop() {
   // Read all pins physical levels
   Module.updateAll(); 
 
+  // Binary samples of all inputs, when streaming
+  Telemetry.poll();
+
+  // Raise or release the attention line for the changes just found
+  if (i2c_active) updateAttention();
+
   // Dump all changes (inputs level or socket connection);
   if (trace_mode) Module.dumpChanges();
 
@@ -87,10 +128,17 @@ void loop() {
   // I2C stats every second
   //if ((counter % 100) == 0) I2C_dump_stats();
 
-  delay(10);
-  counter += 1;
-
+  // Never waits for input, commands run once their line is complete
   pollCLI();
+
+  unsigned long elapsed = micros() - start;
+  if (elapsed > loop_stats.maxMicros) loop_stats.maxMicros = elapsed;
+  if (consoleActive() && elapsed > loop_stats.maxMicrosConsole) loop_stats.maxMicrosConsole = elapsed;
+
+  // Fixed loop period rather than a fixed delay after the work, so the 100 ms polls and telemetry
+  // frames keep their rate
+  if (elapsed < LOOP_PERIOD_MS * 1000UL) delayMicroseconds(LOOP_PERIOD_MS * 1000UL - elapsed);
+  counter += 1;
 }
 
 #define I2C_TICK               0
@@ -98,6 +146,9 @@ void loop() {
 #define I2C_REQUEST_FULLSTATE  2
 #define I2C_WRITE_DIGITAL	     3
 #define I2C_WRITE_PWM	         4
+#define I2C_ATTN_QUERY         5
+#define I2C_DETECT             6
+#define I2C_GET_QUALITY        7
 #define I2C_SET_CONFIG         32
 
 uint8_t message[8];
@@ -107,9 +158,43 @@ uint8_t I2C_tx_len = 0;
 
 uint8_t I2C_maxSize = 32;
 
+// Attention line: a module with unread changes pulls ATTN_PIN low, but only if its moduleId is in the
+// range of the last I2C_ATTN_QUERY broadcast (message[1] = first, message[2] = last moduleId).
+// When the line is high after the detection round, nobody has anything to report and the master skips polling.
+// When it's low, the master narrows the range down with queries to find the modules to read, so poll
+// traffic grows with the number of active modules rather than the number of modules on the bus.
+// Tick 0 and detection step 0 reset the range to all modules.
+
+uint8_t attnFirst = 0;
+uint8_t attnLast = 127;
+
+// Connection detection quality, one socket input per read: I2C_GET_QUALITY with message[1] = socket pinId
+// selects it, or without argument reads the next one, wrapping to 0 after the last
+uint8_t qualityPin = 0;
+
+void updateAttention()
+{
+  uint8_t moduleId = Module.getModuleId();
+  if (Module.hasChanges() && moduleId >= attnFirst && moduleId <= attnLast) {
+    digitalWrite(ATTN_PIN, LOW);
+    pinMode(ATTN_PIN, OUTPUT);
+  } else {
+    pinMode(ATTN_PIN, INPUT);  // open drain, released
+  }
+}
+
+void countStep(unsigned long start)
+{
+  uint16_t elapsed = micros() - start;
+  I2C_stats.stepConnectionsCount++;
+  I2C_stats.stepMicrosTotal += elapsed;
+  if (elapsed > I2C_stats.stepMicrosMax) I2C_stats.stepMicrosMax = elapsed;
+}
+
 void receiveEvent(int howMany) 
 {
   byte tickNum;
+  unsigned long start = micros();
   I2C_stats.onReceiveCount++;
   if (!i2c_active) trace_mode = false; // On first I2C activation, disable trace changes on console
   i2c_active = true;
@@ -122,14 +207,30 @@ void receiveEvent(int howMany)
   switch (message[0]) {
     case I2C_TICK:  // Tick message
       tickNum = message[1];
-      if (tickNum > 32) Serial.println(F("I2C: bad tickNum"));
+      if (tickNum > 32) xprintf(F("I2C: bad tickNum\n"));
+      if (tickNum == 0) {
+        attnFirst = 0;
+        attnLast = 127;
+      }
       Module.stepConnections(tickNum);
-      I2C_stats.stepConnectionsCount++;
+      countStep(start);
+      break;
+    case I2C_DETECT:  // Connection detection step, message[2] = number of pinId bits on step 0 (1 to MAX_PIN_ID_BITS)
+      if (message[1] == 0) {
+        if (howMany >= 3) Module.setPinIdBits(message[2]);
+        attnFirst = 0;
+        attnLast = 127;
+      }
+      Module.detectStep(message[1]);
+      countStep(start);
       break;
     case I2C_GET_CHANGES: // changes reporting
       break;
+    case I2C_GET_QUALITY: // connection detection quality
+      if (howMany >= 2) qualityPin = message[1];
+      break;
     case I2C_REQUEST_FULLSTATE:   // resend all states
-      Serial.println(F("I2C: request full state"));
+      xprintf(F("I2C: request full state\n"));
       Module.requestFullState();
       break;
     case I2C_WRITE_DIGITAL: // write digital 
@@ -140,14 +241,19 @@ void receiveEvent(int howMany)
       if (trace_mode) xprintf(F("I2C: set pwm %d %d\n"), message[1], message[2]);
       Module.setValue(pwmOutput, message[1], message[2]);
       break;
+    case I2C_ATTN_QUERY:  // Which modules need polling
+      attnFirst = message[1];
+      attnLast = message[2];
+      break;
     case I2C_SET_CONFIG:  // Configure I2C message size
-      I2C_maxSize = message[1];
+      I2C_maxSize = constrain(message[1], 6, 32);   // at least one record, END and flags, at most the Wire buffer
       xprintf(F("I2C: setting max size to %d\n"), I2C_maxSize);
       break;
     default:  // Space for other message types
       xprintf(F("I2C: unknown message type %d\n"), message[0]);
       break;
   }
+  updateAttention();
 }
 
 #define I2C_WRITE(b) { I2C_tx_len++; Wire.write(b); }
@@ -155,24 +261,55 @@ void receiveEvent(int howMany)
 #define I2C_TAG_ANALOG_VALUE   0b00000000
 #define I2C_TAG_DIGITAL_VALUE  0b01000000
 #define I2C_TAG_CONNECTION     0b10000000
+#define I2C_TAG_CONNECTION_16  0b11000000
 #define I2C_TAG_END            0b11111111
 
+// The low 6 bits of the tag byte carry the pinId of the reporting module. pinId 63 can't be used:
+// with I2C_TAG_CONNECTION_16 it gives 0xFF, read as I2C_TAG_END, and the rest of the frame is lost.
+// Connection changes of a higher input pinId are dropped and counted in I2C_stats.
+#define I2C_MAX_PINID          62
+
+// A change report is a list of records in priority order, connections first, then digital inputs,
+// then analog inputs, followed by I2C_TAG_END and a flags byte. When everything didn't fit in
+// I2C_maxSize, I2C_MORE_PENDING is set in the flags and the master reads again straight away,
+// the next frame carrying on where this one stopped. Analog values are coalesced: a knob that moved
+// several times since the last read is sent once, with its current value.
+#define I2C_MORE_PENDING       0x01
+
+#define I2C_ROOM(len) (I2C_tx_len + (len) + 2 <= I2C_maxSize)  // room for a record and the end of frame
+
 // For connections, reporting the format is a list of 3 bytes long records, ended by 0xFF
 // record[0] = to pinId + I2C_TAG_CONNECTION
 // record[1] = from moduleId + bit 7 = connection
 // record[2] = from pinId
 // moduleId should be <= 126
-// pinId should be < 63
+// pinId <= I2C_MAX_PINID
+// If from pinId doesn't fit in a byte (more than 8 pinId bits), the record is 4 bytes long:
+// record[0] = to pinId + I2C_TAG_CONNECTION_16
+// record[1] = from moduleId + bit 7 = connection
+// record[2] = from pinId high 8 bits
+// record[3] = from pinId low 8 bits
 
 void reportConnections()
 {
   
-  while (I2C_tx_len < I2C_maxSize - 3) {
+  while (I2C_ROOM(4)) {
     connectionChangeEvent_t event;
     if (!Module.getNextConnectionChange(event)) break;  // No more connection change to send over I2C
-    I2C_WRITE(event.pinId | I2C_TAG_CONNECTION);
-    I2C_WRITE(event.from.moduleId + (event.from.isConnected ? 0x80 : 00));
-    I2C_WRITE(event.from.pinId);
+    if (event.pinId > I2C_MAX_PINID) {
+      I2C_stats.droppedConnectionsCount++;
+      continue;
+    }
+    if (event.from.pinId > 0xFF) {
+      I2C_WRITE(event.pinId | I2C_TAG_CONNECTION_16);
+      I2C_WRITE(event.from.moduleId + (event.from.isConnected ? 0x80 : 00));
+      I2C_WRITE(highByte(event.from.pinId));
+      I2C_WRITE(lowByte(event.from.pinId));
+    } else {
+      I2C_WRITE(event.pinId | I2C_TAG_CONNECTION);
+      I2C_WRITE(event.from.moduleId + (event.from.isConnected ? 0x80 : 00));
+      I2C_WRITE(event.from.pinId);
+    }
   }
 }
 
@@ -184,7 +321,7 @@ void reportConnections()
 
 void reportAnalogInputs()
 { 
-  while (I2C_tx_len < I2C_maxSize - 3) {
+  while (I2C_ROOM(3)) {
     valueChangeEvent_t event;
     if (!Module.getNextAnalogInputChange(event)) break;  // No more connection change to send over I2C
     I2C_WRITE(event.pinId | I2C_TAG_ANALOG_VALUE);
@@ -200,7 +337,7 @@ void reportAnalogInputs()
 
 void reportDigitalInputs()
 { 
-  while (I2C_tx_len < I2C_maxSize - 2) {
+  while (I2C_ROOM(2)) {
     valueChangeEvent_t event;
     if (!Module.getNextDigitalInputChange(event)) break;  // No more connection change to send over I2C
     I2C_WRITE(event.pinId | I2C_TAG_DIGITAL_VALUE);
@@ -208,17 +345,58 @@ void reportDigitalInputs()
   }
 }
 
+// Connection detection quality of a socket input, 14 bytes:
+// record[0] = socket pinId, 0xFF if the module has no socket inputs
+// record[1..2] = rounds that read a different ID from the round before
+// record[3..4] = IDs read in one round only (glitches)
+// record[5..6] = new IDs confirmed
+// record[7..8] = rounds from the first read of a new ID to its confirmation, in total (average is this / record[5..6])
+// record[9] = most rounds to confirm an ID
+// record[10..11] = smoothed time between two detection rounds, in us
+// record[12..13] = detection rounds since startup, low 16 bits
+// 16 bit values high byte first
+
+void reportQuality()
+{
+  connectionStats_t stats;
+  if (!Module.getConnectionStats(qualityPin, stats)) qualityPin = 0;
+  bool found = Module.getConnectionStats(qualityPin, stats);
+
+  I2C_WRITE(found ? qualityPin : 0xFF);
+  I2C_WRITE(highByte(stats.unconfirmed));
+  I2C_WRITE(lowByte(stats.unconfirmed));
+  I2C_WRITE(highByte(stats.glitches));
+  I2C_WRITE(lowByte(stats.glitches));
+  I2C_WRITE(highByte(stats.confirmations));
+  I2C_WRITE(lowByte(stats.confirmations));
+  I2C_WRITE(highByte(stats.confirmRounds));
+  I2C_WRITE(lowByte(stats.confirmRounds));
+  I2C_WRITE(stats.maxConfirmRounds);
+  I2C_WRITE(highByte(Module.getRoundMicros()));
+  I2C_WRITE(lowByte(Module.getRoundMicros()));
+  I2C_WRITE(highByte(Module.getDetectRounds()));
+  I2C_WRITE(lowByte(Module.getDetectRounds()));
+  qualityPin++;
+}
+
 void requestEvent()
 {
   I2C_stats.onRequestCount++;
+  if (message[0] == I2C_GET_QUALITY) {
+    I2C_tx_len = 0;
+    reportQuality();
+    return;
+  }
   if (message[0] != 1) return;
 
   I2C_tx_len = 0;
 
-  reportAnalogInputs();
-  reportDigitalInputs();
   reportConnections();
+  reportDigitalInputs();
+  reportAnalogInputs();
+
+  I2C_WRITE(I2C_TAG_END);
+  I2C_WRITE(Module.hasChanges() ? I2C_MORE_PENDING : 0);
 
-  if (I2C_tx_len < I2C_maxSize) I2C_WRITE(I2C_TAG_END);
-  if (I2C_tx_len < I2C_maxSize) I2C_WRITE(I2C_TAG_END);
+  updateAttention();  // stays low if not everything fitted
 }
\ No newline at end of file
@@ -7,24 +7,29 @@
 
 ModuleClass Module;
 
-ModuleClass::ModuleClass()
-{
-  vector<pinType_t> pinTypeList = {analogInput, pwmOutput, digitalInput, digitalOutput, socketInput, socketOutput};
+#ifdef STATIC_PIN_CONFIG
+#include "pinconfig.h"
 
-  for (uint8_t i = 0; i < pinTypeList.size(); i++)
-  {
-    mapTable[pinTypeList[i]] = new pinMapper_t(pinTypeList[i]);
-  }
-}
+static pinHandler_t staticPins[STATIC_NB_PINS];   // All pin tables, one after the other
 
-ModuleClass::~ModuleClass()
+void ModuleClass::loadStaticConfig()
 {
-  mapTable_t::iterator it;
-  for (it = mapTable.begin(); it != mapTable.end(); it++)
+  moduleId = STATIC_MODULE_ID;
+
+  uint8_t first = 0;
+  for (uint8_t t = 0; t < NB_PIN_TYPES; t++)
   {
-    delete it->second;
+    uint8_t pins[STATIC_NB_PINS];
+    uint8_t nbPins = 0;
+    for (uint8_t i = 0; i < STATIC_NB_PINS; i++)
+    {
+      if (staticPinConfig[i].pinType == t) pins[nbPins++] = staticPinConfig[i].pinArduino;
+    }
+    mapTable[t].definePins(pins, nbPins, &staticPins[first]);
+    first += nbPins;
   }
 }
+#endif
 
 // Config is now stored in TLV format
 
@@ -32,6 +37,7 @@ typedef enum
 {
   tagModuleId = 0,
   tagPin = 1,
+  tagFilter = 2,
   tagEnd = 0xFF
 } nvramTag_t;
 
@@ -41,11 +47,9 @@ typedef enum
     NVMEM.put((uint8_t)(L)); \
   }
 
-void ModuleClass::saveConfig()
+bool ModuleClass::saveConfig()
 {
-  mapTable_t::iterator it;
-
-  NVMEM.rewind();
+  NVMEM.BeginRecord();
 
   // Write moduleId
 
@@ -54,17 +58,28 @@ void ModuleClass::saveConfig()
 
   // Write config for each pin
 
-  for (it = mapTable.begin(); it != mapTable.end(); it++)
+  for (uint8_t t = 0; t < NB_PIN_TYPES; t++)
   {
-    vector<uint8_t> pins = it->second->getPins();
+    vector<uint8_t> pins = mapTable[t].getPins();
     PUT_TL(tagPin, 1 + pins.size()); // write head for TLV
-    NVMEM.put((uint8_t)it->first);   // write pin type
+    NVMEM.put(t);                    // write pin type
     for (uint8_t i = 0; i < pins.size(); i++)
       NVMEM.put(pins[i]); // write each pin
   }
 
+  // Write analog input filters, after the pins they apply to
+
+  pinTable_t &analogPins = mapTable[analogInput].pinTable;
+  PUT_TL(tagFilter, 2 * analogPins.size());
+  for (uint8_t i = 0; i < analogPins.size(); i++)
+  {
+    filter_t filter = analogPins[i].getFilter();
+    NVMEM.put(filter.minAlpha);
+    NVMEM.put(filter.beta);
+  }
+
   PUT_TL(tagEnd, 0);
-  NVMEM.UpdateCRC(); // Stamp EEPROM content with consistency check
+  return NVMEM.CommitRecord(); // Stamp the record with its sequence number and CRC
 }
 
 bool ModuleClass::loadConfig()
@@ -72,16 +87,14 @@ bool ModuleClass::loadConfig()
   bool end = false;
 
   if (!checkConfig())
-    return false; // EEPROM content is invalid
-
-  NVMEM.rewind();
+    return false; // No valid record in EEPROM
 
   while (!end && !NVMEM.eof())
   {
-    uint8_t tag;
-    uint8_t len;
-    NVMEM.get(tag);
-    NVMEM.get(len);
+    uint8_t tag = tagEnd;
+    uint8_t len = 0;
+    if (!NVMEM.get(tag) || !NVMEM.get(len))
+      break; // Payload ends in the middle of a tag, same as tagEnd
 
     //xprintf(F("tag=%d len=%d\n"), tag, len);
 
@@ -93,19 +106,39 @@ bool ModuleClass::loadConfig()
 
     case tagPin:
       {
-        uint8_t pinType;
-        NVMEM.get(pinType); // read pin type
-        vector<uint8_t> pins(len-1);
+        uint8_t pinType = 0;
+        if (len == 0 || !NVMEM.get(pinType)) // read pin type
+        {
+          end = true;
+          break;
+        }
+        vector<uint8_t> pins;
         for (uint8_t i = 0; i < len-1; i++)
         {
-          uint8_t pinArduino;
-          NVMEM.get(pinArduino); // read each pin
-          pins[i] = pinArduino;
+          uint8_t pinArduino = 0;
+          if (!NVMEM.get(pinArduino)) // read each pin
+            break;
+          pins.push_back(pinArduino);
+        }
+        if (pins.size() < (uint8_t)(len-1))
+        {
+          end = true; // Truncated, the pins of this type are left as they are
+          break;
         }
         definePins((pinType_t)pinType, pins);
       }
       break;
 
+    case tagFilter:
+      for (uint8_t i = 0; i < len / 2; i++)
+      {
+        filter_t filter;
+        if (!NVMEM.get(filter.minAlpha) || !NVMEM.get(filter.beta))
+          break;
+        setFilter(i, filter);
+      }
+      break;
+
     case tagEnd:
       end = true;
       break;
@@ -127,8 +160,8 @@ bool ModuleClass::loadConfig()
 
 void ModuleClass::definePins(pinType_t t, vector<byte> pins)
 {
-  assert(mapTable[t]);
-  mapTable[t]->definePins(pins);
+  assert(t >= 0 && t < NB_PIN_TYPES);
+  mapTable[t].definePins(pins);
 }
 
 int ModuleClass::parsePins(pinType_t t, String list)
@@ -164,21 +197,20 @@ int ModuleClass::parsePins(pinType_t t, String list)
     }
   }
 
-  mapTable[t]->definePins(pins);
+  mapTable[t].definePins(pins);
   return 0;
 }
 
 vector<byte> ModuleClass::getPins(pinType_t t)
 {
-  return (mapTable[t]) ? mapTable[t]->getPins() : vector<byte>{};
+  return (t >= 0 && t < NB_PIN_TYPES) ? mapTable[t].getPins() : vector<byte>{};
 }
 
 void ModuleClass::updateAll()
 {
-  mapTable_t::iterator it;
-  for (it = mapTable.begin(); it != mapTable.end(); it++)
+  for (uint8_t t = 0; t < NB_PIN_TYPES; t++)
   {
-    it->second->updateAllPins();
+    mapTable[t].updateAllPins();
   }
 }
 
@@ -192,12 +224,11 @@ void ModuleClass::blinkDigitalOutputs()
 
 void ModuleClass::dumpPins(boolean showValues)
 {
-  mapTable_t::iterator it;
   uint8_t maxNbPins = 0;
 
-  for (it = mapTable.begin(); it != mapTable.end(); it++)
+  for (uint8_t t = 0; t < NB_PIN_TYPES; t++)
   {
-    maxNbPins = max(it->second->getNbPins(), maxNbPins);
+    maxNbPins = max(mapTable[t].getNbPins(), maxNbPins);
   }
 
   Serial.println();
@@ -207,11 +238,11 @@ void ModuleClass::dumpPins(boolean showValues)
     xprintf(F("   %02d"), i);
   Serial.println();
 
-  vector<pinType_t> pinTypeList = {analogInput, pwmOutput, digitalInput, digitalOutput, socketInput, socketOutput};
+  const pinType_t pinTypeList[] = {analogInput, pwmOutput, digitalInput, digitalOutput, socketInput, socketOutput};
 
-  for (uint8_t i = 0; i < pinTypeList.size(); i++)
+  for (uint8_t i = 0; i < sizeof(pinTypeList) / sizeof(pinTypeList[0]); i++)
   {
-    mapTable[pinTypeList[i]]->dumpPins(showValues);
+    mapTable[pinTypeList[i]].dumpPins(showValues);
   }
   Serial.println();
 }
@@ -227,46 +258,130 @@ void ModuleClass::dumpValues()
   dumpPins(true);
 }
 
+void ModuleClass::dumpFilters()
+{
+  xprintf(F("pin minAlpha beta\n"));
+  for (uint8_t i = 0; i < getNbPins(analogInput); i++)
+  {
+    filter_t filter = mapTable[analogInput].pinTable[i].getFilter();
+    xprintf(F(" %02d      %3d  %3d\n"), i, filter.minAlpha, filter.beta);
+  }
+}
+
+bool ModuleClass::getConnectionStats(uint8_t id, connectionStats_t &stats)
+{
+  if (id >= getNbPins(socketInput)) return false;
+  stats = mapTable[socketInput].pinTable[id].getConnectionStats();
+  return true;
+}
+
+void ModuleClass::clearConnectionStats()
+{
+  for (uint8_t i = 0; i < getNbPins(socketInput); i++)
+    mapTable[socketInput].pinTable[i].clearConnectionStats();
+}
+
+void ModuleClass::dumpConnectionStats()
+{
+  xprintf(F("%u rounds, %uus per round\n"), detectRounds, roundMicros);
+  xprintf(F("pin unconfirmed glitches confirmed rounds avg/max\n"));
+  for (uint8_t i = 0; i < getNbPins(socketInput); i++)
+  {
+    connectionStats_t stats = mapTable[socketInput].pinTable[i].getConnectionStats();
+    xprintf(F(" %02d       %5u    %5u     %5u    %3u.%u/%u\n"), i, stats.unconfirmed, stats.glitches, stats.confirmations,
+      stats.confirmations ? stats.confirmRounds / stats.confirmations : 0,
+      stats.confirmations ? ((uint32_t)stats.confirmRounds * 10 / stats.confirmations) % 10 : 0,
+      stats.maxConfirmRounds);
+  }
+}
+
 void ModuleClass::dumpChanges()
 {
-  mapTable[analogInput]->dumpChanges();
-  mapTable[digitalInput]->dumpChanges();
-  mapTable[socketInput]->dumpChanges();
+  mapTable[analogInput].dumpChanges();
+  mapTable[digitalInput].dumpChanges();
+  mapTable[socketInput].dumpChanges();
 }
 
 void ModuleClass::requestFullState()
 {
-  mapTable[analogInput]->requestFullState();
-  mapTable[digitalInput]->requestFullState();
-  mapTable[socketInput]->requestFullState();
+  mapTable[analogInput].requestFullState();
+  mapTable[digitalInput].requestFullState();
+  mapTable[socketInput].requestFullState();
 }
 
 bool ModuleClass::getNextConnectionChange(connectionChangeEvent_t &event)
 {
-  return mapTable[socketInput]->getNextConnectionChange(event);
+  return mapTable[socketInput].getNextConnectionChange(event);
 }
 
 bool ModuleClass::getNextAnalogInputChange(valueChangeEvent_t &event)
 {
-  return mapTable[analogInput]->getNextValueChange(event);
+  return mapTable[analogInput].getNextValueChange(event);
 }
 
 bool ModuleClass::getNextDigitalInputChange(valueChangeEvent_t &event)
 {
-  return mapTable[digitalInput]->getNextValueChange(event);
+  return mapTable[digitalInput].getNextValueChange(event);
 }
 
+bool ModuleClass::hasChanges()
+{
+  return mapTable[analogInput].hasChanges() || mapTable[digitalInput].hasChanges() || mapTable[socketInput].hasChanges();
+}
+
+void ModuleClass::startRound()
+{
+  unsigned long now = micros();
+  if (detectRounds > 0) {
+    unsigned long elapsed = min(now - roundStart, 0xFFFFUL);
+    roundMicros = (detectRounds == 1) ? elapsed : roundMicros + ((long)elapsed - (long)roundMicros) / 8;
+  }
+  roundStart = now;
+  detectRounds++;
+}
+
+// The I2C_TICK protocol always uses a 16-bit ID, whatever width I2C_DETECT was given
+#define TICK_ID_BITS 16
+
 void ModuleClass::stepConnections(uint8_t stepNumber)
 {
   uint8_t bitNumber = stepNumber >> 1;
+  if (stepNumber == 0)
+    startRound();
   if ((stepNumber & 1) == 0)
-    mapTable[socketOutput]->serialOut(bitNumber);
+    mapTable[socketOutput].serialOut(bitNumber, TICK_ID_BITS - MODULE_ID_BITS);
   else
-    mapTable[socketInput]->serialIn(bitNumber);
+    mapTable[socketInput].serialIn(bitNumber, TICK_ID_BITS);
+}
+
+// Each step reads the bit written by the previous step, then writes the next one, so a round takes
+// one broadcast per ID bit (plus one) instead of two. Modules don't all handle a broadcast at exactly
+// the same time, the delay before writing makes sure the module at the other end of the cable has read
+// the previous bit by then. A late module gives a wrong ID for one round, which is rejected because
+// connections are only confirmed after two identical rounds.
+// The delay is a busy-wait in the TWI interrupt. The broadcast itself isn't stretched: Wire calls
+// onReceive after the STOP, with the bus already released. What waits is this module's next TWI
+// interrupt: a transaction to it (or the next step) starting within the wait is clock stretched until
+// the wait ends. That costs no more than the guard itself, which bounds the step rate in any case,
+// every module having to sample a bit before any module writes the next one. There is no other place
+// to wait: loop() runs every 10 ms, and the timers are all taken by PWM outputs.
+
+#define DETECT_STEP_GUARD_US 20
+
+void ModuleClass::detectStep(uint8_t stepNumber)
+{
+  uint8_t nbBits = MODULE_ID_BITS + pinIdBits;
+  if (stepNumber == 0) startRound();
+  if (stepNumber > 0 && stepNumber <= nbBits)
+    mapTable[socketInput].serialIn(stepNumber - 1, nbBits);
+  if (stepNumber < nbBits) {
+    delayMicroseconds(DETECT_STEP_GUARD_US);
+    mapTable[socketOutput].serialOut(stepNumber, pinIdBits);
+  }
 }
 
 void ModuleClass::detectConnections()
 {
-  for (uint8_t stepNumber = 0; stepNumber < 32; stepNumber++)
-    stepConnections(stepNumber);
+  for (uint8_t stepNumber = 0; stepNumber < getDetectSteps(); stepNumber++)
+    detectStep(stepNumber);
 }
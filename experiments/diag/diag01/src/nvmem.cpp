@@ -2,53 +2,143 @@
 #include "nvmem.h"
 #include "console.h"
 
-NVMEMClass NVMEM;;
+NVMEMClass NVMEM;
 
-// Code coming from http://www.ccontrolsys.com/w/How_to_Compute_the_Modbus_RTU_Message_CRC
+// CRC16 Modbus, a nibble at a time: 32 bytes of table in flash instead of 8 shifts per byte
+// (bitwise version at http://www.ccontrolsys.com/w/How_to_Compute_the_Modbus_RTU_Message_CRC)
 
-uint16_t NVMEMClass::eeprom_crc(uint16_t minus)
+static const uint16_t crcTable[16] PROGMEM = {
+	0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+	0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+};
+
+uint16_t NVMEMClass::crc(uint16_t from, uint16_t length)
 {
-	uint16_t crc = ~0L;
-
-	for (uint16_t index = 0; index < EEPROM.length() - minus; ++index) {
-		crc ^= EEPROM[index];          // XOR byte into least sig. byte of crc
-
-		for (int i = 8; i != 0; i--) {    // Loop over each bit
-			if ((crc & 0x0001) != 0) {      // If the LSB is set
-				crc >>= 1;                    // Shift right and XOR 0xA001
-				crc ^= 0xA001;
-			}
-			else                            // Else LSB is not set
-				crc >>= 1;                    // Just shift right
-		}                    // Just shift right
+	uint16_t crc = ~0;
+
+	for (uint16_t index = from; index < from + length; ++index) {
+		crc ^= EEPROM[index];
+		crc = (crc >> 4) ^ pgm_read_word(&crcTable[crc & 0x0F]);
+		crc = (crc >> 4) ^ pgm_read_word(&crcTable[crc & 0x0F]);
 	}
 	return crc;
 }
 
-bool NVMEMClass::CheckCRC(void)
+bool NVMEMClass::isHeader(uint16_t offset)
 {
-	// The following CRC check is a classical method, used for HDLC for example
-	// When CRC calculation is included the CRC in the last word, the result is 0
-	if (eeprom_crc(0) != 0) {
-		xprintf(F("Bad EEPROM CRC\n"));
+	uint16_t version;
+
+	if (EEPROM[offset] != NVMEM_MAGIC)
+		return false;
+	EEPROM.get(offset + 1, version);
+	if (version != _version)
 		return false;
+	return recordSize(offset) <= maxRecord() && offset + recordSize(offset) <= EEPROM.length();
+}
+
+bool NVMEMClass::checkRecord(uint16_t offset)
+{
+	uint16_t length = NVMEM_HEADER_SIZE - 1 + EEPROM[offset + 5];
+	uint16_t stored;
+
+	EEPROM.get(offset + 1 + length, stored);
+	return crc(offset + 1, length) == stored;
+}
+
+// Newest record, or newest older than sequence number 'below' if limited. Sequence numbers wrap, so
+// they are compared by difference. Records are looked for by following the length fields from offset 0
+// (chain), or at every offset when that doesn't lead anywhere
+bool NVMEMClass::findLatest(bool chain, bool limited, uint16_t below, uint16_t &offset, uint16_t &seq)
+{
+	bool found = false;
+	uint16_t o = 0;
+
+	while (o + NVMEM_HEADER_SIZE + NVMEM_CRC_SIZE <= EEPROM.length()) {
+		if (!isHeader(o)) {
+			if (chain)
+				break;
+			o++;
+			continue;
+		}
+		uint16_t s;
+		EEPROM.get(o + 3, s);
+		if ((!limited || (int16_t)(below - s) > 0) && (!found || (int16_t)(s - seq) > 0)) {
+			found = true;
+			offset = o;
+			seq = s;
+		}
+		o += chain ? recordSize(o) : 1;
 	}
+	return found;
+}
 
-	EEPROM.get(EEPROM.length() - 4, version);
-	if (version != _version) {
-		xprintf(F("Bad EEPROM version %04X (waiting %04X)\n"), version, _version);
-		return false;
+bool NVMEMClass::OpenLatest(void)
+{
+	uint16_t offset;
+	uint16_t seq;
+	bool chain = true;
+
+	scanned = true;
+	next = 0;
+	sequence = 0;
+	end = p = 0;
+
+	if (!findLatest(true, false, 0, offset, seq)) {
+		// The record at offset 0 was never written or is being rewritten, the others can be anywhere
+		chain = false;
+		if (!findLatest(false, false, 0, offset, seq)) {
+			xprintf(F("No config record in EEPROM\n"));
+			return false;
+		}
+	}
+
+	// New records go after the newest one, even if it turns out to be damaged
+	next = offset + recordSize(offset);
+	sequence = seq;
+
+	while (!checkRecord(offset)) {
+		xprintf(F("Bad CRC in config record %u at %u\n"), seq, offset);
+		if (!findLatest(chain, true, seq, offset, seq))
+			return false;
 	}
 
+	start = offset;
+	p = start + NVMEM_HEADER_SIZE;
+	end = p + EEPROM[start + 5];
 	return true;
 }
 
-void NVMEMClass::UpdateCRC(void)
+void NVMEMClass::BeginRecord(void)
 {
-	// Put version at the end, just before the CRC
-	EEPROM.put(EEPROM.length() - 4, _version);
-	
-	// Compute the CRC and write at the end
-	uint16_t crc = eeprom_crc(2);
-	EEPROM.put(EEPROM.length() - 2, crc);
+	if (!scanned)
+		OpenLatest();
+
+	start = next;
+	if (start + maxRecord() > EEPROM.length())
+		start = 0; // Back to the beginning of the EEPROM
+
+	EEPROM.update(start, 0); // Not a record until it is committed
+	p = start + NVMEM_HEADER_SIZE;
+	end = start + maxRecord() - NVMEM_CRC_SIZE;
+	overflow = false;
+}
+
+bool NVMEMClass::CommitRecord(void)
+{
+	if (overflow) {
+		xprintf(F("Config doesn't fit in a record (%u bytes max)\n"), maxRecord() - NVMEM_HEADER_SIZE - NVMEM_CRC_SIZE);
+		return false;
+	}
+
+	uint8_t length = p - start - NVMEM_HEADER_SIZE;
+	sequence++;
+	EEPROM.put(start + 1, _version);
+	EEPROM.put(start + 3, sequence);
+	EEPROM.update(start + 5, length);
+	EEPROM.put(p, crc(start + 1, NVMEM_HEADER_SIZE - 1 + length));
+	EEPROM.update(start, NVMEM_MAGIC); // Last, the record is valid from here
+
+	next = p + NVMEM_CRC_SIZE;
+	end = p; // Nothing to read until OpenLatest()
+	return true;
 }
@@ -1,14 +1,16 @@
 #include <assert.h>
 
 #include "pinhandler.h"
+#include "adcengine.h"
 #include "module.h"
 #include "console.h"
 
 uint8_t pinHandler_t::debounceDelay = 5;      // Delay before successive reads of digital input for debouncing
-uint8_t pinHandler_t::denoiseFilterCoeff = 2; // Actual anolog IIR filter constant will be 1<<analogFilterCoeff 
-uint8_t pinHandler_t::denoiseThreshold = 6;   // Threshold for change detection of analog inputs
+uint8_t pinHandler_t::denoiseThreshold = 12; // Threshold for change detection of analog inputs, in 1/16 LSB
+uint8_t pinHandler_t::restSpeed = 4;          // Speed under which an analog input is at rest, in 1/16 LSB per ADC round
+uint8_t pinHandler_t::settleRounds = 30;      // ADC rounds at rest before reporting the settled value
 
-pinHandler_t::pinHandler_t(pinType_t pinType, uint8_t pinArduino, uint8_t pinId)
+pinHandler_t::pinHandler_t(pinType_t pinType, uint8_t pinArduino, uint16_t pinId)
 {
   this->pinType = pinType;
   this->pinId = pinId;
@@ -38,7 +40,8 @@ pinHandler_t::pinHandler_t(pinType_t pinType, uint8_t pinArduino, uint8_t pinId)
     digitalWrite(pinArduino, 0);
     break;
   case analogInput:
-    value.currentValue = analogRead(pinArduino) << denoiseFilterCoeff;
+    value.currentValue = analogRead(pinArduino) << ADC_SAMPLES_BITS;
+    lastSample = value.currentValue;
     break;
   case pwmOutput:
     if (!digitalPinHasPWM(pinArduino)) {
@@ -57,7 +60,7 @@ pinHandler_t::pinHandler_t(pinType_t pinType, uint8_t pinArduino, uint8_t pinId)
   value.prevValue = value.currentValue;
 }
 
-bool pinHandler_t::updateValue()
+bool pinHandler_t::updateValue(uint8_t portValue)
 {
   if (debounceCounter > 0) {
     debounceCounter--;
@@ -66,7 +69,7 @@ bool pinHandler_t::updateValue()
 
   switch (pinType) {
   case digitalInput:
-    value.currentValue = digitalRead(pinArduino);
+    value.currentValue = (portValue & bitMask) != 0;
     if (value.prevValue != value.currentValue) {
       value.prevValue = value.currentValue;
       debounceCounter = debounceDelay;
@@ -76,20 +79,36 @@ bool pinHandler_t::updateValue()
   case digitalOutput:
   case socketOutput:
   case socketInput:
-    value.currentValue = digitalRead(pinArduino);
+    value.currentValue = (portValue & bitMask) != 0;
     break;
   case pwmOutput:
     break;
   case analogInput:
     {
-      uint16_t newValue = analogRead(pinArduino);
-      // Apply IIR filter with coeff 0.25
+      uint16_t sum;   // 1/16 LSB resolution
+      if (!ADCEngine.getResult(pinId, sum)) break;   // Nothing new since last time
+
+      int16_t dx = (int16_t)sum - (int16_t)lastSample;
+      lastSample = sum;
+      speed += (abs(dx) - speed) >> 2;
+      uint16_t alpha = filter.minAlpha + (((uint16_t)filter.beta * speed) >> 4);
+      if (alpha > 256) alpha = 256;
+
+      int16_t error = (int16_t)sum - (int16_t)value.currentValue;
+      int16_t step = ((int32_t)error * alpha) >> 8;
+      if (step == 0 && error > 0) step = 1;   // Don't stop short of the input when smoothing heavily
       cli();
-      value.currentValue -= value.currentValue >> denoiseFilterCoeff;
-      value.currentValue += newValue;
+      value.currentValue += step;
       sei();
+
+      // Report moves beyond the noise, plus the value the knob settles at once it has been still for a
+      // while, so the last few counts of a move are not lost in the threshold
+      if (speed > restSpeed) stillRounds = 0;
+      else if (stillRounds <= settleRounds) stillRounds++;
+
       int delta = abs((int)value.prevValue - (int)value.currentValue);
-      if (delta > denoiseThreshold) {
+      bool settled = (stillRounds == settleRounds) && (getValue() != ((value.prevValue + ADC_SAMPLES / 2) >> ADC_SAMPLES_BITS));
+      if (delta > denoiseThreshold || settled) {
         value.prevValue = value.currentValue;
         return true;
       }
@@ -123,7 +142,7 @@ void pinHandler_t::setValue(uint8_t v)
 
 uint16_t pinHandler_t::getValue()
 {
-  if (pinType == analogInput) return value.currentValue >> denoiseFilterCoeff;
+  if (pinType == analogInput) return (value.currentValue + ADC_SAMPLES / 2) >> ADC_SAMPLES_BITS;
   else return value.currentValue;
 }
 
@@ -132,31 +151,61 @@ connection_t pinHandler_t::getConnection()
   return connection.getConnection();
 }
 
-void pinHandler_t::serialOut(uint16_t bitNumber)
+// A pinId that doesn't fit in pinIdBits would run into the moduleId bits and name another module:
+// the pin sends all ones instead, which reads as no cable at the other end
+uint8_t pinHandler_t::serialOut(uint8_t bitNumber, uint8_t pinIdBits)
 {
-  if (bitNumber == 0) connection.serialBuffer = (Module.getModuleId() << 8) | pinId;
-  digitalWrite(pinArduino, (connection.serialBuffer >> bitNumber) & 1);
+  if (bitNumber == 0) {
+    if ((uint32_t)pinId >> pinIdBits) connection.serialBuffer = 0xFFFFFFFF;
+    else connection.serialBuffer = ((uint32_t)Module.getModuleId() << pinIdBits) | pinId;
+  }
+  return ((connection.serialBuffer >> bitNumber) & 1) ? bitMask : 0;
 }
 
-bool pinHandler_t::serialIn(uint16_t bitNumber)
+bool pinHandler_t::serialIn(uint8_t bitNumber, uint8_t nbBits, uint8_t portValue)
 {
-  uint16_t bit = digitalRead(pinArduino);
+  uint32_t bit = (portValue & bitMask) != 0;
   if (bitNumber == 0) connection.serialBuffer = 0;
   connection.serialBuffer |= bit << bitNumber;
 
-  if (bitNumber != 15) return false; // 16 bits not yet received
+  if (bitNumber != nbBits - 1) return false; // ID not yet fully received
+
+  connectionStats_t &stats = connection.stats;
+  bool counting = connection.confirmedBuffer != 0xFFFFFFFF;   // Not before the first ID is confirmed
+  uint8_t round = Module.getDetectRounds();
 
   if (connection.prevSerialBuffer != connection.serialBuffer) { // Received ID not confirmed, probably glitch during cable connection
+    if (counting) {
+      if (stats.unconfirmed < 0xFFFF) stats.unconfirmed++;
+      if (connection.prevSerialBuffer != connection.confirmedBuffer) {
+        if (stats.glitches < 0xFFFF) stats.glitches++;   // The previous round's ID didn't come back
+      }
+      else connection.changeRound = round;                // First round away from the confirmed ID
+    }
     connection.prevSerialBuffer = connection.serialBuffer;
     return false; 
   }
 
-  if (connection.isConnected && connection.serialBuffer == 0xFFFF) {  // Disconnection
+  if (connection.serialBuffer != connection.confirmedBuffer) {
+    if (counting) {
+      uint8_t rounds = round - connection.changeRound;
+      if (stats.confirmations < 0xFFFF) stats.confirmations++;
+      if (stats.confirmRounds <= 0xFFFF - rounds) stats.confirmRounds += rounds;
+      if (rounds > stats.maxConfirmRounds) stats.maxConfirmRounds = rounds;
+    }
+    connection.confirmedBuffer = connection.serialBuffer;
+  }
+
+  uint32_t noConnection = (nbBits < 32) ? (1UL << nbBits) - 1 : 0xFFFFFFFF;
+  uint8_t pinIdBits = nbBits - MODULE_ID_BITS;
+  connection_t received = { (uint8_t)(connection.serialBuffer >> pinIdBits), (uint16_t)(connection.serialBuffer & ((1UL << pinIdBits) - 1)), true };
+
+  if (connection.isConnected && connection.serialBuffer == noConnection) {  // Disconnection
     connection.isConnected = false;
     return true;
   }
-  else if (!connection.isConnected && connection.serialBuffer != 0xFFFF) {  // New connection
-    connection.confirmedConnection = connection.serialBuffer;
+  else if (!connection.isConnected && connection.serialBuffer != noConnection) {  // New connection
+    connection.confirmedConnection = received;
     connection.isConnected = true;
     return true;
   }
@@ -1,41 +1,101 @@
 #include "board.h"
+#include "adcengine.h"
 #include "module.h"
 #include "console.h"
 
 void pinMapper_t::definePins(vector<uint8_t> pins)
 {
-  this->pinType = pinType;
+  definePins(pins.size() ? &pins[0] : NULL, min(pins.size(), (size_t)255));
+}
+
+void pinMapper_t::definePins(const uint8_t *pins, uint8_t nbPins, pinHandler_t *storage)
+{
+  if (pinTable.allocated) delete[] pinTable.handlers;
+  pinTable.handlers = NULL;
+  pinTable.count = 0;
+  pinTable.allocated = false;
+  changes.clear();
+  if (nbPins > CHANGE_MAX_PINS) {
+    xprintf(F("Too many pins, only the first %d are used\n"), CHANGE_MAX_PINS);
+    nbPins = CHANGE_MAX_PINS;
+  }
+  if (pinType == analogInput) ADCEngine.stop();   // pinHandler_t reads the initial value with analogRead()
+  if (nbPins == 0) return;
 
-  pinTable.clear();
-  if (pinChange[0]) delete pinChange[0];
-  if (pinChange[1]) delete pinChange[1];
-  
-  for (uint8_t pinId = 0; pinId < pins.size(); pinId++) {
-    pinHandler_t pinHandler(pinType, pins[pinId], pinId);
-    pinTable.push_back(pinHandler);
+  if (!storage) {
+    storage = new pinHandler_t[nbPins];
+    pinTable.allocated = true;
+  }
+  pinTable.handlers = storage;
+  for (uint8_t pinId = 0; pinId < nbPins; pinId++) {
+    pinTable.handlers[pinId] = pinHandler_t(pinType, pins[pinId], pinId);
   }
+  pinTable.count = nbPins;
 
-  pinChange[0] = new bitArray(pins.size());
-  pinChange[1] = new bitArray(pins.size()); 
+  definePortGroups();
+  if (pinType == analogInput) ADCEngine.start(pins, nbPins);
 }
 
-pinMapper_t::~pinMapper_t()
+void pinMapper_t::definePortGroups()
+{
+  nbPortGroups = 0;
+
+  switch (pinType) {
+    case digitalInput:
+    case digitalOutput:
+    case socketInput:
+    case socketOutput:
+      break;
+    default:
+      return;   // analog and PWM pins are not read or written through the port registers
+  }
+
+  for (uint8_t i = 0; i < pinTable.size(); i++) {
+    uint8_t pinArduino = pinTable[i].getPinArduino();
+    uint8_t port = digitalPinToPort(pinArduino);
+    if (port == NOT_A_PIN) continue;
+
+    uint8_t group = 0;
+    while (group < nbPortGroups && portGroups[group].port != port) group++;
+    if (group == nbPortGroups) {
+      if (nbPortGroups == MAX_PORT_GROUPS) {
+        xprintf(F("Pins on more than %d ports, pin %d is not used\n"), MAX_PORT_GROUPS, pinArduino);
+        continue;
+      }
+      portGroups[group] = { port, portInputRegister(port), portOutputRegister(port), 0, 0 };
+      nbPortGroups++;
+    }
+
+    uint8_t mask = digitalPinToBitMask(pinArduino);
+    portGroups[group].mask |= mask;
+    pinTable[i].setPortGroup(group, mask);
+  }
+}
+
+void pinMapper_t::readPorts()
 {
-  /*
-  pinTable_t::iterator pin;
-  for (pin = pinTable.begin(); pin < pinTable.end(); pin++) {
-    delete (*pin);
+  for (uint8_t group = 0; group < nbPortGroups; group++) {
+    portGroups[group].value = *portGroups[group].in;
   }
-  */
+}
+
+uint8_t pinMapper_t::portValue(uint8_t pinId)
+{
+  uint8_t group = pinTable[pinId].getPortGroup();
+  return (group < nbPortGroups) ? portGroups[group].value : 0;
+}
+
+pinMapper_t::~pinMapper_t()
+{
+  if (pinTable.allocated) delete[] pinTable.handlers;
 }
 
 vector<uint8_t> pinMapper_t::getPins()
 {
   vector<uint8_t> pins;
 
-  pinTable_t::iterator pin;
-  for (pin = pinTable.begin(); pin < pinTable.end(); pin++) {
-    pins.push_back((*pin).getPinArduino());
+  for (uint8_t i = 0; i < pinTable.size(); i++) {
+    pins.push_back(pinTable[i].getPinArduino());
   }
 
   return pins;
@@ -43,38 +103,24 @@ vector<uint8_t> pinMapper_t::getPins()
 
 void pinMapper_t::updateAllPins()
 {  
+  readPorts();
   for (uint8_t i = 0; i < pinTable.size(); i++) {
-    if (pinTable[i].updateValue()) {   // pin change
-      pinChange[0]->set(i, true);
-      pinChange[1]->set(i, true);
+    if (pinTable[i].updateValue(portValue(i))) {   // pin change
+      changes.set(i);
     }
   }
 }
 
-valueChangeList_t pinMapper_t::getValueChangeList(uint8_t readerIndex)
-{
-  valueChangeList_t list;
-
-  for (uint8_t pinId = 0; pinId < pinTable.size(); pinId++) {
-    if (pinChange[readerIndex]->get(pinId)) {
-      list.push_back( { pinId, pinTable[pinId].getValue() });
-      pinChange[readerIndex]->set(pinId, false);  // We have read the change
-    }
-  }
-
-  return list;
-}
-
 void pinMapper_t::requestFullState()
 {
   for (uint8_t pinId = 0; pinId < pinTable.size(); pinId++) {
     switch (pinType) {
       case socketInput:
         // Force state change only if connected
-        if (pinTable[pinId].getConnection().isConnected) pinChange[0]->set(pinId, true);
+        if (pinTable[pinId].getConnection().isConnected) changes.set(pinId, READER_I2C);
         break;
       default:
-        pinChange[0]->set(pinId, true);  // Force state change
+        changes.set(pinId, READER_I2C);  // Force state change
         break;
     }
   }
@@ -82,58 +128,48 @@ void pinMapper_t::requestFullState()
 
 bool pinMapper_t::getNextValueChange(valueChangeEvent_t &event, uint8_t readerIndex)
 {
-  for (uint8_t pinId = 0; pinId < pinTable.size(); pinId++) {
-    if (pinChange[readerIndex]->get(pinId)) {
-      event = { pinId, pinTable[pinId].getValue() };
-      pinChange[readerIndex]->set(pinId, false);  // We have read the change
-      return true;
-    }
-  }
+  int8_t pinId = changes.next(readerIndex);  // We have read the change
+  if (pinId < 0 || pinId >= pinTable.size()) return false;
 
-  return false;
-}
-    
-connectionChangeList_t pinMapper_t::getConnectionChangeList(uint8_t readerIndex)
-{
-  connectionChangeList_t list;
-
-  for (uint8_t pinId = 0; pinId < pinTable.size(); pinId++) {
-    if (pinChange[readerIndex]->get(pinId)) {
-      list.push_back( { pinId, pinTable[pinId].getConnection() });
-      pinChange[readerIndex]->set(pinId, false);  // We have read the change
-    }
-  }
-
-  return list;
+  event = { (uint8_t)pinId, pinTable[pinId].getValue() };
+  return true;
 }
 
 bool pinMapper_t::getNextConnectionChange(connectionChangeEvent_t &event, uint8_t readerIndex)
 {
-  for (uint8_t pinId = 0; pinId < pinTable.size(); pinId++) {
-    if (pinChange[readerIndex]->get(pinId)) {
-      event = { pinId, pinTable[pinId].getConnection() };
-      pinChange[readerIndex]->set(pinId, false);  // We have read the change
-      return true;
-    }
-  }  
+  int8_t pinId = changes.next(readerIndex);  // We have read the change
+  if (pinId < 0 || pinId >= pinTable.size()) return false;
 
-  return false;
+  event = { (uint8_t)pinId, pinTable[pinId].getConnection() };
+  return true;
 }
 
-void pinMapper_t::serialOut(uint8_t bitNumber)
+void pinMapper_t::serialOut(uint8_t bitNumber, uint8_t pinIdBits)
 {
-  pinTable_t::iterator pin;
-  for (pin = pinTable.begin(); pin < pinTable.end(); pin++) {
-    (*pin).serialOut(bitNumber);
+  uint8_t bits[MAX_PORT_GROUPS] = { 0 };
+
+  for (uint8_t i = 0; i < pinTable.size(); i++) {
+    uint8_t group = pinTable[i].getPortGroup();
+    uint8_t mask = pinTable[i].serialOut(bitNumber, pinIdBits);
+    if (group < nbPortGroups) bits[group] |= mask;
+  }
+
+  // All outputs of a port change at once. Interrupts are off so the read-modify-write doesn't undo
+  // a write to another pin of the port from an interrupt
+  uint8_t oldSREG = SREG;
+  cli();
+  for (uint8_t group = 0; group < nbPortGroups; group++) {
+    *portGroups[group].out = (*portGroups[group].out & ~portGroups[group].mask) | bits[group];
   }
+  SREG = oldSREG;
 }
 
-void pinMapper_t::serialIn(uint8_t bitNumber)
+void pinMapper_t::serialIn(uint8_t bitNumber, uint8_t nbBits)
 {
+  readPorts();
   for (uint8_t i = 0; i < pinTable.size(); i++) {
-    if (pinTable[i].serialIn(bitNumber)) {
-      pinChange[0]->set(i, true);
-      pinChange[1]->set(i, true);      
+    if (pinTable[i].serialIn(bitNumber, nbBits, portValue(i))) {
+      changes.set(i);
     }
   }
 }
@@ -141,13 +177,13 @@ void pinMapper_t::serialIn(uint8_t bitNumber)
 void pinMapper_t::printPinType()
 {
     switch (pinType) {
-    case analogInput:    Serial.print(F("   Analog Input")); break;
-    case pwmOutput:      Serial.print(F("     PWM Output")); break;
-    case digitalInput:   Serial.print(F("  Digital Input")); break;
-    case digitalOutput:  Serial.print(F(" Digital Output")); break;
-    case socketInput:    Serial.print(F("   Socket Input")); break;
-    case socketOutput:   Serial.print(F("  Socket Output")); break;
-    default:             Serial.print(F("              ?")); break;
+    case analogInput:    xprintf(F("   Analog Input")); break;
+    case pwmOutput:      xprintf(F("     PWM Output")); break;
+    case digitalInput:   xprintf(F("  Digital Input")); break;
+    case digitalOutput:  xprintf(F(" Digital Output")); break;
+    case socketInput:    xprintf(F("   Socket Input")); break;
+    case socketOutput:   xprintf(F("  Socket Output")); break;
+    default:             xprintf(F("              ?")); break;
   }
 }
 
@@ -165,19 +201,16 @@ void pinMapper_t::dumpPins(bool showValues)
 void pinMapper_t::dumpChanges()
 {
   if (pinType != socketInput) {
-    valueChangeList_t list = getValueChangeList(1); // readerIndex = 1 means console
-    if (list.size() == 0) return;
-    for (uint8_t i = 0; i < list.size(); i++) {
+    valueChangeEvent_t event;
+    while (getNextValueChange(event, READER_CONSOLE)) {
       printPinType();
-      xprintf(F("[%02d] = %5d\n"), list[i].pinId, list[i].newValue);
+      xprintf(F("[%02d] = %5d\n"), event.pinId, event.newValue);
     }
   }
   else {
-    connectionChangeList_t list = getConnectionChangeList(1); // readerIndex = 1 means console
-    if (list.size() == 0) return;
-    for (uint8_t i = 0; i < list.size(); i++) {
-      string label = list[i].from.isConnected ? "Connection" : "Disconnection";
-      xprintf(F("%-14s [%02d.%02d] -> [%02d.%02d]\n"), label.c_str(), list[i].from.moduleId, list[i].from.pinId, Module.getModuleId(), list[i].pinId);
+    connectionChangeEvent_t event;
+    while (getNextConnectionChange(event, READER_CONSOLE)) {
+      xprintf(F("%-14s [%02d.%02d] -> [%02d.%02d]\n"), event.from.isConnected ? "Connection" : "Disconnection", event.from.moduleId, event.from.pinId, Module.getModuleId(), event.pinId);
     }
   }
 }
@@ -0,0 +1,85 @@
+#include "telemetry.h"
+#include "module.h"
+#include "console.h"
+
+TelemetryClass Telemetry;
+
+void TelemetryClass::start(uint16_t periodMs, unsigned long baud)
+{
+  periodMs = max(periodMs, (uint16_t)LOOP_PERIOD_MS);
+  xprintf(F("Telemetry every %dms, switching to %lu baud, send any character to stop\n"), periodMs, baud);
+  Serial.flush();
+  Serial.begin(baud);
+
+  period = periodMs;
+  lastSample = millis() - periodMs;
+  frameCount = 0;
+  active = true;
+}
+
+void TelemetryClass::stop()
+{
+  active = false;
+  Serial.flush();
+  Serial.begin(CONSOLE_BAUD);
+  Serial.println(F("\nTelemetry stopped"));
+}
+
+void TelemetryClass::poll()
+{
+  if (!active || millis() - lastSample < period) return;
+  lastSample += period;
+  if (millis() - lastSample >= period) lastSample = millis();  // Loop too slow for the period, don't catch up
+
+  pinTable_t &analogPins = Module.getPinTable(analogInput);
+  pinTable_t &digitalPins = Module.getPinTable(digitalInput);
+  pinTable_t &socketPins = Module.getPinTable(socketInput);
+
+  // Frame header, counts are trimmed so the frame fits, sockets first then digital inputs
+  uint8_t nbAnalog = analogPins.size();
+  uint8_t nbDigital = digitalPins.size();
+  uint8_t nbSocket = socketPins.size();
+  uint16_t room = TELEMETRY_MAX_FRAME - 9;
+  nbAnalog = min((uint16_t)nbAnalog, (uint16_t)(room / 6));
+  room -= nbAnalog * 6;
+  nbDigital = min((uint16_t)nbDigital, (uint16_t)(room * 8));
+  room -= (nbDigital + 7) / 8;
+  nbSocket = min((uint16_t)nbSocket, (uint16_t)(room / 3));
+
+  uint8_t len = 0;
+  uint32_t now = micros();
+  frame[len++] = TELEMETRY_SYNC;
+  frame[len++] = 0;   // Length, filled in below
+  frame[len++] = TELEMETRY_SAMPLE;
+  memcpy(&frame[len], &now, sizeof(now));
+  len += sizeof(now);
+  frame[len++] = frameCount++;
+  frame[len++] = nbAnalog;
+  frame[len++] = nbDigital;
+  frame[len++] = nbSocket;
+
+  for (uint8_t i = 0; i < nbAnalog; i++) {
+    uint16_t values[3] = { analogPins[i].getSample(), analogPins[i].getFiltered(), analogPins[i].getReported() };
+    memcpy(&frame[len], values, sizeof(values));
+    len += sizeof(values);
+  }
+
+  for (uint8_t i = 0; i < nbDigital; i++) {
+    if ((i & 7) == 0) frame[len++] = 0;
+    if (digitalPins[i].getValue()) frame[len - 1] |= 1 << (i & 7);
+  }
+
+  for (uint8_t i = 0; i < nbSocket; i++) {
+    connection_t c = socketPins[i].getConnection();
+    frame[len++] = c.moduleId | (c.isConnected ? 0x80 : 0);
+    frame[len++] = lowByte(c.pinId);
+    frame[len++] = highByte(c.pinId);
+  }
+
+  frame[1] = len - 2;
+  uint8_t sum = 0;
+  for (uint8_t i = 2; i < len; i++) sum += frame[i];
+  frame[len++] = -sum;
+
+  Serial.write(frame, len);
+}
@@ -0,0 +1,153 @@
+// Slot enumeration simulator for mainboardnew / moduleboardnew, comparing the binary ID strobing with
+// the pulse counting it replaced:
+// - pulses: slot i gets i+1 pulses of 30 ms high and 30 ms low on its ID line, modules count them and
+//           take the count as their number once the line has been quiet for 50 ms
+// - strobe: for each bit of the slot number, the main board shifts that bit of every slot's number out
+//           to the ID lines and broadcasts a type 12 message, modules sample their ID line when it
+//           arrives. A type 13 broadcast then moves every module to its new address
+// Modules sample the line from their receive interrupt, some time after the broadcast's stop condition
+// (random, up to the latency given with -l). If the main board has already latched the next bit by then,
+// the module reads the wrong one. Each run puts modules in random slots and checks that every one of
+// them ended up with its slot number; the program exits with an error if any didn't.
+//
+// Build from the polymodnano folder:
+//   g++ -O2 -o enumsim host/enumsim.cpp
+//
+// Usage: enumsim [-r runs] [-l max module latency us] [-f bus clock Hz] [-e empty slot chance]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+// main board timings on a 16 MHz AVR with the Arduino core
+#define SHIFT_BYTE_US 110 // shiftOut() of one byte
+#define LATCH_US 8 // the two latch pin writes around it
+#define ID_SETTLE_US 10 // same as mainboardnew
+#define WIRE_OVERHEAD_US 40 // endTransmission() besides the bits on the bus
+
+#define PULSE_MS 60
+#define PULSE_SETTLE_MS 50
+#define PULSE_WAIT_MS 100 // main board wait after the last pulse
+
+struct module_t {
+  int slot;
+  int moduleNum;
+  bool enumerated;
+};
+
+static double busClock = 100000;
+static double maxLatency = 50;
+static double worstMargin;
+
+static int enumBits(int nbSlots)
+{
+  int bits = 0;
+  while ((1 << bits) <= nbSlots) bits++;
+  return bits;
+}
+
+// broadcast of length bytes, in us: start, address and data bytes with their ACK, stop
+static double broadcastTime(int length)
+{
+  return (1 + 9 * (1 + length) + 1) * 1000000.0 / busClock + WIRE_OVERHEAD_US;
+}
+
+static double shiftTime(int nbSlots)
+{
+  return (nbSlots + 7) / 8 * SHIFT_BYTE_US + LATCH_US;
+}
+
+// type 1 request and one byte read per slot, done the same way after either enumeration
+static double typeQueryTime(int nbSlots)
+{
+  return nbSlots * (broadcastTime(1) + broadcastTime(1));
+}
+
+static double pulsesTime(int nbSlots)
+{
+  return (nbSlots * (nbSlots + 1) / 2.0 * PULSE_MS + PULSE_WAIT_MS) * 1000;
+}
+
+// runs the strobe enumeration on a rack with modules in some of the slots, returns the time it took in us
+static double strobe(int nbSlots, std::vector<module_t> &modules)
+{
+  int bits = enumBits(nbSlots);
+  double t = 0;
+  for (module_t &m : modules) {
+    m.moduleNum = 0;
+    m.enumerated = false;
+  }
+
+  // setIdLines(ENUM_BITS) in setup() leaves all lines low, then one step per bit
+  for (int bit = 0; bit < bits; bit++) {
+    t += shiftTime(nbSlots); // lines show this bit from here
+    t += ID_SETTLE_US;
+    t += broadcastTime(2);
+    double nextChange = t + shiftTime(nbSlots); // next setIdLines() latches at the end of its shiftOut()
+    for (module_t &m : modules) {
+      double sampled = t + maxLatency * rand() / RAND_MAX;
+      int line = (m.slot + 1) >> bit & 1;
+      if (sampled >= nextChange) line = bit + 1 < bits ? (m.slot + 1) >> (bit + 1) & 1 : 0;
+      if (nextChange - sampled < worstMargin) worstMargin = nextChange - sampled;
+      if (bit == 0) m.moduleNum = 0;
+      m.moduleNum |= line << bit;
+    }
+  }
+  t += shiftTime(nbSlots);
+  t += broadcastTime(1);
+  for (module_t &m : modules) {
+    if (m.moduleNum > 0) m.enumerated = true;
+  }
+  return t;
+}
+
+int main(int argc, char **argv)
+{
+  long runs = 1000;
+  double emptyChance = 0.25;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:l:f:e:")) != -1) {
+    switch (opt) {
+      case 'r': runs = atol(optarg); break;
+      case 'l': maxLatency = atof(optarg); break;
+      case 'f': busClock = atof(optarg); break;
+      case 'e': emptyChance = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-r runs] [-l max module latency us] [-f bus clock Hz] [-e empty slot chance]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  printf("%ld runs per rack size, module latency up to %.0f us, %.0f kHz, %.0f%% empty slots\n\n",
+    runs, maxLatency, busClock / 1000, emptyChance * 100);
+  printf("slots  bits  strobe ms  pulses ms  type queries ms  worst margin us  failed runs\n");
+
+  int sizes[] = { 8, 16, 32, 64, 126 };
+  long totalFailed = 0;
+  srand(1);
+  for (int nbSlots : sizes) {
+    long failed = 0;
+    double strobeTime = 0;
+    worstMargin = 1e9;
+    for (long run = 0; run < runs; run++) {
+      std::vector<module_t> modules;
+      for (int slot = 0; slot < nbSlots; slot++) {
+        if (rand() >= emptyChance * RAND_MAX) modules.push_back({ slot, 0, false });
+      }
+      strobeTime = strobe(nbSlots, modules);
+      std::vector<int> owners(nbSlots + 1, 0);
+      bool ok = true;
+      for (module_t &m : modules) {
+        if (!m.enumerated || m.moduleNum != m.slot + 1 || ++owners[m.moduleNum] > 1) ok = false;
+      }
+      if (!ok) failed++;
+    }
+    totalFailed += failed;
+    printf("%5d  %4d  %9.2f  %9.0f  %15.2f  %15.1f  %11ld\n",
+      nbSlots, enumBits(nbSlots), strobeTime / 1000, pulsesTime(nbSlots) / 1000,
+      typeQueryTime(nbSlots) / 1000, worstMargin, failed);
+  }
+  return totalFailed ? 1 : 0;
+}
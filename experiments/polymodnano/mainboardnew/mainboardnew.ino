@@ -3,11 +3,20 @@
 int latchPin = 8;
 int clockPin = 10;
 int dataPin = 9;
+int attnPin = 2; // attention line, held low by any module with changes to report
 
 const int maxModules = 8;
 int moduleTypes[maxModules];
 byte tickNum = 0;
 
+// Slots are numbered in binary on the ID lines: for each bit of the slot number (slot i is number
+// i+1), every slot's line is set to that bit of its number and a type 12 broadcast tells the modules
+// to sample it, then a type 13 broadcast moves them all to their new address. That's ENUM_BITS
+// broadcasts whatever the number of modules, instead of i+1 pulses of 60 ms for slot i.
+#define ENUM_BITS 4 // enough for slot numbers up to maxModules
+#define ID_BYTES ((maxModules + 7) / 8) // one ID shift register per 8 slots, chained
+#define ID_SETTLE_US 10
+
 void setup()
 {
   while(!Serial);
@@ -18,35 +27,33 @@ void setup()
   pinMode(clockPin, OUTPUT);
   pinMode(dataPin, OUTPUT);
   pinMode(13, OUTPUT);
+  pinMode(attnPin, INPUT_PULLUP);
 
   
   Serial.println("polymod main board started");
   Wire.begin(); // join i2c bus (address optional for master)
   
   // init ID shift register
-  digitalWrite(latchPin, LOW);
-  shiftOut(dataPin, clockPin, MSBFIRST, B00000000);
-  digitalWrite(latchPin, HIGH);
+  setIdLines(ENUM_BITS);
   
   delay(2000); // allow modules to power up
   
-  // for each module number, send different number of pulses
-  for(int i=0;i<maxModules;i++) {
-    byte thisByte = 0;
-    bitWrite(thisByte,i,HIGH);
-    for(int j=0; j<i+1; j++) {
-      digitalWrite(latchPin, LOW);
-      shiftOut(dataPin, clockPin, MSBFIRST, thisByte);
-      digitalWrite(latchPin, HIGH);
-      delay(30);
-      digitalWrite(latchPin, LOW);
-      shiftOut(dataPin, clockPin, MSBFIRST, B00000000);
-      digitalWrite(latchPin, HIGH);
-      delay(30);
-    }
+  unsigned long enumStart = micros();
+  for(byte bit=0; bit<ENUM_BITS; bit++) {
+    setIdLines(bit);
+    delayMicroseconds(ID_SETTLE_US);
+    Wire.beginTransmission(0); // broadcast to all modules
+    Wire.write(12); // message type 12 (enumeration step)
+    Wire.write(bit);
+    Wire.endTransmission();
   }
-  
-  delay(100); // wait for modules to be sure of their IDs
+  setIdLines(ENUM_BITS);
+  Wire.beginTransmission(0);
+  Wire.write(13); // message type 13 (end of enumeration)
+  Wire.endTransmission();
+  Serial.print("enumeration took ");
+  Serial.print(micros() - enumStart);
+  Serial.println(" us");
   
   for(int i=0; i<maxModules; i++) {
     moduleTypes[i] = 0; // default to type 0 (no module connected)
@@ -65,64 +72,192 @@ void setup()
   Serial.println("end of setup");
 }
 
+// put the given bit of each slot's number on its ID line. Slot numbers are below 2^ENUM_BITS, so
+// bit ENUM_BITS pulls all lines low
+void setIdLines(byte bit)
+{
+  digitalWrite(latchPin, LOW);
+  for(int b=ID_BYTES-1; b>=0; b--) { // last register in the chain first
+    byte thisByte = 0;
+    for(byte i=0; i<8; i++) {
+      int slot = b*8 + i;
+      if(slot < maxModules && bitRead(slot+1, bit)) bitSet(thisByte, i);
+    }
+    shiftOut(dataPin, clockPin, MSBFIRST, thisByte);
+  }
+  digitalWrite(latchPin, HIGH);
+}
+
 byte thisMessage[8]; // max message length currently 5 but giving some wiggle room
-byte messageLengths[] = {2,1,3,3,3,3,5,5};
+byte messageLengths[] = {2,1,3,3,3,3,5,5,2,3,3,2,2,1};
+
+// Connection detection is done with type 11 steps, each one reads a bit and writes the next one,
+// so a round is one broadcast per bit of the 6 bit socket ID plus one, instead of 32 ticks
+#define DETECT_STEPS 7
+
+// Detection steps are sent back to back, tickInterval apart. Modules report ticks they missed and
+// connection readings that didn't repeat (type 9 message); if any do, the interval is doubled,
+// and after a run of clean cycles it is shortened again, so ticks go as fast as the modules tolerate.
+#define TICK_INTERVAL_MAX 5000 // us
+#define CLEAN_CYCLES_BEFORE_SPEEDUP 100
+unsigned int tickInterval = 0; // us between two tick broadcasts
+unsigned int cleanCycles = 0;
+
+// Each module's changes are read in one transaction: a changes request (type 8) with the number of
+// bytes we are going to read, then a repeated start and the read. The first byte of the reply is the
+// number of message bytes that follow, with bit 7 set if the module has more waiting.
+// Modules that had nothing to say last time are only asked for room for one message, so an idle
+// module costs a few bytes on the bus.
+#define REPORT_SMALL 6 // length byte + one 5-byte message
+#define REPORT_MAX 32 // Wire buffer size
+byte reportSize[maxModules];
+
+byte dirtyModules[maxModules]; // slots found holding the attention line after a tick cycle
+byte numDirty;
+// when more than half of the modules had changes last time, finding them costs more than reading them all
+byte lastDirty = 0;
+
+unsigned long cycles = 0;
+unsigned long cycleStart = 0;
+
 void loop()
 {
-  Wire.beginTransmission(0); // broadcast to all modules
-  Wire.write(0); // message type 0 (tick)
-  Wire.write(tickNum);
-  Wire.endTransmission();    // stop transmitting
-
-  tickNum++;
-
-  if(tickNum == 32) {
-    // on last tick, request data from all modules
-    for(uint8_t n=0; n<=maxModules; n++) {
-      Wire.requestFrom(n+1,1); // request data
-      uint8_t bytesExpected = 0;
-      while(Wire.available()) {
-        bytesExpected = Wire.read();        
-      }
-      byte byteNum = 0;
-      uint8_t channelNum = n+1;
-      Wire.requestFrom(channelNum,bytesExpected);
-      while(Wire.available()) {
-        thisMessage[byteNum] = Wire.read();
-        byteNum ++;
-        if(byteNum >= messageLengths[thisMessage[0]]) {
-          // message complete, handle command
-          switch(thisMessage[0]) {
-            case 6:
-            Serial.print("connection ");
-            Serial.print(thisMessage[1]);
-            Serial.print(thisMessage[2]);
-            Serial.print(thisMessage[3]);
-            Serial.println(thisMessage[4]);
-            break;
-
-            case 7:
-            Serial.println("disconnection");
-            break;
-
-            case 2:
-            Serial.print("analog value: ");
-            Serial.println(thisMessage[2]);
-            Wire.beginTransmission(channelNum); // broadcast to all modules
-            Wire.write(5); // message type 0 (tick)
-            byte digiChan = thisMessage[2]/128;
-            byte digiVal = (thisMessage[2]/8)%2;
-            Wire.write(digiChan);
-            Wire.write(digiVal);
-            Wire.endTransmission();
-          }
-          byteNum = 0;
+  if(cycles == 0) {
+    for(int i=0; i<maxModules; i++) reportSize[i] = REPORT_SMALL;
+    cycleStart = millis();
+  }
+
+  for(tickNum=0; tickNum<DETECT_STEPS; tickNum++) {
+    Wire.beginTransmission(0); // broadcast to all modules
+    Wire.write(11); // message type 11 (detection step)
+    Wire.write(tickNum);
+    Wire.endTransmission();    // stop transmitting
+    if(tickInterval > 0) delayMicroseconds(tickInterval);
+  }
+
+  // on last step, request data from the modules that have some. Step 0 asked all modules to hold the
+  // attention line if they have changes, so if it's high there is nothing to read at all
+  bool tickProblems = false;
+  numDirty = 0;
+  if(lastDirty > maxModules/2) {
+    for(byte n=0; n<maxModules; n++) dirtyModules[numDirty++] = n;
+  } else if(digitalRead(attnPin) == LOW) {
+    findDirtyModules(0, maxModules-1, true);
+  }
+  lastDirty = 0;
+  for(byte i=0; i<numDirty; i++) {
+    if(moduleTypes[dirtyModules[i]] == 0) continue; // empty slot
+    if(pollModule(dirtyModules[i])) tickProblems = true;
+  }
+
+  if(tickProblems) {
+    tickInterval = min(2*tickInterval + 10, TICK_INTERVAL_MAX);
+    cleanCycles = 0;
+    Serial.print("tick interval ");
+    Serial.println(tickInterval);
+  } else if(tickInterval > 0 && ++cleanCycles >= CLEAN_CYCLES_BEFORE_SPEEDUP) {
+    tickInterval -= tickInterval/8 + 1;
+    cleanCycles = 0;
+  }
+
+  cycles++;
+  if(millis() - cycleStart >= 5000) {
+    Serial.print(cycles * 1000 / (millis() - cycleStart));
+    Serial.print(" connection cycles per second, tick interval ");
+    Serial.println(tickInterval);
+    cycles = 1;
+    cycleStart = millis();
+  }
+}
+
+// find the modules in slots first..last with changes by asking only that range to hold the attention
+// line (type 10 message) and splitting it until single modules are left. If the first half turns out
+// quiet, the second half must be the one holding the line, no need to ask
+void findDirtyModules(uint8_t first, uint8_t last, bool known)
+{
+  if(!known) {
+    Wire.beginTransmission(0); // broadcast to all modules
+    Wire.write(10); // message type 10 (attention query)
+    Wire.write(first+1);
+    Wire.write(last+1);
+    Wire.endTransmission();
+    delayMicroseconds(10); // let the modules update the line
+    if(digitalRead(attnPin) == HIGH) return;
+  }
+  if(first == last) {
+    dirtyModules[numDirty++] = first;
+    return;
+  }
+  uint8_t middle = (first + last) / 2;
+  byte numBefore = numDirty;
+  findDirtyModules(first, middle, false);
+  findDirtyModules(middle+1, last, numDirty == numBefore);
+}
+
+// read and handle the changes of one module, returns true if it reported tick problems
+bool pollModule(uint8_t n)
+{
+  uint8_t channelNum = n+1;
+  bool tickProblems = false;
+  bool hadChanges = false;
+  bool more = true;
+
+  while(more) {
+    Wire.beginTransmission(channelNum);
+    Wire.write(8); // message type 8 (changes request)
+    Wire.write(reportSize[n]);
+    Wire.endTransmission(false); // repeated start, the read below is part of the same transaction
+    Wire.requestFrom(channelNum, reportSize[n]);
+    if(!Wire.available()) return false;
+    byte header = Wire.read();
+    byte bytesExpected = header & 0x3F;
+    more = header & 0x80;
+    if(bytesExpected > 0 && !hadChanges) {
+      hadChanges = true;
+      lastDirty++;
+    }
+    reportSize[n] = (bytesExpected > 0 || more) ? REPORT_MAX : REPORT_SMALL;
+
+    byte byteNum = 0;
+    while(Wire.available() && bytesExpected > 0) {
+      thisMessage[byteNum] = Wire.read();
+      bytesExpected--;
+      byteNum ++;
+      if(byteNum >= messageLengths[thisMessage[0]]) {
+        // message complete, handle command
+        switch(thisMessage[0]) {
+          case 6:
+          Serial.print("connection ");
+          Serial.print(thisMessage[1]);
+          Serial.print(thisMessage[2]);
+          Serial.print(thisMessage[3]);
+          Serial.println(thisMessage[4]);
+          break;
+
+          case 7:
+          Serial.println("disconnection");
+          break;
+
+          case 9:
+          // missed ticks and unstable connection readings since last report
+          tickProblems = true;
+          break;
+
+          case 2:
+          Serial.print("analog value: ");
+          Serial.println(thisMessage[2]);
+          Wire.beginTransmission(channelNum); // broadcast to all modules
+          Wire.write(5); // message type 0 (tick)
+          byte digiChan = thisMessage[2]/128;
+          byte digiVal = (thisMessage[2]/8)%2;
+          Wire.write(digiChan);
+          Wire.write(digiVal);
+          Wire.endTransmission();
         }
+        byteNum = 0;
       }
     }
-    tickNum = 0;
-    delayMicroseconds(10);
+    while(Wire.available()) Wire.read(); // padding after the last message
   }
-  delay(5);
-  delayMicroseconds(10);
+  return tickProblems;
 }
@@ -1,11 +1,11 @@
-#include <Bounce2.h>
 #include <Wire.h>
 
-byte idPin = 10;
+byte idPin = 10; // driven by the main board's ID shift register, one line per slot
+byte attnPin = 11; // shared with all modules and the main board, pulled low while we have changes to report
 int moduleNum = 0;
 int moduleType = 43; // will be different for a VCO, LFO, etc
-unsigned long lastRead = 0;
 bool foundModuleNum = false;
+bool announcedModuleNum = false;
 const byte socketOutPins[] = {2,3,4,5};
 const byte socketInPins[] = {6,7,8,9};
 const byte digitalOutPins[] = {13,12};
@@ -20,9 +20,14 @@ bool sendDisconnection[4];
 byte everConnected[4];
 byte storedAnalogValues[6];
 bool analogChanges[6] = {false, false, false, false, false, false};
+byte missedTicks = 0; // ticks that didn't follow the previous one
+byte unstableReadings = 0; // connection readings that changed again before being confirmed
+byte attnFirst = 1; // range of module numbers asked to hold the attention line (type 10 message)
+byte attnLast = 127;
 
-Bounce b = Bounce();
-Bounce b2 = Bounce();
+// Until the main board has given us a slot number we listen on an address no slot uses; only
+// broadcasts (enumeration steps) are sent to modules in that state
+#define ENUM_ADDRESS 127
 
 void setup() {
   while(!Serial);
@@ -38,40 +43,56 @@ void setup() {
   for(byte i=0; i<2; i++) {
     pinMode(digitalOutPins[i], OUTPUT);
   }
-  b.attach(idPin, INPUT);
-  b.interval(1);
-  
-  delay(1000); // wait for main module to boot up
-  lastRead = millis();
+  pinMode(idPin, INPUT);
+
+  Wire.begin(ENUM_ADDRESS);
+  TWAR = (ENUM_ADDRESS << 1) | 1; // enable broadcasts to be received http://www.gammon.com.au/i2c
+  Wire.onReceive(receiveEvent);
+  Wire.onRequest(requestEvent);
   Serial.println("listening...");
 }
 
 void loop() {
-  if(!foundModuleNum) {
-    b.update();
-    if(b.rose()) {
-      moduleNum ++;
-      lastRead = millis();
-    }
-    if(!foundModuleNum && millis() > lastRead + 50 && moduleNum > 0) {
-      foundModuleNum = true;
-      Wire.begin(moduleNum);
-      TWAR = (moduleNum << 1) | 1; // enable broadcasts to be received http://www.gammon.com.au/i2c
-      Wire.onReceive(receiveEvent);
-      Wire.onRequest(requestEvent);
-      Serial.print("module type ");
-      Serial.print(moduleType);
-      Serial.print(" found in slot ");
-      Serial.println(moduleNum);
+  if(foundModuleNum && !announcedModuleNum) {
+    announcedModuleNum = true;
+    Serial.print("module type ");
+    Serial.print(moduleType);
+    Serial.print(" found in slot ");
+    Serial.println(moduleNum);
+  }
+
+  // analog changes are picked up here rather than in requestEvent, which runs in the I2C interrupt
+  for(byte i=0; i<6; i++) {
+    byte newAnalogReading = analogRead(analogPins[i]) / 4;
+    if(newAnalogReading != storedAnalogValues[i]) {
+      storedAnalogValues[i] = newAnalogReading;
+      analogChanges[i] = true;
     }
   }
-  b2.update();
+  if(foundModuleNum) {
+    noInterrupts();
+    updateAttention();
+    interrupts();
+  }
 }
 
 byte byteNum = 0;
-byte message[2];
+byte message[3];
 byte tickNum = 0;
-byte messageLengths[] = {2,1,3,3,3,3,5,5};
+byte expectedTick = 0;
+byte messageLengths[] = {2,1,3,3,3,3,5,5,2,3,3,2,2,1};
+
+// Detection steps (type 11): one broadcast per ID bit instead of a write tick and a read tick.
+// The ID is the module number (4 bits, up to 15 modules) then the socket (2 bits), low bit first.
+// An unconnected input reads all ones, which would be module 15, so that slot is never used.
+#define MODULE_BITS 4
+#define SOCKET_BITS 2
+#define DETECT_STEPS (MODULE_BITS + SOCKET_BITS + 1)
+#define DETECT_GUARD_US 20 // wait before writing so slower modules have read the previous bit
+
+// Enumeration: for each bit of the slot number the main board sets every slot's ID line to that bit
+// of its number and broadcasts a type 12 message with the bit number, we sample the line when it
+// arrives. A type 13 broadcast ends enumeration and we move to our slot number's address.
 
 void receiveEvent(int howMany) {
   while(Wire.available()) {
@@ -82,87 +103,145 @@ void receiveEvent(int howMany) {
       switch(message[0]) {
         case 0:
         tickNum = message[1];
+        if(tickNum == 0) {
+          attnFirst = 1;
+          attnLast = 127;
+        }
+        if(tickNum != expectedTick && missedTicks < 255) {
+          missedTicks ++;
+        }
+        expectedTick = (tickNum + 1) % 32;
         doTick();
         break;
+
+        case 11:
+        tickNum = message[1];
+        if(tickNum == 0) {
+          attnFirst = 1;
+          attnLast = 127;
+        }
+        if(tickNum != expectedTick && missedTicks < 255) {
+          missedTicks ++;
+        }
+        expectedTick = (tickNum + 1) % DETECT_STEPS;
+        doDetectStep();
+        break;
         
         case 5:
-        byte channelNum = message[1];
-        if(channelNum <= 1) {
-          digitalWrite(digitalOutPins[channelNum], message[2]);
+        if(message[1] <= 1) {
+          digitalWrite(digitalOutPins[message[1]], message[2]);
+        }
+        break;
+
+        case 10:
+        attnFirst = message[1];
+        attnLast = message[2];
+        break;
+
+        case 12:
+        if(message[1] == 0) {
+          moduleNum = 0;
+        }
+        bitWrite(moduleNum, message[1], digitalRead(idPin));
+        break;
+
+        case 13:
+        if(moduleNum > 0) {
+          TWAR = (moduleNum << 1) | 1; // new address, broadcasts still enabled
+          foundModuleNum = true;
         }
-        break; 
+        break;
       }
       byteNum = 0;
     }
   }
+  updateAttention();
+}
+
+bool hasChanges() {
+  for(byte i=0; i<4; i++) {
+    if(sendConnection[i] || sendDisconnection[i]) return true;
+  }
+  for(byte i=0; i<6; i++) {
+    if(analogChanges[i]) return true;
+  }
+  return missedTicks > 0 || unstableReadings > 0;
+}
+
+// open drain: pull the attention line low if we have changes and are in the range asked for, otherwise let go
+void updateAttention() {
+  if(hasChanges() && moduleNum >= attnFirst && moduleNum <= attnLast) {
+    digitalWrite(attnPin, LOW);
+    pinMode(attnPin, OUTPUT);
+  } else {
+    pinMode(attnPin, INPUT);
+  }
+}
+
+byte report[32];
+byte reportLength;
+
+// append a message to the report if there is room for it
+bool addToReport(byte type, byte b1, byte b2, byte b3, byte b4, byte maxLength) {
+  if(reportLength + messageLengths[type] > maxLength) {
+    return false;
+  }
+  byte data[] = {type, b1, b2, b3, b4};
+  for(byte i=0; i<messageLengths[type]; i++) {
+    report[reportLength++] = data[i];
+  }
+  return true;
 }
 
-bool numBytesSent = false;
 void requestEvent() {
   if(message[0]==1) {
     // send module type
     Wire.write(moduleType);
     Serial.println("sending module type");
-  } else if(message[0]==0) {
-    // send changed data
-    byte numNewConnected = 0;
-    byte numNewDisconnected = 0;
+  } else if(message[0]==8) {
+    // send changed data in one go: number of message bytes (bit 7 set if more is waiting), then the
+    // messages, as many as fit in what the main board reads. Whatever doesn't fit stays flagged for
+    // the next request.
+    byte maxLength = min(message[1], sizeof(report));
+    bool more = false;
+    reportLength = 1;
     for(byte i=0; i<4; i++) {
       if(sendConnection[i]) {
-        numNewConnected ++;
+        if(addToReport(6, confirmedConnections[i][0], confirmedConnections[i][1], moduleNum, i, maxLength)) {
+          sendConnection[i] = false;
+        } else {
+          more = true;
+        }
       }
       if(sendDisconnection[i]) {
-        numNewDisconnected ++;
-      }
-    }
-
-    if(!numBytesSent) {
-      // calculate and send number of bytes to be expected
-      byte numBytesToSend = 0;
-      numBytesToSend += numNewConnected * messageLengths[6];
-      numBytesToSend += numNewDisconnected * messageLengths[7];
-      for(byte i=0; i<6; i++) {
-        byte newAnalogReading = analogRead(analogPins[i]) / 4;
-        if(newAnalogReading != storedAnalogValues[i]) {
-          storedAnalogValues[i] = newAnalogReading;
-          analogChanges[i] = true;
-          numBytesToSend += messageLengths[2];
+        if(addToReport(7, prevConfirmedConnections[i][0], prevConfirmedConnections[i][1], moduleNum, i, maxLength)) {
+          sendDisconnection[i] = false;
         } else {
-          analogChanges[i] = false;
+          more = true;
         }
       }
-      Wire.write(numBytesToSend);
-      numBytesSent = numBytesToSend > 0;
-    } else {
-      // send expected data
-      for(byte i=0; i<6; i++) {
-        if(analogChanges[i]) {
-          Wire.write(2); // analog message
-          Wire.write(i); // channel
-          Wire.write(storedAnalogValues[i]); // value
+    }
+    for(byte i=0; i<6; i++) {
+      if(analogChanges[i]) {
+        if(addToReport(2, i, storedAnalogValues[i], 0, 0, maxLength)) {
+          analogChanges[i] = false;
+        } else {
+          more = true;
         }
       }
-      for(byte i=0; i<4; i++) {
-        if(sendConnection[i]) {
-          Wire.write(6); // connection message
-          Wire.write(confirmedConnections[i][0]);
-          Wire.write(confirmedConnections[i][1]);
-          Wire.write(moduleNum);
-          Wire.write(i);
-          sendConnection[i] = false;
-        }
-        if(sendDisconnection[i]) {
-          Wire.write(7); // disconnection message
-          Wire.write(prevConfirmedConnections[i][0]);
-          Wire.write(prevConfirmedConnections[i][1]);
-          Wire.write(moduleNum);
-          Wire.write(i);
-          sendDisconnection[i] = false;
-        }
+    }
+    if(missedTicks > 0 || unstableReadings > 0) {
+      if(addToReport(9, missedTicks, unstableReadings, 0, 0, maxLength)) {
+        missedTicks = 0;
+        unstableReadings = 0;
+      } else {
+        more = true;
       }
-      numBytesSent = false;
     }
+    report[0] = (reportLength - 1) | (more ? 0x80 : 0);
+    Wire.write(report, reportLength);
   }
+  updateAttention();
 }
 
 void doTick() {
@@ -193,48 +272,95 @@ void doTick() {
     }
   }
   if(tickNum==31) {
+    confirmConnections();
+  }
+}
+
+// read the bit written on the previous step, then write the next one
+void doDetectStep() {
+  if(tickNum==0) {
+    for(byte i=0; i<4; i++) {
+      newConnections[i][0] = 0;
+      newConnections[i][1] = 0;
+    }
+  } else {
+    byte bitNum = tickNum - 1;
     for(byte i=0; i<4; i++) {
-      if(newConnections[i][0] != prevConnections[i][0] || newConnections[i][1] != prevConnections[i][1]) {
-        prevConnections[i][0] = newConnections[i][0];
-        prevConnections[i][1] = newConnections[i][1];
-        unchangedCount[i] = 0;
+      if(bitNum<SOCKET_BITS) {
+        bitWrite(newConnections[i][1], bitNum, digitalRead(socketInPins[i]));
       } else {
-        if(unchangedCount[i] < 3) {
-          unchangedCount[i] ++;
-        }
-        if(unchangedCount[i] == 2) {
-          prevConfirmedConnections[i][0] = confirmedConnections[i][0];
-          prevConfirmedConnections[i][1] = confirmedConnections[i][1];
-          confirmedConnections[i][0] = newConnections[i][0];
-          confirmedConnections[i][1] = newConnections[i][1];
-          if(confirmedConnections[i][0]==255) {
-            if(everConnected[i]) {
-              Serial.print("disconnect ");
-              Serial.print("m");
-              Serial.print(prevConfirmedConnections[i][0], DEC);
-              Serial.print("p");
-              Serial.print(prevConfirmedConnections[i][1], DEC);
-              Serial.print("->m");
-              Serial.print(moduleNum, DEC);
-              Serial.print("p");
-              Serial.print(i, DEC);
-              Serial.println("");
-              sendDisconnection[i] = true;
-            }
-          } else {
-            Serial.print("connect ");
+        bitWrite(newConnections[i][0], bitNum - SOCKET_BITS, digitalRead(socketInPins[i]));
+      }
+    }
+  }
+  if(tickNum < DETECT_STEPS - 1) {
+    delayMicroseconds(DETECT_GUARD_US);
+    for(byte i=0; i<4; i++) {
+      if(tickNum<SOCKET_BITS) {
+        digitalWrite(socketOutPins[i], bitRead(i, tickNum));
+      } else {
+        digitalWrite(socketOutPins[i], bitRead(moduleNum, tickNum - SOCKET_BITS));
+      }
+    }
+  } else {
+    for(byte i=0; i<4; i++) {
+      if(newConnections[i][0] == (1<<MODULE_BITS)-1 && newConnections[i][1] == (1<<SOCKET_BITS)-1) {
+        // nothing connected, same as with the 32 tick protocol
+        newConnections[i][0] = 255;
+        newConnections[i][1] = 255;
+      }
+    }
+    confirmConnections();
+  }
+}
+
+// a reading is confirmed when it comes back the same on the next round
+void confirmConnections() {
+  for(byte i=0; i<4; i++) {
+    if(newConnections[i][0] != prevConnections[i][0] || newConnections[i][1] != prevConnections[i][1]) {
+      prevConnections[i][0] = newConnections[i][0];
+      prevConnections[i][1] = newConnections[i][1];
+      if(unchangedCount[i] == 0 && unstableReadings < 255) {
+        // changed twice in a row, ticks are probably coming faster than the sockets settle
+        unstableReadings ++;
+      }
+      unchangedCount[i] = 0;
+    } else {
+      if(unchangedCount[i] < 3) {
+        unchangedCount[i] ++;
+      }
+      if(unchangedCount[i] == 2) {
+        prevConfirmedConnections[i][0] = confirmedConnections[i][0];
+        prevConfirmedConnections[i][1] = confirmedConnections[i][1];
+        confirmedConnections[i][0] = newConnections[i][0];
+        confirmedConnections[i][1] = newConnections[i][1];
+        if(confirmedConnections[i][0]==255) {
+          if(everConnected[i]) {
+            Serial.print("disconnect ");
             Serial.print("m");
-            Serial.print(confirmedConnections[i][0], DEC);
+            Serial.print(prevConfirmedConnections[i][0], DEC);
             Serial.print("p");
-            Serial.print(confirmedConnections[i][1], DEC);
+            Serial.print(prevConfirmedConnections[i][1], DEC);
             Serial.print("->m");
             Serial.print(moduleNum, DEC);
             Serial.print("p");
             Serial.print(i, DEC);
             Serial.println("");
-            sendConnection[i] = true;
-            everConnected[i] = true;
+            sendDisconnection[i] = true;
           }
+        } else {
+          Serial.print("connect ");
+          Serial.print("m");
+          Serial.print(confirmedConnections[i][0], DEC);
+          Serial.print("p");
+          Serial.print(confirmedConnections[i][1], DEC);
+          Serial.print("->m");
+          Serial.print(moduleNum, DEC);
+          Serial.print("p");
+          Serial.print(i, DEC);
+          Serial.println("");
+          sendConnection[i] = true;
+          everConnected[i] = true;
         }
       }
     }
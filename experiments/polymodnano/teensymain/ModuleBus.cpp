@@ -0,0 +1,247 @@
+#include "Arduino.h"
+#include <Wire.h>
+#include "ModuleBus.h"
+
+ModuleBusClass ModuleBus;
+
+#define RING_MASK (MODULE_BUS_QUEUE_SIZE-1)
+#define ERROR_FLAGS (LPI2C_MSR_NDF | LPI2C_MSR_ALF | LPI2C_MSR_FEF | LPI2C_MSR_PLTF)
+
+static IMXRT_LPI2C_t * const port = &IMXRT_LPI2C1;
+static uint8_t txFifoSize;
+
+static void lpi2c1Isr() {
+  ModuleBus.isr();
+}
+
+void ModuleBusClass::begin(uint32_t clock) {
+  // let Wire set up clocks, pins and bus timing, then take the peripheral over
+  Wire.begin();
+  Wire.setClock(clock);
+  txFifoSize = 1 << (port->PARAM & 0x0F);
+  port->MIER = 0;
+  port->MFCR = LPI2C_MFCR_TXWATER(1) | LPI2C_MFCR_RXWATER(0);
+  port->MSR = 0x7F00; // clear all flags
+  attachInterruptVector(IRQ_LPI2C1, lpi2c1Isr);
+  NVIC_SET_PRIORITY(IRQ_LPI2C1, 224); // below the audio library (208)
+  NVIC_ENABLE_IRQ(IRQ_LPI2C1);
+  resetStats();
+}
+
+bool ModuleBusClass::write(byte address, const byte *data, byte length, void (*callback)(ModuleBusTransaction &)) {
+  ModuleBusTransaction transaction;
+  transaction.address = address;
+  transaction.txLength = min(length, sizeof(transaction.txData));
+  memcpy(transaction.txData, data, transaction.txLength);
+  transaction.rxLength = 0;
+  transaction.callback = callback;
+  return queue(transaction);
+}
+
+bool ModuleBusClass::read(byte address, const byte *txData, byte txLength, byte rxLength, void (*callback)(ModuleBusTransaction &)) {
+  ModuleBusTransaction transaction;
+  transaction.address = address;
+  transaction.txLength = min(txLength, sizeof(transaction.txData));
+  memcpy(transaction.txData, txData, transaction.txLength);
+  transaction.rxLength = min(rxLength, MODULE_BUS_MAX_READ);
+  transaction.callback = callback;
+  return queue(transaction);
+}
+
+bool ModuleBusClass::detectCycle() {
+  byte steps = MODULE_ID_BITS + _pinIdBits + 1;
+  if(MODULE_BUS_QUEUE_SIZE - 1 - ((_tail - _reap) & RING_MASK) < steps) return false; // the whole round or nothing
+  byte first[] = {I2C_DETECT, 0, _pinIdBits};
+  write(0, first, 3);
+  for(byte step=1; step<steps; step++) {
+    byte message[] = {I2C_DETECT, step};
+    write(0, message, 2);
+  }
+  return true;
+}
+
+bool ModuleBusClass::requestChanges(byte address) {
+  byte message[] = {I2C_GET_CHANGES};
+  return read(address, message, 1, _changesMaxSize, changesReceived);
+}
+
+// same parsing as getChanges() in arduino-poll.py
+void ModuleBusClass::changesReceived(ModuleBusTransaction &transaction) {
+  if(!transaction.ok || !ModuleBus._changeHandler) return;
+  const byte *data = transaction.rxData;
+  byte ptr = 0;
+  while(ptr < transaction.received && data[ptr] != I2C_TAG_END) {
+    ModuleChange change = {};
+    change.tag = data[ptr] & I2C_TAG_MASK;
+    change.moduleId = transaction.address;
+    change.pinId = data[ptr] & ~I2C_TAG_MASK;
+    switch(change.tag) {
+      case I2C_TAG_ANALOG_VALUE:
+        if(ptr + 3 > transaction.received) return;
+        change.value = (data[ptr+1] << 8) + data[ptr+2];
+        ptr += 3;
+        break;
+      case I2C_TAG_DIGITAL_VALUE:
+        if(ptr + 2 > transaction.received) return;
+        change.value = data[ptr+1];
+        ptr += 2;
+        break;
+      case I2C_TAG_CONNECTION:
+        if(ptr + 3 > transaction.received) return;
+        change.fromModuleId = data[ptr+1] & 0x7F;
+        change.connected = data[ptr+1] & 0x80;
+        change.fromPinId = data[ptr+2];
+        ptr += 3;
+        break;
+      case I2C_TAG_CONNECTION_16:
+        if(ptr + 4 > transaction.received) return;
+        change.tag = I2C_TAG_CONNECTION;
+        change.fromModuleId = data[ptr+1] & 0x7F;
+        change.connected = data[ptr+1] & 0x80;
+        change.fromPinId = (data[ptr+2] << 8) + data[ptr+3];
+        ptr += 4;
+        break;
+      default:
+        return; // unknown tag, can't tell how long it is
+    }
+    ModuleBus._changeHandler(change);
+  }
+  // drain the module in the same pass, the next frame carries on where this one stopped
+  if(ptr + 1 < transaction.received && (data[ptr+1] & I2C_MORE_PENDING)) {
+    ModuleBus.stats.continuations++;
+    ModuleBus.requestChanges(transaction.address);
+  }
+}
+
+void ModuleBusClass::update() {
+  while(_reap != _active) {
+    ModuleBusTransaction &transaction = _ring[_reap];
+    if(transaction.callback) transaction.callback(transaction);
+    _reap = (_reap + 1) & RING_MASK;
+  }
+}
+
+bool ModuleBusClass::queue(ModuleBusTransaction &transaction) {
+  NVIC_DISABLE_IRQ(IRQ_LPI2C1);
+  byte next = (_tail + 1) & RING_MASK;
+  if(next == _reap) {
+    stats.dropped++;
+    NVIC_ENABLE_IRQ(IRQ_LPI2C1);
+    return false;
+  }
+  _ring[_tail] = transaction;
+  _tail = next;
+  byte depth = (_tail - _reap) & RING_MASK;
+  if(depth > stats.maxQueueDepth) stats.maxQueueDepth = depth;
+  if(!_busy) start();
+  NVIC_ENABLE_IRQ(IRQ_LPI2C1);
+  return true;
+}
+
+// put the transaction at _active on the bus, called with the interrupt disabled or from it
+void ModuleBusClass::start() {
+  ModuleBusTransaction &transaction = _ring[_active];
+  _numCommands = 0;
+  if(transaction.txLength > 0 || transaction.rxLength == 0) {
+    _commands[_numCommands++] = LPI2C_MTDR_CMD_START | (transaction.address << 1);
+    for(byte i=0; i<transaction.txLength; i++) {
+      _commands[_numCommands++] = LPI2C_MTDR_CMD_TRANSMIT | transaction.txData[i];
+    }
+    stats.bytes += 1 + transaction.txLength;
+  }
+  if(transaction.rxLength > 0) {
+    // repeated start if something was written first
+    _commands[_numCommands++] = LPI2C_MTDR_CMD_START | (transaction.address << 1) | 1;
+    _commands[_numCommands++] = LPI2C_MTDR_CMD_RECEIVE | (transaction.rxLength - 1);
+    stats.bytes += 1 + transaction.rxLength;
+  }
+  _commands[_numCommands++] = LPI2C_MTDR_CMD_STOP;
+  _nextCommand = 0;
+  transaction.received = 0;
+  _failed = false;
+  _busy = true;
+  _startMicros = micros();
+  stats.transactions++;
+  port->MSR = 0x7F00;
+  port->MIER = LPI2C_MIER_TDIE | LPI2C_MIER_RDIE | LPI2C_MIER_SDIE | LPI2C_MIER_NDIE | LPI2C_MIER_ALIE | LPI2C_MIER_FEIE | LPI2C_MIER_PLTIE;
+}
+
+void ModuleBusClass::finish(bool ok) {
+  ModuleBusTransaction &transaction = _ring[_active];
+  transaction.ok = ok && transaction.received == transaction.rxLength;
+  stats.busyMicros += micros() - _startMicros;
+  port->MIER = 0;
+  _busy = false;
+  _active = (_active + 1) & RING_MASK;
+  if(_active != _tail) start();
+}
+
+void ModuleBusClass::isr() {
+  ModuleBusTransaction &transaction = _ring[_active];
+  uint32_t status = port->MSR;
+
+  if(status & ERROR_FLAGS) {
+    if(status & LPI2C_MSR_NDF) stats.nacks++; // nobody at this address
+    else stats.errors++;
+    _failed = true;
+    // drop the rest of the transaction and end it with a stop if we still own the bus
+    port->MCR |= LPI2C_MCR_RTF | LPI2C_MCR_RRF;
+    port->MSR = ERROR_FLAGS;
+    _nextCommand = _numCommands;
+    if(port->MSR & LPI2C_MSR_MBF) {
+      port->MTDR = LPI2C_MTDR_CMD_STOP;
+    } else {
+      finish(false);
+      return;
+    }
+  }
+
+  // pick up received bytes
+  while(true) {
+    uint32_t data = port->MRDR;
+    if(data & LPI2C_MRDR_RXEMPTY) break;
+    if(transaction.received < transaction.rxLength) transaction.rxData[transaction.received++] = data;
+  }
+
+  // refill the command FIFO
+  while(_nextCommand < _numCommands && (port->MFSR & 0x07) < txFifoSize) {
+    port->MTDR = _commands[_nextCommand++];
+  }
+  if(_nextCommand >= _numCommands) port->MIER &= ~LPI2C_MIER_TDIE;
+
+  if(status & LPI2C_MSR_SDF) {
+    port->MSR = LPI2C_MSR_SDF;
+    finish(!_failed);
+  }
+}
+
+void ModuleBusClass::resetStats() {
+  NVIC_DISABLE_IRQ(IRQ_LPI2C1);
+  memset(&stats, 0, sizeof(stats));
+  _statsStart = micros();
+  NVIC_ENABLE_IRQ(IRQ_LPI2C1);
+}
+
+float ModuleBusClass::utilisation() {
+  unsigned long elapsed = micros() - _statsStart;
+  return elapsed ? (float)stats.busyMicros / elapsed : 0;
+}
+
+void ModuleBusClass::printStats() {
+  Serial.print("module bus: ");
+  Serial.print(utilisation() * 100, 1);
+  Serial.print("% busy, ");
+  Serial.print(stats.transactions);
+  Serial.print(" transactions, ");
+  Serial.print(stats.bytes);
+  Serial.print(" bytes, ");
+  Serial.print(stats.nacks);
+  Serial.print(" nacks, ");
+  Serial.print(stats.errors);
+  Serial.print(" errors, ");
+  Serial.print(stats.dropped);
+  Serial.print(" dropped, ");
+  Serial.print(stats.continuations);
+  Serial.print(" continuations, max queue ");
+  Serial.println(stats.maxQueueDepth);
+}
@@ -0,0 +1,120 @@
+#ifndef ModuleBus_h
+#define ModuleBus_h
+#include "Arduino.h"
+
+// Non-blocking I2C master for the module bus (diag01 protocol), on LPI2C1 (pins 18/19).
+//
+// Transactions are queued and run one after the other from the LPI2C interrupt, the CPU only
+// touches the bus to refill the 4 word FIFOs. Nothing waits for the bus: loop() queues a detection round
+// and the change reads, and calls update(), which hands finished transactions to their callbacks
+// (in loop context, so they can change the audio graph) and parses change reports into
+// ModuleChange records.
+// The interrupt runs at a lower priority than the audio library, so audio updates are never held up;
+// the bus just stretches the clock until the FIFO is refilled.
+
+#define MODULE_BUS_QUEUE_SIZE 64 // power of two, room for a detection round and the change reads
+#define MODULE_BUS_MAX_READ 32
+
+// diag01 commands
+#define I2C_TICK               0
+#define I2C_GET_CHANGES        1
+#define I2C_REQUEST_FULLSTATE  2
+#define I2C_WRITE_DIGITAL      3
+#define I2C_WRITE_PWM          4
+#define I2C_ATTN_QUERY         5
+#define I2C_DETECT             6
+#define I2C_GET_QUALITY        7 // connection detection quality of one socket input, see diag01.ino
+#define I2C_SET_CONFIG         32
+
+// connection IDs are moduleId then pinId, one bit per I2C_DETECT step
+#define MODULE_ID_BITS 7
+
+// diag01 change report tags
+#define I2C_TAG_ANALOG_VALUE   0b00000000
+#define I2C_TAG_DIGITAL_VALUE  0b01000000
+#define I2C_TAG_CONNECTION     0b10000000
+#define I2C_TAG_CONNECTION_16  0b11000000 // connection from a pinId above 255, to pinId <= 62 (63 would read as I2C_TAG_END)
+#define I2C_TAG_END            0b11111111
+#define I2C_TAG_MASK           0b11000000
+#define I2C_MORE_PENDING       0x01 // in the byte after I2C_TAG_END: the module has more, read again
+
+struct ModuleBusTransaction {
+  byte address;
+  byte txData[4];
+  byte txLength;
+  byte rxData[MODULE_BUS_MAX_READ];
+  byte rxLength;
+  byte received;
+  bool ok; // false if NACKed or the bus failed
+  void (*callback)(ModuleBusTransaction &transaction);
+};
+
+struct ModuleChange {
+  byte tag; // I2C_TAG_ANALOG_VALUE, I2C_TAG_DIGITAL_VALUE or I2C_TAG_CONNECTION (also for I2C_TAG_CONNECTION_16)
+  byte moduleId; // module reporting the change
+  byte pinId;
+  uint16_t value; // analog and digital inputs
+  byte fromModuleId; // connections: the output patched to pinId
+  uint16_t fromPinId;
+  bool connected;
+};
+
+struct ModuleBusStats {
+  unsigned long transactions;
+  unsigned long bytes; // address and data bytes on the bus
+  unsigned long nacks;
+  unsigned long errors; // arbitration lost, FIFO errors
+  unsigned long dropped; // queue full
+  unsigned long continuations; // change reports read again because the module had more
+  unsigned long busyMicros; // time spent in transactions
+  byte maxQueueDepth;
+};
+
+class ModuleBusClass {
+  public:
+    void begin(uint32_t clock = 400000);
+    bool write(byte address, const byte *data, byte length, void (*callback)(ModuleBusTransaction &) = NULL);
+    bool read(byte address, const byte *txData, byte txLength, byte rxLength, void (*callback)(ModuleBusTransaction &));
+    bool detectCycle(); // queue the I2C_DETECT broadcasts of a connection detection round
+    void setPinIdBits(byte bits) { _pinIdBits = bits; };
+    bool requestChanges(byte address); // queue a change report read, records go to the onChange handler, continuation frames are read too
+    void onChange(void (*handler)(const ModuleChange &change)) { _changeHandler = handler; };
+    void setChangesMaxSize(byte size) { _changesMaxSize = min(size, MODULE_BUS_MAX_READ); };
+    byte changesMaxSize() { return _changesMaxSize; }; // modules must be told with I2C_SET_CONFIG
+    void update(); // call from loop(), runs the callbacks of finished transactions
+    bool idle() { return _reap == _tail; }; // nothing queued, in flight or waiting for its callback
+    byte queued() { return (_tail - _active) & (MODULE_BUS_QUEUE_SIZE-1); };
+
+    ModuleBusStats stats;
+    void resetStats();
+    float utilisation(); // fraction of the time since resetStats() the bus was busy
+    void printStats();
+
+    void isr();
+  private:
+    bool queue(ModuleBusTransaction &transaction);
+    void start();
+    void finish(bool ok);
+    static void changesReceived(ModuleBusTransaction &transaction);
+
+    ModuleBusTransaction _ring[MODULE_BUS_QUEUE_SIZE];
+    volatile byte _reap = 0; // next finished transaction to hand to its callback
+    volatile byte _active = 0; // transaction on the bus, or next to start
+    volatile byte _tail = 0; // next free slot
+    volatile bool _busy = false;
+    volatile bool _failed = false;
+
+    uint16_t _commands[8]; // LPI2C command words for the transaction on the bus
+    byte _numCommands;
+    volatile byte _nextCommand;
+    unsigned long _startMicros;
+    unsigned long _statsStart;
+
+    byte _changesMaxSize = 14; // 4 records, end tag and flags
+    byte _pinIdBits = 6;
+    void (*_changeHandler)(const ModuleChange &change) = NULL;
+};
+
+extern ModuleBusClass ModuleBus;
+
+#endif
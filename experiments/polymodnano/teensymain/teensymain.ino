@@ -10,6 +10,7 @@
 #include "ModuleLFO.h"
 //#include "ModuleMIDI.h"
 #include "ModuleMaster.h"
+#include "ModuleBus.h"
 
 AudioControlSGTL5000 sgtl; // teensy audio board chip
 
@@ -17,6 +18,9 @@ Module *m[8];
 VirtualPatchCable *vpc[8];
 int patchIndex = 0; // temp
 
+byte moduleAddresses[] = { 4 }; // I2C addresses of the modules on the bus
+unsigned long lastBusStats = 0;
+
 void setup() {
   while(!Serial);
   Serial.begin(9600); // opens serial port, sets data rate to 9600 bps
@@ -29,6 +33,57 @@ void setup() {
   m[1] = new ModuleLFO();
   m[2] = new ModuleMaster();
   //m[3] = new ModuleMIDI();
+
+  ModuleBus.begin(400000);
+  ModuleBus.onChange(moduleChanged);
+  byte config[] = {I2C_SET_CONFIG, ModuleBus.changesMaxSize()}; // modules fill their reports up to what we read
+  ModuleBus.write(0, config, 2);
+  byte message[] = {I2C_REQUEST_FULLSTATE, 0};
+  ModuleBus.write(0, message, 2);
+}
+
+void makeConnection(byte outModule, byte outSocket, byte inModule, byte inSocket) {
+  if(m[outModule]!=NULL&&m[inModule]!=NULL) { // check modules exist
+    if(m[outModule]->socketOutputs[outSocket]->patchCableNum==-1&&m[inModule]->socketInputs[inSocket]->patchCableNum==-1) {
+      Serial.println("trying to create patch cable");
+      vpc[patchIndex] = new VirtualPatchCable(m[outModule]->socketOutputs[outSocket]->audioStreamSet,0,m[inModule]->socketInputs[inSocket]->audioStreamSet,0);
+      m[outModule]->socketOutputs[outSocket]->patchCableNum = patchIndex;
+      m[inModule]->socketInputs[inSocket]->patchCableNum = patchIndex;
+      patchIndex ++;
+    } else {
+      Serial.println("cable already connected");
+    }
+  } else {
+    Serial.println("a module doesn't exist");
+  }
+}
+
+void breakConnection(byte outModule, byte outSocket, byte inModule, byte inSocket) {
+  int outputPatchNum = m[outModule]->socketOutputs[outSocket]->patchCableNum;
+  int inputPatchNum = m[inModule]->socketInputs[inSocket]->patchCableNum;
+  if(outputPatchNum == inputPatchNum && outputPatchNum != -1) {
+    delete vpc[outputPatchNum];
+    vpc[outputPatchNum] = NULL;
+    m[outModule]->socketOutputs[outSocket]->patchCableNum = -1;
+    m[inModule]->socketInputs[inSocket]->patchCableNum = -1;
+  }
+}
+
+// change reported by a module on the I2C bus, called from ModuleBus.update() in loop()
+void moduleChanged(const ModuleChange &change) {
+  if(change.moduleId >= 8 || change.pinId >= 8) return;
+  switch(change.tag) {
+    case I2C_TAG_CONNECTION:
+      if(change.fromModuleId >= 8 || change.fromPinId >= 8) return;
+      if(change.connected) makeConnection(change.fromModuleId, change.fromPinId, change.moduleId, change.pinId);
+      else breakConnection(change.fromModuleId, change.fromPinId, change.moduleId, change.pinId);
+      break;
+    case I2C_TAG_ANALOG_VALUE:
+      if(m[change.moduleId]!=NULL && m[change.moduleId]->analogInputs[change.pinId]!=NULL) {
+        m[change.moduleId]->analogInputs[change.pinId]->setValue(change.value);
+      }
+      break;
+  }
 }
 
 bool added1 = false;
@@ -56,34 +111,29 @@ void loop() {
         messageIndex = 0;
 
         if(thisMessage[0] == 0) {
-          // make connection
-          if(m[thisMessage[1]]!=NULL&&m[thisMessage[3]]!=NULL) { // check modules exist
-            if(m[thisMessage[1]]->socketOutputs[thisMessage[2]]->patchCableNum==-1&&m[thisMessage[3]]->socketInputs[thisMessage[4]]->patchCableNum==-1) {
-              Serial.println("trying to create patch cable");
-              vpc[patchIndex] = new VirtualPatchCable(m[thisMessage[1]]->socketOutputs[thisMessage[2]]->audioStreamSet,0,m[thisMessage[3]]->socketInputs[thisMessage[4]]->audioStreamSet,0);
-              m[thisMessage[1]]->socketOutputs[thisMessage[2]]->patchCableNum = patchIndex;
-              m[thisMessage[3]]->socketInputs[thisMessage[4]]->patchCableNum = patchIndex;
-              patchIndex ++;
-            } else {
-              Serial.println("cable already connected");
-            }
-          } else {
-            Serial.println("a module doesn't exist");
-          }
+          makeConnection(thisMessage[1], thisMessage[2], thisMessage[3], thisMessage[4]);
         } else if(thisMessage[0] == 1) {
-          // break connection
-          int outputPatchNum = m[thisMessage[1]]->socketOutputs[thisMessage[2]]->patchCableNum;
-          int inputPatchNum = m[thisMessage[3]]->socketInputs[thisMessage[4]]->patchCableNum;
-          if(outputPatchNum == inputPatchNum && outputPatchNum != -1) {
-            delete vpc[outputPatchNum];
-            vpc[outputPatchNum] = NULL;
-            m[thisMessage[1]]->socketOutputs[thisMessage[2]]->patchCableNum = -1;
-            m[thisMessage[3]]->socketInputs[thisMessage[4]]->patchCableNum = -1;
-          }
+          breakConnection(thisMessage[1], thisMessage[2], thisMessage[3], thisMessage[4]);
         }
       }
     }
   }
+
+  // module bus: start the next connection detection round and change reads once the last one is
+  // done, the transfers themselves run from the I2C interrupt
+  if(ModuleBus.idle()) {
+    ModuleBus.detectCycle();
+    for(byte i=0; i<sizeof(moduleAddresses); i++) {
+      ModuleBus.requestChanges(moduleAddresses[i]);
+    }
+  }
+  ModuleBus.update();
+  if(millis() - lastBusStats >= 5000) {
+    ModuleBus.printStats();
+    ModuleBus.resetStats();
+    lastBusStats = millis();
+  }
+
   byte pinNum = 0;
   for(byte i=0; i<8; i++) {
     if(m[i]!=NULL) {
@@ -0,0 +1,20 @@
+#include "Board.h"
+#include "Constants.h"
+#include "AnalogChannel.h"
+
+bool AnalogChannel::update(int reading, bool force) {
+  // running average of how much the reading jumps between two reads (1/8 weight per read), only
+  // while the knob is at rest: a moving knob would raise the threshold exactly when it should be low
+  int jitter = abs(reading - (int)prevReading);
+  prevReading = reading;
+  if(jitter <= ANALOG_NOISE_BAND) noise += ((jitter << 4) - (int)noise) >> 3;
+
+  uint16_t now = Board.millis();
+  if(!force) {
+    if(abs(reading - (int)value) < threshold()) return false;
+    if((uint16_t)(now - lastSent) < ANALOG_MIN_INTERVAL) return false;
+  }
+  value = reading;
+  lastSent = now;
+  return true;
+}
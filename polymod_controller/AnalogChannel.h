@@ -0,0 +1,23 @@
+#ifndef AnalogChannel_h
+#define AnalogChannel_h
+#include "Board.h"
+#include "Constants.h"
+
+// Change detection state for one analog channel.
+// Readings are kept at full 10-bit resolution. The change threshold adapts to the noise measured
+// on that channel, so a jittery pot stays quiet while a clean one sends every count it moves.
+// Each channel is also rate limited: a change that comes too soon after the previous update is
+// not lost, it is simply sent the next time the channel is read once the interval has passed.
+
+class AnalogChannel {
+  public:
+    bool update(int reading, bool force); // returns true if the new value should be sent
+    int threshold() { return ANALOG_MIN_THRESHOLD + ((ANALOG_NOISE_FACTOR * noise) >> 4); };
+    uint16_t value = 0; // last value sent
+  private:
+    uint16_t prevReading = 0; // last raw reading, for the noise estimate
+    byte noise = 0; // average reading-to-reading difference, 4.4 fixed point
+    uint16_t lastSent = 0; // low 16 bits of millis() when value was last sent
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef Board_h
+#define Board_h
+
+// Thin hardware layer for the controller.
+//
+// Everything that touches the microcontroller (GPIO, SPI shift registers, ADC and the UART link to
+// the main board) goes through Board, so the scan and reporting code (Scanner, AnalogChannel,
+// TxQueue) is the same on every target. Only one implementation is compiled:
+// - BoardAVR.cpp      Arduino Uno (ATmega328P), free-running ADC interrupt, port manipulation
+// - BoardTeensyLC.cpp Teensy LC (KL26), continuous 12-bit ADC with hardware averaging, SPI DMA
+// - BoardLinux.cpp    Linux host, simulated patch matrix and knobs, for benchmarking the scan core
+
+#if defined(ARDUINO)
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+typedef uint8_t byte;
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#endif
+
+class BoardClass {
+  public:
+    void begin();
+
+    // connection matrix addressing
+    void setScanAddress(uint16_t shiftData); // shift registers: sending group/module/socket and receiving group
+    void selectModuleSocket(byte module, byte socket); // receiving module (E) and socket (F) multiplexers
+    bool readConnection(); // true if the sending socket is patched to the receiving socket
+    bool readModuleIdBit(); // bit F of the receiving module's ID, empty slots read 0
+
+    // module output shift registers (LEDs etc), daisy-chained with a common latch
+    void writeModuleOutputs(const byte *data, int length); // shift out and latch, may return before it's done
+    bool moduleOutputsBusy(); // true while a previous write is still being shifted out
+
+    // module input shift registers (buttons, switches), daisy-chained with a common load
+    void readModuleInputs(byte *data, int length); // load and shift in all modules, module 0 first
+
+    // ADC, converting continuously from the analog multiplexer output
+    bool analogReady(); // a new conversion finished since the last analogRead()
+    int analogRead(); // latest 10-bit result, clears analogReady()
+
+    // UART link to the main board
+    int linkAvailableForWrite(); // bytes that can be written without blocking
+    void linkWrite(const byte *data, int length);
+    int linkAvailable(); // bytes received from the main board
+    byte linkRead();
+
+    unsigned long millis();
+    unsigned long micros();
+};
+
+extern BoardClass Board;
+
+#endif
@@ -0,0 +1,178 @@
+#if defined(__AVR__)
+
+#include "Arduino.h"
+#include <SPI.h>
+#include "Board.h"
+
+// Arduino Uno: address lines E on pins 2-4 and F on pins 5-7 (all on PORTD),
+// shift register latches on pins 10 (scan address) and 9 (module outputs), input shift register load on 8,
+// connection sense on A2 (PC2),
+// module ID on A3 (PC3)
+
+#define SCAN_LATCH_PIN 10
+#define OUTPUT_LATCH_PIN 9
+#define INPUT_LOAD_PIN 8
+#define CONNECTION_PIN A2
+#define MODULE_ID_PIN A3 // active low, so an empty slot reads as ID 0
+
+BoardClass Board;
+
+// High when a value is ready to be read
+static volatile bool readFlag;
+
+// Value to store analog result
+static volatile int analogVal;
+
+void BoardClass::begin() {
+  Serial.begin(500000);
+  pinMode(OUTPUT_LATCH_PIN,OUTPUT);
+  pinMode(INPUT_LOAD_PIN,OUTPUT);
+  digitalWrite(INPUT_LOAD_PIN,HIGH);
+  pinMode(SCAN_LATCH_PIN,OUTPUT);
+  pinMode(11,OUTPUT);
+  pinMode(13,OUTPUT);
+  for(int i=2;i<8;i++) {
+    pinMode(i, OUTPUT);
+  }
+  pinMode(CONNECTION_PIN, INPUT_PULLUP);
+  pinMode(MODULE_ID_PIN, INPUT_PULLUP);
+  SPI.begin();
+
+  // code adapted from http://www.glennsweeney.com/tutorials/interrupt-driven-analog-conversion-with-an-atmega328p
+
+  // clear ADLAR in ADMUX (0x7C) to right-adjust the result
+  // ADCL will contain lower 8 bits, ADCH upper 2 (in last two bits)
+  ADMUX &= B11011111;
+
+  // Set REFS1..0 in ADMUX (0x7C) to change reference voltage to the
+  // proper source (01)
+  ADMUX |= B01000000;
+
+  // Clear MUX3..0 in ADMUX (0x7C) in preparation for setting the analog
+  // input
+  ADMUX &= B11110000;
+
+  // Set MUX3..0 in ADMUX (0x7C) to read from AD8 (Internal temp)
+  // list of possible inputs is available in Table 24-4 of the ATMega328
+  // datasheet
+  ADMUX |= 0;
+  // ADMUX |= B00001000; // Binary equivalent
+
+  // Set ADEN in ADCSRA (0x7A) to enable the ADC.
+  // Note, this instruction takes 12 ADC clocks to execute
+  ADCSRA |= B10000000;
+
+  // Set ADATE in ADCSRA (0x7A) to enable auto-triggering.
+  ADCSRA |= B00100000;
+
+  // Clear ADTS2..0 in ADCSRB (0x7B) to set trigger mode to free running.
+  // This means that as soon as an ADC has finished, the next will be
+  // immediately started.
+  ADCSRB &= B11111000;
+
+  // Set the Prescaler to 128 (16000KHz/128 = 125KHz)
+  // Above 200KHz 10-bit results are not reliable.
+  ADCSRA |= B00000111;
+
+  // Set ADIE in ADCSRA (0x7A) to enable the ADC interrupt.
+  // Without this, the internal interrupt will not trigger.
+  ADCSRA |= B00001000;
+
+  // Enable global interrupts
+  // AVR macro included in <avr/interrupts.h>, which the Arduino IDE
+  // supplies by default.
+  sei();
+
+  // Kick off the first ADC
+  readFlag = false;
+  // Set ADSC in ADCSRA (0x7A) to start the ADC conversion
+  ADCSRA |=B01000000;
+}
+
+void BoardClass::setScanAddress(uint16_t shiftData) {
+  digitalWrite(SCAN_LATCH_PIN,LOW);
+  SPI.transfer((shiftData>>8));
+  SPI.transfer(shiftData);
+  digitalWrite(SCAN_LATCH_PIN,HIGH);
+}
+
+void BoardClass::selectModuleSocket(byte module, byte socket) {
+  PORTD = (module<<2) + (socket<<5); // faster "port manipulation" version of digitalWrite on pins 2-7
+}
+
+bool BoardClass::readConnection() {
+  return !bitRead(PINC,2);
+}
+
+bool BoardClass::readModuleIdBit() {
+  return !bitRead(PINC,3);
+}
+
+void BoardClass::writeModuleOutputs(const byte *data, int length) {
+  digitalWrite(OUTPUT_LATCH_PIN,LOW);
+  for(int i=0; i<length; i++) SPI.transfer(data[i]);
+  digitalWrite(OUTPUT_LATCH_PIN,HIGH);
+}
+
+bool BoardClass::moduleOutputsBusy() {
+  return false;
+}
+
+void BoardClass::readModuleInputs(byte *data, int length) {
+  // latch all inputs into the registers, then clock the chain in
+  digitalWrite(INPUT_LOAD_PIN,LOW);
+  digitalWrite(INPUT_LOAD_PIN,HIGH);
+  SPI.transfer(data, length);
+}
+
+bool BoardClass::analogReady() {
+  return readFlag;
+}
+
+int BoardClass::analogRead() {
+  noInterrupts(); // analogVal is two bytes, don't let the ISR update it half way through
+  int value = analogVal;
+  readFlag = false;
+  interrupts();
+  return value;
+}
+
+int BoardClass::linkAvailableForWrite() {
+  return Serial.availableForWrite();
+}
+
+void BoardClass::linkWrite(const byte *data, int length) {
+  Serial.write(data, length);
+}
+
+int BoardClass::linkAvailable() {
+  return Serial.available();
+}
+
+byte BoardClass::linkRead() {
+  return Serial.read();
+}
+
+unsigned long BoardClass::millis() {
+  return ::millis();
+}
+
+unsigned long BoardClass::micros() {
+  return ::micros();
+}
+
+// Interrupt service routine for the ADC completion
+ISR(ADC_vect){
+
+  // Done reading
+  readFlag = true;
+
+  // Must read low first
+  analogVal = ADCL | (ADCH << 8);
+
+  // Not needed because free-running mode is enabled.
+  // Set ADSC in ADCSRA (0x7A) to start another ADC conversion
+  // ADCSRA |= B01000000;
+}
+
+#endif
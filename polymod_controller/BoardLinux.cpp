@@ -0,0 +1,155 @@
+#if !defined(ARDUINO)
+
+#include <time.h>
+#include "Board.h"
+#include "BoardLinux.h"
+
+// Linux host: the patch matrix, knobs, ADC and UART are simulated in real time, so the scan core
+// can be run and timed on a PC. The ADC finishes a conversion every adcConversionTime and the UART
+// drains at baudRate, so backpressure on the link behaves like on the real board.
+
+BoardClass Board;
+SimulatedRig Rig;
+
+static struct timespec startTime;
+
+void SimulatedRig::connect(int socket1, int socket2) {
+  patched[socket1][socket2>>6] |= 1ULL << (socket2&63);
+  patched[socket2][socket1>>6] |= 1ULL << (socket1&63);
+}
+
+void SimulatedRig::disconnect(int socket1, int socket2) {
+  patched[socket1][socket2>>6] &= ~(1ULL << (socket2&63));
+  patched[socket2][socket1>>6] &= ~(1ULL << (socket1&63));
+}
+
+bool SimulatedRig::isConnected(int socket1, int socket2) {
+  return (patched[socket1][socket2>>6] >> (socket2&63)) & 1;
+}
+
+void SimulatedRig::scheduleConnect(unsigned long time, int socket1, int socket2) {
+  scheduled.push_back({time, socket1, socket2});
+}
+
+void SimulatedRig::applyScheduled() {
+  unsigned long now = Board.micros();
+  for(size_t i=0; i<scheduled.size(); ) {
+    if(now >= scheduled[i].time) {
+      connect(scheduled[i].socket1, scheduled[i].socket2);
+      scheduled.erase(scheduled.begin() + i);
+    } else {
+      i++;
+    }
+  }
+}
+
+void SimulatedRig::drainUart() {
+  unsigned long now = Board.micros();
+  uartFill -= (now - lastDrain) * (baudRate / 10) / 1e6; // 10 bits per byte on the line
+  if(uartFill < 0) uartFill = 0;
+  lastDrain = now;
+}
+
+void BoardClass::begin() {
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  Rig.lastConversion = 0;
+  Rig.lastDrain = 0;
+}
+
+void BoardClass::setScanAddress(uint16_t shiftData) {
+  Rig.shiftData = shiftData;
+}
+
+void BoardClass::selectModuleSocket(byte module, byte socket) {
+  Rig.module = module;
+  Rig.socket = socket;
+}
+
+bool BoardClass::readConnection() {
+  int a = Rig.shiftData & 7;
+  int b = (Rig.shiftData >> 3) & 7;
+  int c = (Rig.shiftData >> 6) & 7;
+  int d = (Rig.shiftData >> 9) & 7;
+  Rig.applyScheduled();
+  return Rig.isConnected((a<<6)+(b<<3)+c, (d<<6)+(Rig.module<<3)+Rig.socket);
+}
+
+bool BoardClass::readModuleIdBit() {
+  int d = (Rig.shiftData >> 9) & 7;
+  return bitRead(Rig.getModuleId((d<<3)+Rig.module), Rig.socket);
+}
+
+void BoardClass::writeModuleOutputs(const byte *data, int length) {
+  memcpy(Rig.outputs, data, length);
+  Rig.outputBursts++;
+  Rig.outputBytes += length;
+}
+
+bool BoardClass::moduleOutputsBusy() {
+  return false;
+}
+
+void BoardClass::readModuleInputs(byte *data, int length) {
+  memcpy(data, Rig.inputs, length);
+}
+
+bool BoardClass::analogReady() {
+  return micros() - Rig.lastConversion >= Rig.adcConversionTime;
+}
+
+int BoardClass::analogRead() {
+  int d = (Rig.shiftData >> 9) & 7;
+  int value = Rig.getKnob((d<<6)+(Rig.module<<3)+Rig.socket);
+  if(Rig.analogNoise > 0) value += rand() % (2*Rig.analogNoise + 1) - Rig.analogNoise;
+  if(value < 0) value = 0;
+  if(value > 1023) value = 1023;
+  Rig.lastConversion = micros();
+  return value;
+}
+
+int BoardClass::linkAvailableForWrite() {
+  Rig.drainUart();
+  return Rig.uartBufferSize - (int)(Rig.uartFill + 0.999);
+}
+
+void BoardClass::linkWrite(const byte *data, int length) {
+  while(linkAvailableForWrite() < length) {
+    // a real Serial.write() blocks until there is room in the buffer
+  }
+  Rig.uartFill += length;
+  if(Rig.uartFill > Rig.maxUartFill) Rig.maxUartFill = Rig.uartFill;
+  Rig.bytesWritten += length;
+  if(Rig.linkOutput) {
+    for(int i=0; i<length; i++) {
+      byte b = data[i];
+      if(Rig.linkErrors > 0 && rand() < Rig.linkErrors * RAND_MAX) {
+        b ^= 1 << (rand() % 8);
+        Rig.corruptedBytes++;
+      }
+      fputc(b, Rig.linkOutput);
+    }
+  }
+  if(Rig.linkObserver) Rig.linkObserver(data, length);
+}
+
+int BoardClass::linkAvailable() {
+  return Rig.linkInput.size();
+}
+
+byte BoardClass::linkRead() {
+  byte data = Rig.linkInput.front();
+  Rig.linkInput.pop_front();
+  return data;
+}
+
+unsigned long BoardClass::millis() {
+  return micros() / 1000;
+}
+
+unsigned long BoardClass::micros() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - startTime.tv_sec) * 1000000UL + (now.tv_nsec - startTime.tv_nsec) / 1000;
+}
+
+#endif
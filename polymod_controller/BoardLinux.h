@@ -0,0 +1,72 @@
+#ifndef BoardLinux_h
+#define BoardLinux_h
+#if !defined(ARDUINO)
+
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include "Board.h"
+
+// Simulated hardware behind the Linux Board implementation.
+// Sockets are numbered like on the link: (group<<6)+(module<<3)+socket.
+
+#define RIG_NUM_SOCKETS 512
+
+class SimulatedRig {
+  public:
+    void connect(int socket1, int socket2);
+    void disconnect(int socket1, int socket2);
+    bool isConnected(int socket1, int socket2);
+    void setKnob(int channel, int value) { knobs[channel] = value; };
+    int getKnob(int channel) { return knobs[channel]; };
+    void setModuleId(int module, byte id) { moduleIds[module] = id; };
+    byte getModuleId(int module) { return moduleIds[module]; };
+    void scheduleConnect(unsigned long time, int socket1, int socket2); // patch a cable at a given time (us)
+
+    int analogNoise = 0; // +/- counts of random noise added to every reading
+    unsigned long adcConversionTime = 104; // us, ATmega328P free running at 125 kHz
+    long baudRate = 500000;
+    int uartBufferSize = 63; // bytes, like the AVR HardwareSerial TX buffer
+    FILE *linkOutput = NULL; // if set, everything written to the link is copied there
+    double linkErrors = 0; // chance a byte copied to linkOutput has a bit flipped, like noise on the line
+    void (*linkObserver)(const byte *data, int length) = NULL; // if set, called for everything written to the link
+    std::deque<byte> linkInput; // bytes sent by the main board, waiting to be read
+
+    // module outputs as latched in the shift register chain
+    byte outputs[RIG_NUM_SOCKETS/8] = {};
+    unsigned long outputBursts = 0;
+    unsigned long outputBytes = 0;
+
+    // buttons and switches, as loaded into the input shift register chain
+    byte inputs[RIG_NUM_SOCKETS/8] = {};
+
+    // link statistics
+    unsigned long bytesWritten = 0;
+    unsigned long corruptedBytes = 0;
+    unsigned long maxUartFill = 0;
+
+    // current hardware state, set by Board
+    uint16_t shiftData = 0;
+    byte module = 0;
+    byte socket = 0;
+    unsigned long lastConversion = 0;
+    double uartFill = 0; // bytes waiting in the simulated UART buffer
+    unsigned long lastDrain = 0;
+    void drainUart();
+    void applyScheduled();
+  private:
+    struct Scheduled {
+      unsigned long time;
+      int socket1;
+      int socket2;
+    };
+    std::vector<Scheduled> scheduled;
+    byte moduleIds[RIG_NUM_SOCKETS/8] = {};
+    uint64_t patched[RIG_NUM_SOCKETS][RIG_NUM_SOCKETS/64] = {};
+    int knobs[RIG_NUM_SOCKETS] = {};
+};
+
+extern SimulatedRig Rig;
+
+#endif
+#endif
@@ -0,0 +1,146 @@
+#if defined(__MKL26Z64__)
+
+#include "Arduino.h"
+#include <SPI.h>
+#include <EventResponder.h>
+#include "Board.h"
+
+// Teensy LC: same pin numbers as the Uno for the address lines and latches, so the controller
+// board can take either. The link to the main board is on Serial1 (pins 0/1), Serial is USB.
+//
+// The ADC converts continuously from the analog multiplexer output at 12 bits with 4 samples
+// averaged in hardware, and the result is scaled to the 10 bits carried by the link.
+// There is no point using DMA here: the channel is selected by the external multiplexer between two
+// conversions, so each result has to be picked up individually with the scan position it belongs to.
+// DMA is used for the module output frame instead: the chain is shifted out in the background and
+// latched from the completion event.
+
+#define SCAN_LATCH_PIN 10
+#define OUTPUT_LATCH_PIN 9
+#define INPUT_LOAD_PIN 8
+#define CONNECTION_PIN 16 // A2
+#define MODULE_ID_PIN 17 // A3, active low so an empty slot reads as ID 0
+#define ANALOG_PIN 14 // A0
+#define ANALOG_CHANNEL 5 // A0 is ADC0_SE5b
+
+BoardClass Board;
+
+static volatile bool readFlag;
+static volatile int analogVal;
+static volatile bool outputsBusy = false;
+static EventResponder outputsEvent;
+
+static void outputsDone(EventResponderRef event) {
+  digitalWriteFast(OUTPUT_LATCH_PIN,HIGH);
+  outputsBusy = false;
+}
+
+static void adcIsr() {
+  analogVal = ADC0_RA >> 2; // reading RA also clears the conversion complete flag
+  readFlag = true;
+}
+
+void BoardClass::begin() {
+  Serial1.begin(500000);
+  pinMode(OUTPUT_LATCH_PIN,OUTPUT);
+  pinMode(INPUT_LOAD_PIN,OUTPUT);
+  digitalWriteFast(INPUT_LOAD_PIN,HIGH);
+  pinMode(SCAN_LATCH_PIN,OUTPUT);
+  for(int i=2;i<8;i++) {
+    pinMode(i, OUTPUT);
+  }
+  pinMode(CONNECTION_PIN, INPUT_PULLUP);
+  pinMode(MODULE_ID_PIN, INPUT_PULLUP);
+  SPI.begin();
+  outputsEvent.attachImmediate(outputsDone);
+
+  // let the core set up clocks, calibration and the b-side mux for A0, then switch to
+  // continuous conversion with an interrupt at the end of each one
+  analogReadResolution(12);
+  analogReadAveraging(4);
+  ::analogRead(ANALOG_PIN);
+  readFlag = false;
+  attachInterruptVector(IRQ_ADC0, adcIsr);
+  NVIC_ENABLE_IRQ(IRQ_ADC0);
+  ADC0_SC3 |= ADC_SC3_ADCO;
+  ADC0_SC1A = ADC_SC1_AIEN | ADC_SC1_ADCH(ANALOG_CHANNEL);
+}
+
+void BoardClass::setScanAddress(uint16_t shiftData) {
+  while(outputsBusy); // SPI is shared with the output chain
+  digitalWriteFast(SCAN_LATCH_PIN,LOW);
+  SPI.transfer((shiftData>>8));
+  SPI.transfer(shiftData);
+  digitalWriteFast(SCAN_LATCH_PIN,HIGH);
+}
+
+void BoardClass::selectModuleSocket(byte module, byte socket) {
+  // pins 2-7 are spread over ports A and D on the LC, constant pin numbers make each one a single store
+  digitalWriteFast(2, bitRead(module,0));
+  digitalWriteFast(3, bitRead(module,1));
+  digitalWriteFast(4, bitRead(module,2));
+  digitalWriteFast(5, bitRead(socket,0));
+  digitalWriteFast(6, bitRead(socket,1));
+  digitalWriteFast(7, bitRead(socket,2));
+}
+
+bool BoardClass::readConnection() {
+  return !digitalReadFast(CONNECTION_PIN);
+}
+
+bool BoardClass::readModuleIdBit() {
+  return !digitalReadFast(MODULE_ID_PIN);
+}
+
+void BoardClass::writeModuleOutputs(const byte *data, int length) {
+  outputsBusy = true;
+  digitalWriteFast(OUTPUT_LATCH_PIN,LOW);
+  SPI.transfer(data, NULL, length, outputsEvent); // DMA, outputsDone() latches when finished
+}
+
+bool BoardClass::moduleOutputsBusy() {
+  return outputsBusy;
+}
+
+void BoardClass::readModuleInputs(byte *data, int length) {
+  while(outputsBusy); // SPI is shared with the output chain
+  // latch all inputs into the registers, then clock the chain in
+  digitalWriteFast(INPUT_LOAD_PIN,LOW);
+  digitalWriteFast(INPUT_LOAD_PIN,HIGH);
+  SPI.transfer(data, length);
+}
+
+bool BoardClass::analogReady() {
+  return readFlag;
+}
+
+int BoardClass::analogRead() {
+  readFlag = false;
+  return analogVal;
+}
+
+int BoardClass::linkAvailableForWrite() {
+  return Serial1.availableForWrite();
+}
+
+void BoardClass::linkWrite(const byte *data, int length) {
+  Serial1.write(data, length);
+}
+
+int BoardClass::linkAvailable() {
+  return Serial1.available();
+}
+
+byte BoardClass::linkRead() {
+  return Serial1.read();
+}
+
+unsigned long BoardClass::millis() {
+  return ::millis();
+}
+
+unsigned long BoardClass::micros() {
+  return ::micros();
+}
+
+#endif
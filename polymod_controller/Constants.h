@@ -0,0 +1,17 @@
+// Number of module groups scanned. Each group holds 8 modules of 8 analog channels.
+// The Uno only has RAM for the per-channel analog state of 2 groups, the Teensy LC can take all 8.
+#ifndef NUM_GROUPS
+#define NUM_GROUPS 2
+#endif
+#define NUM_MODULES (NUM_GROUPS*8)
+#define NUM_CHANNELS (NUM_GROUPS*64)
+
+// Analog change detection (readings are 10-bit)
+#define ANALOG_MIN_THRESHOLD 1 // smallest change sent for a perfectly quiet channel
+#define ANALOG_NOISE_FACTOR 2 // threshold grows by this many times the channel noise estimate
+#define ANALOG_NOISE_BAND 6 // a bigger change between two reads is the knob moving, not noise
+#define ANALOG_MIN_INTERVAL 5 // ms, so each channel sends at most 200 updates per second
+
+// Time-sliced scanning
+#define TIME_SLICED_SCAN 1 // 1: one row per loop() picked by activity, 0: full scans in order
+#define HOT_TIME 2000 // ms, a row that changed is rescanned often for this long
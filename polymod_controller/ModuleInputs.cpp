@@ -0,0 +1,22 @@
+#include "Board.h"
+#include "ModuleInputs.h"
+
+ModuleInputs::ModuleInputs() {
+  memset(last, 0, sizeof(last));
+  memset(reported, 0, sizeof(reported));
+}
+
+void ModuleInputs::update(TxQueue &txQueue) {
+  Board.readModuleInputs(raw, sizeof(raw));
+  framesRead++;
+  for(int module=0; module<NUM_MODULES; module++) {
+    byte stable = ~(raw[module] ^ last[module]);
+    byte changed = (raw[module] ^ reported[module]) & stable;
+    last[module] = raw[module];
+    if(changed == 0) continue;
+    reported[module] ^= changed;
+    for(byte bits=changed; bits; bits &= bits-1) edges++;
+    byte inputMessage[] = {6, (byte)(module>>3), (byte)(module&7), reported[module]}; // digital inputs message
+    txQueue.pushMessage(inputMessage, sizeof(inputMessage));
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef ModuleInputs_h
+#define ModuleInputs_h
+#include "Board.h"
+#include "Constants.h"
+#include "TxQueue.h"
+
+// Buttons and switches of all modules, one byte per module.
+// The shift-in registers of all modules are daisy-chained, so a whole frame is read in one SPI burst.
+// Changes are found with XOR against the previous frames: a bit has to read the same on two frames in
+// a row (debounce) and differ from what was last reported to be sent, and only modules with such an
+// edge are sent over the link.
+
+class ModuleInputs {
+  public:
+    ModuleInputs();
+    void update(TxQueue &txQueue); // read a frame and queue a DIGITAL INPUTS message per changed module
+    byte get(int module) { return reported[module]; };
+
+    unsigned long framesRead = 0;
+    unsigned long edges = 0; // bit changes reported
+  private:
+    byte raw[NUM_MODULES]; // frame just read
+    byte last[NUM_MODULES]; // previous frame, for debouncing
+    byte reported[NUM_MODULES]; // state the main board knows about
+};
+
+#endif
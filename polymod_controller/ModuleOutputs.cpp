@@ -0,0 +1,24 @@
+#include "Board.h"
+#include "ModuleOutputs.h"
+
+ModuleOutputs::ModuleOutputs() {
+  memset(frame, 0, sizeof(frame));
+  dirtyCount = NUM_MODULES; // the registers power up in any state, the first flush() clears them
+}
+
+void ModuleOutputs::set(int module, byte data) {
+  if(module >= NUM_MODULES || frame[module] == data) return;
+  frame[module] = data;
+  if(dirtyCount < 255) dirtyCount++;
+}
+
+bool ModuleOutputs::flush() {
+  if(dirtyCount == 0 || Board.moduleOutputsBusy()) return false;
+  // module 0 is at the far end of the chain, so it has to go out first
+  memcpy(sending, frame, sizeof(sending));
+  Board.writeModuleOutputs(sending, sizeof(sending));
+  framesSent++;
+  modulesChanged += dirtyCount;
+  dirtyCount = 0;
+  return true;
+}
@@ -0,0 +1,28 @@
+#ifndef ModuleOutputs_h
+#define ModuleOutputs_h
+#include "Board.h"
+#include "Constants.h"
+
+// Frame buffer for the module output shift registers (LEDs and other digital outputs), one byte
+// per module, written by the main board over the link.
+// The registers of all modules are daisy-chained with a common latch, so flush() sends the whole
+// frame in one SPI burst (by DMA where the board can) and latches it once. The first flush() sends
+// the whole frame to clear the registers from their power-up state; after that nothing at all is
+// sent while no module has changed, so outputs cost nothing on a quiet rack.
+
+class ModuleOutputs {
+  public:
+    ModuleOutputs();
+    void set(int module, byte data);
+    byte get(int module) { return frame[module]; };
+    bool flush(); // send the frame if anything changed, returns true if a frame was sent
+
+    unsigned long framesSent = 0;
+    unsigned long modulesChanged = 0; // module bytes that changed, summed over all frames sent
+  private:
+    byte frame[NUM_MODULES];
+    byte sending[NUM_MODULES]; // copy being shifted out, so set() can't change it half way through a DMA
+    byte dirtyCount = 0;
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include "Board.h"
+#include "Scanner.h"
+
+Scanner::Scanner() : txQueue(analogChannels) {
+  memset(cyclesSinceRead, 0, sizeof(cyclesSinceRead));
+  memset(rowSignature, 0, sizeof(rowSignature));
+  memset(moduleIDReadings, 0, sizeof(moduleIDReadings));
+  memset(activeModules, 0, sizeof(activeModules));
+  for(int i=0; i<HOT_ROWS; i++) hotRows[i].row = -1;
+}
+
+void Scanner::begin() {
+  Board.begin();
+}
+
+void Scanner::scan() {
+  unsigned long lastStart = Board.millis();
+  byte loopMessage = 0;
+  txQueue.pushMessage(&loopMessage, 1); // new loop started
+  for(int socket1=0; socket1<numGroups*64; socket1++) {
+    scanRow(socket1, true, false);
+  }
+  txQueue.sendStats(); // report queue depth and drops once per full scan
+  lastScanTime = Board.millis() - lastStart;
+}
+
+// Slices go round a pattern of 8: even slots for recently changed rows, odd slots for rows of
+// present modules, and the last slot for a row of an empty slot (which also picks up new modules).
+// A slot with nothing to do falls through to the next class.
+
+void Scanner::scanSlice() {
+  byte slot = slices & 7;
+  int row = -1;
+  bool allModules = false;
+
+  if((slot & 1) == 0) {
+    unsigned long now = Board.millis();
+    for(int i=0; i<HOT_ROWS && row<0; i++) {
+      int n = (slices/2 + i) % HOT_ROWS; // take turns between the hot rows
+      if(hotRows[n].row >= 0 && now - hotRows[n].since > HOT_TIME) hotRows[n].row = -1; // cooled down
+      row = hotRows[n].row;
+    }
+  }
+  if(row < 0 && slot != 7) row = pickRow(nextPresentRow, true);
+  if(row < 0) {
+    row = pickRow(nextEmptyRow, false);
+    allModules = true;
+  }
+  if(row < 0) row = pickRow(nextPresentRow, true); // every slot is taken
+
+  scanRow(row, allModules, true);
+  slices++;
+  if((slices % 64) == 0) txQueue.sendStats();
+}
+
+int Scanner::pickRow(int &cursor, bool present) {
+  int numRows = numGroups*64;
+  for(int n=0; n<numRows; n++) {
+    int row = cursor;
+    cursor = (cursor + 1) % numRows;
+    if(isPresent(row>>3) == present) return row;
+  }
+  return -1;
+}
+
+void Scanner::markHot(int row) {
+  int oldest = 0;
+  for(int i=0; i<HOT_ROWS; i++) {
+    if(hotRows[i].row == row || hotRows[i].row < 0) {
+      oldest = i;
+      break;
+    }
+    if(hotRows[i].since < hotRows[oldest].since) oldest = i;
+  }
+  hotRows[oldest].row = row;
+  hotRows[oldest].since = Board.millis();
+}
+
+// Test one sending socket against all receiving sockets, or only those of present modules.
+// Analog channels and module IDs of each receiving module are read on the way.
+// A cable is reported by the row of its lower socket. When testing all receiving sockets from a
+// module that isn't present, cables to lower sockets are looked for too, see below.
+
+void Scanner::scanRow(int socket1, bool allModules, bool reportRow) {
+  unsigned long rowStart = Board.micros();
+  byte a = socket1 >> 6;
+  byte b = (socket1 >> 3) & 7;
+  byte c = socket1 & 7;
+  byte signature = 0;
+
+  // module outputs (LEDs etc) for all modules at once, only if the main board changed any
+  pollLink();
+  outputs.flush();
+  // buttons and switches of all modules, in one read
+  inputs.update(txQueue);
+
+  for(byte d=0;d<numGroups;d++) {
+    // route the connection test voltage to group A, module B, socket C
+    // and the connection readings, ID and analog data from group D
+    Board.setScanAddress((d<<9)+(c<<6)+(b<<3)+a);
+
+    for(byte e=0;e<8;e++) {
+      int module = (d<<3)+e;
+      if(!allModules && !isPresent(module)) continue;
+      byte moduleID = 0;
+
+      for(byte f=0;f<8;f++) {
+        int socket2 = (d<<6)+(e<<3)+f;
+        Board.selectModuleSocket(e, f);
+
+        if(Board.analogReady()) {
+          cyclesSinceRead[socket2] = 0;
+          updateAnalogReading(d,e,f,Board.analogRead());
+        } else {
+          cyclesSinceRead[socket2]++;
+          if(cyclesSinceRead[socket2] > 10) {
+            while(!Board.analogReady()) {
+              // wait
+            }
+            cyclesSinceRead[socket2] = 0;
+            updateAnalogReading(d,e,f,Board.analogRead());
+          }
+        }
+        // use the multiplexer settling time to feed the serial link
+        // (queueing an analog message no longer takes long enough to replace the delay)
+        unsigned long settleStart = Board.micros();
+        txQueue.service();
+        while(Board.micros() - settleStart < 10); // was 6, but was getting errors
+
+        if(Board.readModuleIdBit()) bitSet(moduleID, f);
+
+        if(socket1 < socket2) {
+          if(Board.readConnection()) {
+            byte patchMessage[] = {1, a, b, c, d, e, f}; // patch connection message
+            txQueue.pushMessage(patchMessage, sizeof(patchMessage));
+            signature = (signature * 33) ^ (socket2 >> 8) ^ socket2;
+            bitSet(activeModules[socket1>>6], (socket1>>3)&7);
+            bitSet(activeModules[d], e);
+          }
+        } else if(allModules && socket2 < socket1 && !isPresent(socket1>>3)) {
+          // the row of the lower socket only tests present modules and would never find this cable:
+          // make this module present and rescan that row soon
+          if(Board.readConnection()) {
+            bitSet(activeModules[socket1>>6], (socket1>>3)&7);
+            markHot(socket2);
+          }
+        }
+      }
+
+      if(moduleID != moduleIDReadings[module]) {
+        moduleIDReadings[module] = moduleID;
+        byte idMessage[] = {3, d, e, moduleID}; // ID message, group number, module number, module ID
+        txQueue.pushMessage(idMessage, sizeof(idMessage));
+      }
+    }
+  }
+
+  if(allModules) firstLoop = false;
+  if(signature != rowSignature[socket1]) {
+    rowSignature[socket1] = signature;
+    markHot(socket1);
+  }
+  if(reportRow) {
+    byte rowMessage[] = {5, a, b, c}; // socket scanned message
+    txQueue.pushMessage(rowMessage, sizeof(rowMessage));
+  }
+  lastRowTime = Board.micros() - rowStart;
+}
+
+// Messages from the main board:
+// MODULE OUTPUTS (command 1): group, module, output byte
+
+void Scanner::pollLink() {
+  while(Board.linkAvailable() > 0) {
+    rxMessage[rxLength++] = Board.linkRead();
+    if(rxMessage[0] != 1) {
+      rxLength = 0; // not a command we know, wait for the next one
+    } else if(rxLength == 4) {
+      outputs.set((rxMessage[1]<<3)+rxMessage[2], rxMessage[3]);
+      rxLength = 0;
+    }
+  }
+}
+
+bool Scanner::updateAnalogReading(byte group,byte module,byte pin,int reading) {
+  int channel = (group<<6)+(module<<3)+pin;
+  if(analogChannels[channel].update(reading, firstLoop)) {
+    txQueue.queueAnalog(channel); // sent later by txQueue.service()
+    return true;
+  } else {
+    return false;
+  }
+}
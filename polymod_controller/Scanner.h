@@ -0,0 +1,64 @@
+#ifndef Scanner_h
+#define Scanner_h
+#include "Board.h"
+#include "Constants.h"
+#include "AnalogChannel.h"
+#include "TxQueue.h"
+#include "ModuleOutputs.h"
+#include "ModuleInputs.h"
+
+// Scan core: walks the connection matrix, reads the analog channels and reports changes over the
+// link. It only talks to the hardware through Board, so it runs unchanged on the Uno, the Teensy LC
+// and the Linux host.
+//
+// The matrix is scanned one row at a time: a row is one sending socket tested against every
+// receiving socket, reading the analog channels of each receiving module on the way. There are two
+// ways of going through the rows:
+// - scan() does all rows in order, then the main board compares the whole cable list (END LOOP)
+// - scanSlice() does a single row picked by activity, and the main board updates the cables of
+//   that socket only (SOCKET SCANNED). Rows that changed recently are rescanned most often, then
+//   rows of modules that are present, and empty slots only now and then, so a new cable is heard
+//   long before a full scan would have reached it.
+// Once per row, messages from the main board (module outputs) are picked up, the output frame is
+// flushed and the buttons and switches of all modules are read.
+
+#define HOT_ROWS 8 // number of recently changed rows tracked
+
+class Scanner {
+  public:
+    Scanner();
+    void begin();
+    void scan(); // one full scan of the connection matrix
+    void scanSlice(); // one row, picked by activity
+
+    int numGroups = NUM_GROUPS;
+    unsigned long lastScanTime = 0; // ms, duration of the last full scan
+    unsigned long lastRowTime = 0; // us, duration of the last row
+    unsigned long slices = 0; // rows scanned by scanSlice()
+    AnalogChannel analogChannels[NUM_CHANNELS]; // indexed by (group<<6)+(module<<3)+pin
+    byte moduleIDReadings[NUM_GROUPS*8]; // 0 if no module in the slot
+    TxQueue txQueue;
+    ModuleOutputs outputs;
+    ModuleInputs inputs;
+  private:
+    byte rxMessage[4];
+    byte rxLength = 0;
+    void pollLink();
+    byte cyclesSinceRead[NUM_CHANNELS];
+    byte rowSignature[NUM_CHANNELS]; // hash of the connections found on each row when last scanned
+    byte activeModules[NUM_GROUPS]; // one bit per module that has been seen with a cable
+    struct {
+      int row;
+      unsigned long since; // ms
+    } hotRows[HOT_ROWS];
+    int nextPresentRow = 0;
+    int nextEmptyRow = 0;
+    bool firstLoop = true;
+    void scanRow(int socket1, bool allModules, bool reportRow);
+    bool isPresent(int module) { return moduleIDReadings[module] != 0 || bitRead(activeModules[module>>3], module&7); };
+    int pickRow(int &cursor, bool present);
+    void markHot(int row);
+    bool updateAnalogReading(byte group, byte module, byte pin, int reading);
+};
+
+#endif
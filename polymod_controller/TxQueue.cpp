@@ -0,0 +1,99 @@
+#include "Board.h"
+#include "TxQueue.h"
+
+TxQueue::TxQueue(const AnalogChannel *analogChannels) {
+  this->analogChannels = analogChannels;
+  memset(pending, 0, sizeof(pending));
+}
+
+void TxQueue::pushMessage(const byte *message, byte length) {
+  if(TX_FIFO_SIZE - 1 - fifoDepth() < length) {
+    // no room: this is the only place where the scan waits for the link
+    stats.stalls++;
+    while(TX_FIFO_SIZE - 1 - fifoDepth() < length) service();
+  }
+  for(byte i=0; i<length; i++) {
+    fifo[fifoHead] = message[i];
+    fifoHead = (fifoHead + 1) & (TX_FIFO_SIZE - 1);
+  }
+  if(fifoDepth() > stats.maxFifoDepth) stats.maxFifoDepth = fifoDepth();
+}
+
+void TxQueue::queueAnalog(int channel) {
+  if(bitRead(pending[channel>>3], channel&7)) {
+    // previous value never made it out, it is replaced by the new one
+    stats.analogDropped++;
+    return;
+  }
+  bitSet(pending[channel>>3], channel&7);
+  pendingCount++;
+  if(pendingCount > stats.maxAnalogBacklog) stats.maxAnalogBacklog = pendingCount;
+}
+
+int TxQueue::findPending() {
+  int i = nextPending;
+  for(int n=0; n<NUM_CHANNELS; n++) {
+    if(pending[i>>3] == 0) {
+      // skip the whole byte
+      n += 7 - (i&7);
+      i = (i | 7) + 1;
+    } else {
+      if(bitRead(pending[i>>3], i&7)) return i;
+      i++;
+    }
+    if(i >= NUM_CHANNELS) i = 0;
+  }
+  return -1;
+}
+
+int TxQueue::service() {
+  if(fifoHead == fifoTail && pendingCount == 0) return 0;
+
+  byte block[TX_FIFO_SIZE];
+  int room = Board.linkAvailableForWrite();
+  if(room > (int)sizeof(block)) room = sizeof(block);
+  int length = 0;
+
+  // high priority messages first
+  while(length < room && fifoTail != fifoHead) {
+    block[length++] = fifo[fifoTail];
+    fifoTail = (fifoTail + 1) & (TX_FIFO_SIZE - 1);
+  }
+
+  // then whole analog messages, only once the FIFO is empty so messages are never interleaved
+  while(fifoTail == fifoHead && pendingCount > 0 && room - length >= TX_ANALOG_MESSAGE_LENGTH) {
+    int channel = findPending();
+    if(channel < 0) break;
+    bitClear(pending[channel>>3], channel&7);
+    pendingCount--;
+    nextPending = channel + 1 < NUM_CHANNELS ? channel + 1 : 0;
+    block[length++] = 2; // analog message
+    block[length++] = channel >> 6; // group
+    block[length++] = (channel >> 3) & 7; // module
+    uint16_t reading = analogChannels[channel].value;
+    block[length++] = (channel & 7) | ((reading >> 8) << 3); // pin, plus reading bits 8-9 in bits 3-4
+    block[length++] = reading & 0xFF; // reading bits 0-7
+  }
+
+  if(length > 0) Board.linkWrite(block, length);
+  return length;
+}
+
+void TxQueue::flush() {
+  while(fifoHead != fifoTail || pendingCount > 0) service();
+}
+
+void TxQueue::sendStats() {
+  byte message[5];
+  message[0] = 4; // TX stats message
+  message[1] = stats.maxFifoDepth;
+  message[2] = stats.maxAnalogBacklog < 255 ? stats.maxAnalogBacklog : 255;
+  message[3] = stats.analogDropped < 255 ? stats.analogDropped : 255;
+  message[4] = stats.stalls < 255 ? stats.stalls : 255;
+  lastStats = stats;
+  stats.maxFifoDepth = 0;
+  stats.maxAnalogBacklog = pendingCount;
+  stats.analogDropped = 0;
+  stats.stalls = 0;
+  pushMessage(message, sizeof(message));
+}
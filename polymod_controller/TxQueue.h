@@ -0,0 +1,50 @@
+#ifndef TxQueue_h
+#define TxQueue_h
+#include "Board.h"
+#include "Constants.h"
+#include "AnalogChannel.h"
+
+// Outgoing message queue for the serial link to the Teensy.
+//
+// Messages are never written to the link byte by byte from the scan loop any more. Instead:
+// - patch connection, module ID and loop markers go into a small FIFO (high priority, never dropped)
+// - analog updates only mark their channel as pending (low priority). The value is read from the
+//   analog channel table when the message is actually sent, so if a channel changes again before it had
+//   a chance to go out, the older value is simply superseded (and counted as dropped).
+// service() assembles as many whole messages as the UART buffer can accept and writes them in one
+// block, so it never waits for the line. Only a full FIFO can stall the scan (backpressure).
+
+#define TX_FIFO_SIZE 64   // bytes, must be a power of 2
+#define TX_ANALOG_MESSAGE_LENGTH 5
+
+class TxQueue {
+  public:
+    TxQueue(const AnalogChannel *analogChannels);
+    void pushMessage(const byte *message, byte length); // high priority, waits for room if needed
+    void queueAnalog(int channel); // low priority, coalesced per channel
+    int service(); // send what fits in the UART buffer without blocking, returns bytes written
+    void flush(); // wait until everything has been sent
+    byte fifoDepth() { return (fifoHead - fifoTail) & (TX_FIFO_SIZE - 1); };
+    int analogBacklog() { return pendingCount; };
+    void sendStats(); // queue a TX STATS message and reset the statistics
+
+    struct Stats {
+      byte maxFifoDepth;
+      int maxAnalogBacklog;
+      unsigned int analogDropped; // analog values superseded before they were sent
+      unsigned int stalls; // times the scan had to wait for FIFO room
+    };
+    Stats stats = {}; // since last sendStats()
+    Stats lastStats = {}; // as reported by the last sendStats()
+  private:
+    const AnalogChannel *analogChannels;
+    byte fifo[TX_FIFO_SIZE];
+    byte fifoHead = 0;
+    byte fifoTail = 0;
+    byte pending[NUM_CHANNELS/8];
+    int pendingCount = 0;
+    int nextPending = 0; // round robin position, so no channel gets starved
+    int findPending();
+};
+
+#endif
@@ -0,0 +1,243 @@
+// Host benchmark for the controller scan core, running on the simulated board (BoardLinux.cpp)
+//
+// Build from the polymod_controller folder:
+//   g++ -O2 -DNUM_GROUPS=8 -I. -o bench host/bench.cpp Scanner.cpp TxQueue.cpp AnalogChannel.cpp ModuleOutputs.cpp ModuleInputs.cpp BoardLinux.cpp
+//
+// Usage: bench [-t] [-d seconds] [-m present modules] [-c cables] [-p patch events] [-k knobs moving]
+//              [-l LED changes] [-b button changes] [-n analog noise] [-o link capture file] [-P]
+//              [-e byte error chance] [-u cables to modules without ID]
+//   -t  time-sliced scanning (scanSlice) instead of full scans (scan)
+//   -P  write the link to a new pseudo terminal instead of a file, for a main board build to read
+//       (polymod_main/host/linkbench). The scan starts once the other end is opened
+//   -e  bytes written to the capture file or pty get a random bit flipped with this chance
+//   -u  cables patched during the run between a present module and an empty slot (a module whose ID
+//       reads 0), counted with the -p patch events
+//
+// Cables patched while the scan runs are followed through the link output until the main board
+// would apply them (END LOOP after a full scan, SOCKET SCANNED for a slice), which gives the
+// patch-to-sound latency of the controller side.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <vector>
+#include <algorithm>
+#include "Board.h"
+#include "BoardLinux.h"
+#include "Scanner.h"
+
+struct PatchEvent {
+  int socket1;
+  int socket2;
+  unsigned long time; // us, when the cable is patched
+  bool detected; // patch message seen on the link
+  long latency; // us until the main board applies it, -1 if not yet
+};
+
+static std::vector<PatchEvent> events;
+static byte message[8];
+static int messageLength = 0;
+static const int messageLengths[] = {1, 7, 5, 4, 5, 4, 4}; // by command
+
+static void applyEvents(int row) {
+  unsigned long now = Board.micros();
+  for(size_t i=0; i<events.size(); i++) {
+    if(events[i].detected && events[i].latency < 0 && (row < 0 || events[i].socket1 == row)) {
+      events[i].latency = now - events[i].time;
+    }
+  }
+}
+
+// follows the messages written by the controller, like the parser in polymod_main would
+static void observeLink(const byte *data, int length) {
+  for(int n=0; n<length; n++) {
+    message[messageLength++] = data[n];
+    if(message[0] > 6) {
+      fprintf(stderr, "bad command %d on the link\n", message[0]);
+      messageLength = 0;
+      continue;
+    }
+    if(messageLength < messageLengths[message[0]]) continue;
+    messageLength = 0;
+    switch(message[0]) {
+      case 0: // END LOOP: the main board compares the whole cable list
+        applyEvents(-1);
+        break;
+      case 1: { // PATCH CONNECTION
+        int socket1 = (message[1]<<6)+(message[2]<<3)+message[3];
+        int socket2 = (message[4]<<6)+(message[5]<<3)+message[6];
+        for(size_t i=0; i<events.size(); i++) {
+          if(events[i].socket1 == socket1 && events[i].socket2 == socket2 && Board.micros() >= events[i].time) {
+            events[i].detected = true;
+          }
+        }
+        break;
+      }
+      case 5: // SOCKET SCANNED: the main board updates the cables of that socket
+        applyEvents((message[1]<<6)+(message[2]<<3)+message[3]);
+        break;
+    }
+  }
+}
+
+// new pseudo terminal in raw mode, returns the master side once something has opened the slave side
+static FILE *openPty() {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if(master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) return NULL;
+  const char *name = ptsname(master);
+  int slave = open(name, O_RDWR | O_NOCTTY);
+  struct termios tio;
+  if(slave < 0 || tcgetattr(slave, &tio) < 0) return NULL;
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  close(slave);
+
+  // the master side reads as hung up until the slave side is opened again
+  printf("link on %s, waiting for a reader\n", name);
+  fflush(stdout);
+  struct pollfd pfd = {master, POLLOUT, 0};
+  do {
+    usleep(100000);
+    poll(&pfd, 1, 0);
+  } while(pfd.revents & POLLHUP);
+  return fdopen(master, "wb");
+}
+
+int main(int argc, char **argv) {
+  bool timeSliced = false;
+  int duration = 20;
+  int presentModules = 16;
+  int cables = 20;
+  int patchEvents = 10;
+  int movingKnobs = 4;
+  int ledChanges = 0;
+  int buttonChanges = 0;
+  int unidentifiedEvents = 0;
+  bool pty = false;
+  int opt;
+
+  while((opt = getopt(argc, argv, "td:m:c:p:k:l:b:n:o:Pe:u:")) != -1) {
+    switch(opt) {
+      case 't': timeSliced = true; break;
+      case 'd': duration = atoi(optarg); break;
+      case 'm': presentModules = atoi(optarg); break;
+      case 'c': cables = atoi(optarg); break;
+      case 'p': patchEvents = atoi(optarg); break;
+      case 'k': movingKnobs = atoi(optarg); break;
+      case 'l': ledChanges = atoi(optarg); break;
+      case 'b': buttonChanges = atoi(optarg); break;
+      case 'n': Rig.analogNoise = atoi(optarg); break;
+      case 'o': Rig.linkOutput = fopen(optarg, "wb"); break;
+      case 'P': pty = true; break;
+      case 'e': Rig.linkErrors = atof(optarg); break;
+      case 'u': unidentifiedEvents = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-t] [-d seconds] [-m modules] [-c cables] [-p events] [-k knobs] [-l leds] [-b buttons] [-n noise] [-o file] [-P] [-e chance] [-u events]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  Scanner scanner;
+  int numModules = scanner.numGroups * 8;
+  if(presentModules > numModules) presentModules = numModules;
+  srand(1);
+
+  // modules in random slots, cables and knobs on present modules only
+  std::vector<int> slots;
+  for(int i=0; i<numModules; i++) slots.push_back(i);
+  for(int i=numModules-1; i>0; i--) std::swap(slots[i], slots[rand() % (i+1)]);
+  slots.resize(presentModules);
+  for(int i=0; i<presentModules; i++) Rig.setModuleId(slots[i], 100 + i);
+  auto randomSocket = [&]() { return slots[rand() % presentModules] * 8 + rand() % 8; };
+  for(int i=0; i<cables; i++) {
+    int socket1 = randomSocket();
+    int socket2 = randomSocket();
+    if(socket1 != socket2) Rig.connect(socket1, socket2);
+  }
+  for(int i=0; i<numModules*8; i++) Rig.setKnob(i, rand() % 1024);
+
+  // new cables patched at random times during the first half of the run
+  std::vector<int> emptySlots;
+  for(int i=0; i<numModules; i++) {
+    if(std::find(slots.begin(), slots.end(), i) == slots.end()) emptySlots.push_back(i);
+  }
+  if(emptySlots.empty()) unidentifiedEvents = 0;
+  for(int i=0; i<patchEvents + unidentifiedEvents; i++) {
+    int socket1 = randomSocket();
+    int socket2 = randomSocket();
+    if(i >= patchEvents) socket2 = emptySlots[rand() % emptySlots.size()] * 8 + rand() % 8;
+    if(socket1 == socket2 || Rig.isConnected(socket1, socket2)) continue;
+    if(socket1 > socket2) std::swap(socket1, socket2); // the row of the lower socket finds the cable
+    unsigned long time = 1000000UL + (unsigned long)rand() % (duration * 500000UL);
+    events.push_back({socket1, socket2, time, false, -1});
+    Rig.scheduleConnect(time, socket1, socket2);
+  }
+  Rig.linkObserver = observeLink;
+  if(pty) {
+    Rig.linkOutput = openPty();
+    if(!Rig.linkOutput) {
+      fprintf(stderr, "can't open a pseudo terminal\n");
+      return 1;
+    }
+  }
+
+  scanner.begin();
+  unsigned long scans = 0;
+  unsigned long maxRowTime = 0;
+  unsigned long end = duration * 1000000UL;
+  while(Board.micros() < end) {
+    for(int i=0; i<movingKnobs; i++) {
+      int channel = randomSocket();
+      Rig.setKnob(channel, (Rig.getKnob(channel) + 37) % 1024);
+    }
+    for(int i=0; i<ledChanges; i++) {
+      // MODULE OUTPUTS message from the main board
+      int module = slots[rand() % presentModules];
+      byte ledMessage[] = {1, (byte)(module >> 3), (byte)(module & 7), (byte)rand()};
+      Rig.linkInput.insert(Rig.linkInput.end(), ledMessage, ledMessage + sizeof(ledMessage));
+    }
+    for(int i=0; i<buttonChanges; i++) {
+      Rig.inputs[slots[rand() % presentModules]] ^= 1 << (rand() % 8);
+    }
+    if(timeSliced) {
+      scanner.scanSlice();
+    } else {
+      scanner.scan();
+      scans++;
+      printf("scan %lu: %lu ms, queue %d, backlog %d, dropped %u, stalls %u\n", scans, scanner.lastScanTime,
+        scanner.txQueue.lastStats.maxFifoDepth, scanner.txQueue.lastStats.maxAnalogBacklog,
+        scanner.txQueue.lastStats.analogDropped, scanner.txQueue.lastStats.stalls);
+    }
+    if(scanner.lastRowTime > maxRowTime) maxRowTime = scanner.lastRowTime;
+  }
+  scanner.txQueue.flush();
+
+  printf("%s scanning, %d modules (%d present), %d s\n", timeSliced ? "time-sliced" : "full", numModules,
+    presentModules, duration);
+  if(timeSliced) printf("%lu slices, %.0f per second, ", scanner.slices, scanner.slices / (double)duration);
+  else printf("%lu full scans, ", scans);
+  printf("worst row %lu us\n", maxRowTime);
+
+  std::vector<long> latencies;
+  for(size_t i=0; i<events.size(); i++) {
+    if(events[i].latency >= 0) latencies.push_back(events[i].latency);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  if(latencies.size() > 0) {
+    printf("patch latency over %zu cables: typical %.1f ms, worst %.1f ms", latencies.size(),
+      latencies[latencies.size()/2] / 1000.0, latencies.back() / 1000.0);
+  }
+  printf(" (%zu not applied before the end of the run)\n", events.size() - latencies.size());
+  printf("module outputs: %lu frames (%lu module changes), %lu bytes shifted out\n", scanner.outputs.framesSent,
+    scanner.outputs.modulesChanged, Rig.outputBytes);
+  printf("module inputs: %lu frames read, %lu edges sent\n", scanner.inputs.framesRead, scanner.inputs.edges);
+  printf("link: %lu bytes, %.1f%% of %ld baud", Rig.bytesWritten,
+    100.0 * Rig.bytesWritten * 10 / (Rig.baudRate * (Board.micros() / 1e6)), Rig.baudRate);
+  if(Rig.corruptedBytes) printf(", %lu corrupted", Rig.corruptedBytes);
+  printf("\n");
+  if(Rig.linkOutput) fclose(Rig.linkOutput);
+  return 0;
+}
@@ -8,15 +8,15 @@ AudioStreamSet::AudioStreamSet() {
 void AudioStreamSet::addInput(AudioStreamSet *setToAdd) {
 	inputs[numInputs] = setToAdd;
 	numInputs ++;
-	Serial.print("Set ");
-	Serial.print(ref);
-	Serial.print(initRand);
-	Serial.print(" now has ");
-	Serial.print(numInputs);
-	Serial.println(" inputs");
-	Serial.print("INPUTS: ");
+	DEBUG_PRINT("Set ");
+	DEBUG_PRINT(ref);
+	DEBUG_PRINT(initRand);
+	DEBUG_PRINT(" now has ");
+	DEBUG_PRINT(numInputs);
+	DEBUG_PRINTLN(" inputs");
+	DEBUG_PRINT("INPUTS: ");
 	for(int i=0;i<numInputs;i++) {
-		Serial.println(inputs[i]->ref);
+		DEBUG_PRINTLN(inputs[i]->ref);
 	}
 }
 
@@ -2,3 +2,25 @@
 #define MAX_POLYPHONY 2
 #define MAX_CABLES 200
 #define TEENSY_AUDIO_MEMORY 50
+
+// link capture (LinkCapture.h): record everything arriving on Serial1 with timestamps, or replay a
+// capture from the SD card instead of reading Serial1, to compare firmware versions on the same input
+#define LINK_RECORD_OFF 0
+#define LINK_RECORD_SD 1 // to LINK_CAPTURE_FILE on the SD card
+#define LINK_RECORD_USB 2 // to USB serial, which turns the debug prints off
+#define LINK_RECORD LINK_RECORD_OFF
+//#define LINK_REPLAY // replay LINK_CAPTURE_FILE from the SD card, Serial1 is not read
+#define LINK_REPLAY_REALTIME true // at the recorded timing, false for as fast as possible
+#define LINK_CAPTURE_FILE "LINK.CAP"
+// added to the 64 bytes of the Serial1 core: about 80 ms of the link at 500000 baud, for loop()
+// passes held up by an SD card write or the cable comparison
+#define LINK_RX_BUFFER 4096
+
+// debug text on USB serial, none while the link capture goes out there
+#if LINK_RECORD == LINK_RECORD_USB
+#define DEBUG_PRINT(...) ((void)0)
+#define DEBUG_PRINTLN(...) ((void)0)
+#else
+#define DEBUG_PRINT(...) Serial.print(__VA_ARGS__)
+#define DEBUG_PRINTLN(...) Serial.println(__VA_ARGS__)
+#endif
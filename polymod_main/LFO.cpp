@@ -2,7 +2,7 @@
 #include "LFO.h"
 
 LFO::LFO() {
-	Serial.println("New virtual LFO module created");
+	DEBUG_PRINTLN("New virtual LFO module created");
 	sockets[0] = new VirtualSocket();
 	sockets[0]->audioStreamSet.ref = 'L';
 	_oscSineSet.ref = 'Q';
@@ -0,0 +1,100 @@
+#include "LinkCapture.h"
+
+static const byte header[5] = {'P', 'M', 'L', 'C', LINK_CAPTURE_VERSION};
+
+void LinkCaptureWriter::begin(unsigned long time) {
+  _length = 0;
+  _lastTime = time;
+  for(int i=0; i<5; i++) put(header[i]);
+}
+
+void LinkCaptureWriter::record(unsigned long time, const byte *data, int length) {
+  while(length > 0) {
+    int chunk = length < LINK_CAPTURE_MAX_CHUNK ? length : LINK_CAPTURE_MAX_CHUNK;
+    putTime(time);
+    put(chunk);
+    for(int i=0; i<chunk; i++) put(data[i]);
+    bytes += chunk;
+    data += chunk;
+    length -= chunk;
+  }
+}
+
+void LinkCaptureWriter::overrun(unsigned long time) {
+  putTime(time);
+  put(0);
+  overruns++;
+}
+
+void LinkCaptureWriter::flush() {
+  if(_length == 0) return;
+  if(onWrite) onWrite(_buffer, _length);
+  written += _length;
+  _length = 0;
+}
+
+void LinkCaptureWriter::putTime(unsigned long time) {
+  unsigned long delta = time - _lastTime; // unsigned, so micros() wrapping around is fine
+  _lastTime = time;
+  while(delta >= 0x80) {
+    put((delta & 0x7F) | 0x80);
+    delta >>= 7;
+  }
+  put(delta);
+}
+
+void LinkCaptureWriter::put(byte data) {
+  _buffer[_length++] = data;
+  if(_length == LINK_CAPTURE_BUFFER) flush();
+}
+
+bool LinkCaptureReader::begin() {
+  time = 0;
+  chunks = 0;
+  overruns = 0;
+  bad = false;
+  for(int i=0; i<5; i++) {
+    int c = onRead();
+    if(i < 4 ? c != header[i] : c < 1 || c > LINK_CAPTURE_VERSION) {
+      bad = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LinkCaptureReader::next() {
+  if(bad) return false;
+  do {
+    unsigned long delta = 0;
+    int shift = 0;
+    int c;
+    do {
+      c = onRead();
+      if(c < 0) {
+        bad = shift > 0; // the end of the capture is fine between chunks
+        return false;
+      }
+      delta |= (unsigned long)(c & 0x7F) << shift;
+      shift += 7;
+    } while((c & 0x80) && shift < 35);
+    time += delta;
+
+    length = onRead();
+    if(length < 0) {
+      bad = true;
+      return false;
+    }
+    if(length == 0) overruns++;
+  } while(length == 0);
+  for(int i=0; i<length; i++) {
+    int c = onRead();
+    if(c < 0) {
+      bad = true;
+      return false;
+    }
+    data[i] = c;
+  }
+  chunks++;
+  return true;
+}
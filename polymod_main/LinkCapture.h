@@ -0,0 +1,71 @@
+#ifndef LinkCapture_h
+#define LinkCapture_h
+
+// Capture of the link from the controller (Serial1) with timestamps, and replay of a capture.
+//
+// A capture is the bytes as they arrived, in chunks (one Serial1 read), each with the time since
+// the previous chunk, so a session can be fed to LinkParser again byte for byte, either at the
+// recorded timing or as fast as possible, on the Teensy (from the SD card) or on a Linux host
+// (host/linkbench.cpp).
+//
+// Format: "PMLC" and a version byte, then chunks of
+//   time since the previous chunk in us, variable length (7 bits per byte, low bits first, bit 7
+//   set when more bytes follow), mostly 1-2 bytes
+//   number of link bytes (1-255), or 0 for an overrun: the receive buffer was full when this was
+//   read, so link bytes before the next chunk may be missing (no link bytes follow)
+//   the link bytes
+// The first chunk's time is since the capture started. Version 1 captures have no overruns.
+
+#if defined(ARDUINO)
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+typedef uint8_t byte;
+#endif
+
+#define LINK_CAPTURE_VERSION 2
+#define LINK_CAPTURE_MAX_CHUNK 255
+#define LINK_CAPTURE_BUFFER 512 // bytes collected before onWrite, one SD card block
+
+class LinkCaptureWriter {
+  public:
+    void begin(unsigned long time); // writes the header, time in us (micros())
+    void record(unsigned long time, const byte *data, int length); // split into chunks if needed
+    void overrun(unsigned long time); // link bytes may have been lost before the next record()
+    void flush(); // hands what is buffered to onWrite
+
+    // called with a full buffer or from flush(), writes it to the SD card file or USB serial
+    void (*onWrite)(const byte *data, int length) = NULL;
+
+    unsigned long bytes = 0; // link bytes recorded
+    unsigned long written = 0; // capture bytes handed to onWrite
+    unsigned long overruns = 0;
+
+  private:
+    void put(byte data);
+    void putTime(unsigned long time);
+
+    byte _buffer[LINK_CAPTURE_BUFFER];
+    int _length = 0;
+    unsigned long _lastTime = 0;
+};
+
+class LinkCaptureReader {
+  public:
+    bool begin(); // reads and checks the header
+    bool next(); // reads the next chunk into time/data/length, false at the end or on a bad capture
+                 // overruns are counted and skipped
+
+    // returns the next byte of the capture (SD card file, host file), -1 at the end
+    int (*onRead)() = NULL;
+
+    unsigned long time = 0; // us since the capture started
+    byte data[LINK_CAPTURE_MAX_CHUNK];
+    int length = 0;
+    unsigned long chunks = 0;
+    unsigned long overruns = 0;
+    bool bad = false; // capture ended in the middle of a chunk, or not a capture
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "LinkParser.h"
+
+// message length by command, command byte included
+static const byte messageLengths[LINK_NUM_COMMANDS] = {1, 7, 5, 4, 5, 4, 4};
+
+void LinkParser::parse(byte data) {
+  if(_position == 0 && data >= LINK_NUM_COMMANDS) {
+    // not a command, lost in the middle of a message
+    errors++;
+    return;
+  }
+  _message[_position++] = data;
+  if(_position < messageLengths[_message[0]]) return;
+  _position = 0;
+  handleMessage();
+}
+
+// group, module and socket fields of a socket number, 3 bits each
+bool LinkParser::validSocket(const byte *fields) {
+  return fields[0] < 8 && fields[1] < 8 && fields[2] < 8;
+}
+
+void LinkParser::handleMessage() {
+  const byte *m = _message;
+  switch(m[0]) {
+    case LINK_END_LOOP:
+    updateCables(-1);
+    break;
+
+    case LINK_PATCH_CONNECTION:
+    if(!validSocket(m + 1) || !validSocket(m + 4)) {
+      errors++;
+      return;
+    }
+    addNewCable((m[1]<<6)+(m[2]<<3)+m[3], (m[4]<<6)+(m[5]<<3)+m[6]);
+    break;
+
+    case LINK_ANALOG: {
+      // analog reading, 10-bit: bits 8-9 of the reading travel in bits 3-4 of the pin byte
+      if(m[1] >= 8 || m[2] >= 8 || m[3] >= 32) {
+        errors++;
+        return;
+      }
+      int value = ((m[3] >> 3) << 8) + m[4];
+      if(onAnalog) onAnalog((m[1]<<3)+m[2], m[3] & 7, value);
+      break;
+    }
+
+    case LINK_MODULE_ID:
+    if(m[1] >= 8 || m[2] >= 8) {
+      errors++;
+      return;
+    }
+    moduleIds[(m[1]<<3)+m[2]] = m[3];
+    if(onModuleId) onModuleId((m[1]<<3)+m[2], m[3]);
+    break;
+
+    case LINK_TX_STATS:
+    // sent once per full scan (every 64 slices when time-sliced)
+    stats.maxQueueDepth = m[1];
+    stats.maxAnalogBacklog = m[2];
+    stats.analogDropped = m[3];
+    stats.stalls = m[4];
+    break;
+
+    case LINK_SOCKET_SCANNED:
+    // time-sliced scanning: all cables of this sending socket have been sent
+    if(!validSocket(m + 1)) {
+      errors++;
+      return;
+    }
+    updateCables((m[1]<<6)+(m[2]<<3)+m[3]);
+    break;
+
+    case LINK_MODULE_INPUTS: {
+      // digital inputs (buttons, switches) of a module that changed, XOR with the previous state gives the edges
+      if(m[1] >= 8 || m[2] >= 8) {
+        errors++;
+        return;
+      }
+      int module = (m[1]<<3)+m[2];
+      byte edges = moduleInputs[module] ^ m[3];
+      moduleInputs[module] = m[3];
+      for(int i=0; i<8; i++) {
+        if(((edges >> i) & 1) && onInput) onInput(module, i, (m[3] >> i) & 1);
+      }
+      break;
+    }
+  }
+  messages++;
+}
+
+void LinkParser::addNewCable(int socket1, int socket2) {
+  if(_newCount >= MAX_CABLES) {
+    errors++; // more cables than the list holds, or END LOOP lost
+    return;
+  }
+  _newCables[_newCount].inUse = true;
+  _newCables[_newCount].socket1 = socket1;
+  _newCables[_newCount].socket2 = socket2;
+  _newCount++;
+}
+
+// scannedSocket is the sending socket whose row was just scanned (SOCKET SCANNED message), only
+// its cables are compared; -1 after a full scan (END LOOP message) compares all cables
+void LinkParser::updateCables(int scannedSocket) {
+  for(int i=0; i<MAX_CABLES; i++) {
+    if(!cables[i].inUse) continue;
+    if(scannedSocket>=0 && cables[i].socket1!=scannedSocket) continue;
+    bool cableFound = false;
+    for(int j=0; j<_newCount && !cableFound; j++) {
+      if(_newCables[j].inUse && cables[i].socket1==_newCables[j].socket1 && cables[i].socket2==_newCables[j].socket2) {
+        _newCables[j].inUse = false;
+        cableFound = true;
+      }
+    }
+    if(!cableFound) {
+      // patch cable removed
+      if(onCableRemoved) onCableRemoved(i);
+      cables[i].inUse = false;
+    }
+  }
+  for(int i=0; i<_newCount; i++) {
+    if(!_newCables[i].inUse) continue;
+    // patch cable added, find space in list
+    for(int j=0; j<MAX_CABLES; j++) {
+      if(!cables[j].inUse) {
+        cables[j] = _newCables[i];
+        if(onCableAdded) onCableAdded(j);
+        break;
+      }
+    }
+  }
+  _newCount = 0;
+  if(onScanned) onScanned(scannedSocket);
+}
@@ -0,0 +1,82 @@
+#ifndef LinkParser_h
+#define LinkParser_h
+
+// Parser for the link from the controller (Serial1), and the list of patch cables it builds.
+//
+// Bytes are fed one at a time with parse(), whatever their source (Serial1, a capture being
+// replayed, the host benchmark). Finished messages go to the handlers. PATCH CONNECTION messages
+// are collected until the scan is complete (END LOOP, or SOCKET SCANNED for one sending socket when
+// time-sliced), then compared with the cable list, and the cables added or removed are handed to
+// onCableAdded / onCableRemoved.
+// Nothing here touches the audio library, so it also builds on a Linux host: see host/linkbench.cpp.
+//
+// Messages with an unknown command or a field out of range (corrupted on the line) are dropped and
+// counted in errors, and the parser starts again with the next byte.
+
+#if defined(ARDUINO)
+#include "Arduino.h"
+#else
+#include <stdint.h>
+#include <stddef.h>
+typedef uint8_t byte;
+#endif
+#include "Constants.h"
+
+#define LINK_NUM_SOCKETS 512 // (group<<6)+(module<<3)+socket
+
+// link commands from the controller, and the length of their messages
+#define LINK_END_LOOP 0
+#define LINK_PATCH_CONNECTION 1
+#define LINK_ANALOG 2
+#define LINK_MODULE_ID 3
+#define LINK_TX_STATS 4
+#define LINK_SOCKET_SCANNED 5
+#define LINK_MODULE_INPUTS 6
+#define LINK_NUM_COMMANDS 7
+
+struct LinkCable {
+  bool inUse;
+  int socket1;
+  int socket2;
+};
+
+// controller TX queue statistics, from the last TX STATS message
+struct LinkStats {
+  byte maxQueueDepth; // bytes waiting in the high priority (patch/ID) queue
+  byte maxAnalogBacklog; // analog channels waiting to be sent
+  byte analogDropped; // analog values superseded before being sent
+  byte stalls; // times the scan waited for the serial link
+};
+
+class LinkParser {
+  public:
+    void parse(byte data);
+
+    // handlers, called from parse()
+    void (*onCableAdded)(int index) = NULL; // cables[index] was just added
+    void (*onCableRemoved)(int index) = NULL; // cables[index] is about to be freed
+    void (*onAnalog)(int module, int pin, int value) = NULL;
+    void (*onModuleId)(int module, byte id) = NULL;
+    void (*onInput)(int module, int input, bool pressed) = NULL; // button or switch edge
+    void (*onScanned)(int scannedSocket) = NULL; // after the cables were compared, -1 after a full scan
+
+    LinkCable cables[MAX_CABLES] = {}; // physically connected patch cables
+    byte moduleIds[MAX_MODULES] = {};
+    byte moduleInputs[MAX_MODULES] = {}; // buttons and switches, one bit per input
+    LinkStats stats = {};
+    unsigned long messages = 0;
+    unsigned long errors = 0;
+
+  private:
+    void handleMessage();
+    void addNewCable(int socket1, int socket2);
+    void updateCables(int scannedSocket);
+    static bool validSocket(const byte *fields);
+
+    LinkCable _newCables[MAX_CABLES]; // cables reported since the last comparison
+    int _newCount = 0;
+    byte _message[8];
+    byte _position = 0;
+};
+
+#endif
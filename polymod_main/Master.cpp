@@ -2,7 +2,7 @@
 #include "Master.h"
 
 Master::Master() {
-	Serial.println("New master module created");
+	DEBUG_PRINTLN("New master module created");
 	sockets[0] = new VirtualSocket(INPUT);
 	sockets[0]->audioStreamSet.ref = 'A';
 	for(int i=0; i<MAX_POLYPHONY; i++) {
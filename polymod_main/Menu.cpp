@@ -1,5 +1,6 @@
 #include "Arduino.h"
 #include "Menu.h"
+#include "Constants.h" // DEBUG_PRINT
 
 Menu::Menu() {
   msHome.addItem("Load patch");
@@ -68,8 +69,8 @@ void Menu::cancel() {
 }
 
 void Menu::displayText() {
-  Serial.println(currentSet->getTitle());
-  Serial.println(currentSet->getNumItems() > 0 ? currentSet->getItem(currentSet->listIndex) : "Yes / No");
-  Serial.println("");
+  DEBUG_PRINTLN(currentSet->getTitle());
+  DEBUG_PRINTLN(currentSet->getNumItems() > 0 ? currentSet->getItem(currentSet->listIndex) : "Yes / No");
+  DEBUG_PRINTLN("");
 }
 
@@ -6,7 +6,7 @@
 #include "Master.h"
 
 PhysicalModule::PhysicalModule(int initID) {
-  Serial.println("Added physical module");
+  DEBUG_PRINTLN("Added physical module");
   id = initID;
   switch(id) {
     case 88:
@@ -25,6 +25,6 @@ PhysicalModule::PhysicalModule(int initID) {
 }
 
 PhysicalModule::~PhysicalModule() {
-  Serial.println("Removed physical module");
+  DEBUG_PRINTLN("Removed physical module");
   delete virtualModule;
 }
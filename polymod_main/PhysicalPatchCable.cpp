@@ -8,17 +8,17 @@ PhysicalPatchCable::PhysicalPatchCable() {
 PhysicalPatchCable::PhysicalPatchCable(int initSocketA, int initSocketB) {
 	physicalSocketA = initSocketA;
 	physicalSocketB = initSocketB;
-	Serial.print("Added physical patch cable: ");
-	Serial.print(physicalSocketA);
-	Serial.print("<--->");
-	Serial.println(physicalSocketB);
+	DEBUG_PRINT("Added physical patch cable: ");
+	DEBUG_PRINT(physicalSocketA);
+	DEBUG_PRINT("<--->");
+	DEBUG_PRINTLN(physicalSocketB);
 }
 
 PhysicalPatchCable::~PhysicalPatchCable() {
-	Serial.print("Removed physical patch cable: ");
-	Serial.print(physicalSocketA);
-	Serial.print("<--->");
-	Serial.println(physicalSocketB);
+	DEBUG_PRINT("Removed physical patch cable: ");
+	DEBUG_PRINT(physicalSocketA);
+	DEBUG_PRINT("<--->");
+	DEBUG_PRINTLN(physicalSocketB);
 	delete virtualPatchCable;
 }
 
@@ -41,7 +41,7 @@ void PhysicalPatchCable::update(VirtualSocket *updateVirtualSocketA, VirtualSock
 	} else {
 		// cable is linking two sockets of the same type (input to input or output to output)
 		isValid = false;
-		Serial.println("Bad connection");
+		DEBUG_PRINTLN("Bad connection");
 	}
 >>>>>>> 47bf06dffeea8e06460e3808825af276b3af3bc4
 }
@@ -2,7 +2,7 @@
 #include "VCF.h"
 
 VCF::VCF() {
-	Serial.println("New virtual VCF module created");
+	DEBUG_PRINTLN("New virtual VCF module created");
 	sockets[0] = new VirtualSocket(INPUT); // signal in
 	sockets[1] = new VirtualSocket(INPUT); // freq mod in
 	sockets[2] = new VirtualSocket(OUTPUT); // lowpass out
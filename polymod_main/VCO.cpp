@@ -2,7 +2,7 @@
 #include "VCO.h"
 
 VCO::VCO() {
-	Serial.println("New virtual VCO module created");
+	DEBUG_PRINTLN("New virtual VCO module created");
 	sockets[0] = new VirtualSocket(OUTPUT); // saw
 	sockets[1] = new VirtualSocket(OUTPUT); // square
 	sockets[2] = new VirtualSocket(OUTPUT); // triangle
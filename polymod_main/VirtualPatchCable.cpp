@@ -8,34 +8,34 @@ VirtualPatchCable::VirtualPatchCable() {
 
 void VirtualPatchCable::initialise(VirtualSocket& socket1, VirtualSocket& socket2) {
   if(socket1.isSet) {
-    Serial.println("SOCKET 1 IS SET");
+    DEBUG_PRINTLN("SOCKET 1 IS SET");
   } else {
-    Serial.println("SOCKET 1 NOT SET");
+    DEBUG_PRINTLN("SOCKET 1 NOT SET");
   }
   if(socket1.isSet) {
-    Serial.println("SOCKET 2 IS SET");
+    DEBUG_PRINTLN("SOCKET 2 IS SET");
   } else {
-    Serial.println("SOCKET 2 NOT SET");
+    DEBUG_PRINTLN("SOCKET 2 NOT SET");
   }
   if(socket1.isSet && socket2.isSet) {
-    Serial.println("BOTH SOCKETS SET!");
+    DEBUG_PRINTLN("BOTH SOCKETS SET!");
   }
 }
 
 =======
 VirtualPatchCable::VirtualPatchCable(AudioStreamSet sourceSet, int sourceSocketNum, AudioStreamSet destSet, int destSocketNum) {
-	Serial.println("Added virtual patch cable");
+	DEBUG_PRINTLN("Added virtual patch cable");
 	destSet.addInput(&sourceSet);
-	Serial.print(sourceSet.ref);
-	Serial.print(" to ");
-	Serial.println(destSet.ref);
+	DEBUG_PRINT(sourceSet.ref);
+	DEBUG_PRINT(" to ");
+	DEBUG_PRINTLN(destSet.ref);
 	for(int i=0; i<MAX_POLYPHONY; i++) {
 		audioConnections[i] = new AudioConnection(*sourceSet.audioStreams[i], sourceSocketNum, *destSet.audioStreams[i], destSocketNum);
 	}
 }
 
 VirtualPatchCable::~VirtualPatchCable() {
-	Serial.println("Removed virtual patch cable");
+	DEBUG_PRINTLN("Removed virtual patch cable");
 	// important to handle disconnections/deletions here to prevent memory leaks
 	for(int i=0; i<MAX_POLYPHONY; i++) {
 		audioConnections[i]->disconnect();
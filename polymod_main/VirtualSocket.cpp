@@ -1,5 +1,6 @@
 #include "Arduino.h"
 #include "VirtualSocket.h"
+#include "Constants.h" // DEBUG_PRINT
 
 <<<<<<< HEAD
 #define OUTPUT_SOCKET 0
@@ -10,7 +11,7 @@ VirtualSocket::VirtualSocket() {
 }
 
 void VirtualSocket::setOutput(AudioStream &stream, int connectionIndex) {
-  Serial.println("SET OUTPUT");
+  DEBUG_PRINTLN("SET OUTPUT");
   isSet = true;
   _socketType = OUTPUT_SOCKET;
   _stream = &stream;
@@ -18,7 +19,7 @@ void VirtualSocket::setOutput(AudioStream &stream, int connectionIndex) {
 }
 
 void VirtualSocket::setInput(AudioStream& stream, int connectionIndex) {
-  Serial.println("SET INPUT");
+  DEBUG_PRINTLN("SET INPUT");
   isSet = true;
   _socketType = INPUT_SOCKET;
   _stream = &stream;
@@ -39,7 +40,7 @@ int VirtualSocket::getConnectionIndex() {
 
 =======
 VirtualSocket::VirtualSocket(int initType) {
-	Serial.println("New virtual socket created");
+	DEBUG_PRINTLN("New virtual socket created");
 	type = initType;
 	for(int i=0; i<MAX_POLYPHONY; i++) {
 		audioStreamSet.audioStreams[i] = &_amplifiers[i];
@@ -0,0 +1,271 @@
+// Host benchmark for the main board side of the controller link: the LinkParser of polymod_main
+// (message parsing and patch cable diffing) fed from a file (raw link bytes or a capture), stdin,
+// or a serial device or pseudo terminal in real time, e.g. the controller benchmark writing its
+// link to a pty:
+//   polymod_controller/host/bench -P -m 64 -c 100 -k 20 -e 0.0001    (prints the pty name)
+//   linkbench -d /dev/pts/N
+//
+// Build from the polymod_main folder:
+//   g++ -O2 -I. -o linkbench host/linkbench.cpp LinkParser.cpp LinkCapture.cpp
+//
+// Usage: linkbench [-d serial device] [-b baud] [-r] [-T] [-w capture file] [-v] [file]
+//   -r  the file is a link capture (LinkCapture.h, recorded by polymod_main or with -w) rather
+//       than raw link bytes
+//   -T  replay the capture at its recorded timing instead of as fast as possible
+//   -w  record what is read to a link capture, with the time each read returned
+//
+//   Reports the events handed to the sketch (cables added and removed, analog readings, module IDs,
+//   button edges) per second, the parser time per scan (END LOOP) and per slice (SOCKET SCANNED),
+//   and the largest stall: the longest a single byte kept the parser busy, which is the time loop()
+//   can't do anything else (the cable comparison after a scan). A file is read as fast as possible,
+//   so its events per second are what the parser could take, not what the controller sent; a capture
+//   replayed from the same file gives the same bytes in the same chunks every run, so the parser
+//   times can be compared between versions of LinkParser.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <algorithm>
+#include "LinkParser.h"
+#include "LinkCapture.h"
+
+static LinkParser parser;
+static LinkCaptureWriter recorder;
+static LinkCaptureReader replay;
+static FILE *captureIn, *captureOut;
+static volatile bool stopping = false;
+static bool verbose = false;
+
+struct stats_t {
+  unsigned long bytes = 0;
+  unsigned long added = 0, removed = 0, analog = 0, moduleIds = 0, inputs = 0;
+  unsigned long scans = 0, slices = 0;
+  double scanSum = 0, scanMax = 0; // us of parser time from one END LOOP to the next
+  double sliceSum = 0, sliceMax = 0;
+  double parseTime = 0; // us in parse() in total
+  double maxStall = 0;
+  bool maxStallCompared = false; // the largest stall was a cable comparison
+};
+
+static stats_t stats;
+static double sinceScan; // parser time since the last END LOOP or SOCKET SCANNED
+
+static double nowMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void onSignal(int) {
+  stopping = true;
+}
+
+static void cableAdded(int i) {
+  stats.added++;
+  if(verbose) printf("ADDED %d->%d\n", parser.cables[i].socket1, parser.cables[i].socket2);
+}
+
+static void cableRemoved(int i) {
+  stats.removed++;
+  if(verbose) printf("REMOVED %d->%d\n", parser.cables[i].socket1, parser.cables[i].socket2);
+}
+
+static void analogReading(int, int, int) {
+  stats.analog++;
+}
+
+static void moduleId(int, byte) {
+  stats.moduleIds++;
+}
+
+static void moduleInput(int module, int input, bool pressed) {
+  stats.inputs++;
+  if(verbose) printf("%s %d-%d\n", pressed ? "PRESSED" : "RELEASED", module, input);
+}
+
+// the parse time of the byte that finishes the scan is added in feed()
+static void scanned(int scannedSocket) {
+  if(scannedSocket < 0) stats.scans++;
+  else stats.slices++;
+}
+
+static void feed(const byte *data, int length) {
+  for(int i=0; i<length; i++) {
+    unsigned long scans = stats.scans, slices = stats.slices;
+    double start = nowMicros();
+    parser.parse(data[i]);
+    double time = nowMicros() - start;
+
+    stats.bytes++;
+    stats.parseTime += time;
+    sinceScan += time;
+    bool compared = stats.scans != scans || stats.slices != slices;
+    if(time > stats.maxStall) {
+      stats.maxStall = time;
+      stats.maxStallCompared = compared;
+    }
+    if(stats.scans != scans) {
+      stats.scanSum += sinceScan;
+      stats.scanMax = std::max(stats.scanMax, sinceScan);
+      sinceScan = 0;
+    } else if(stats.slices != slices) {
+      stats.sliceSum += sinceScan;
+      stats.sliceMax = std::max(stats.sliceMax, sinceScan);
+      sinceScan = 0;
+    }
+  }
+}
+
+static int readCapture() {
+  return fgetc(captureIn);
+}
+
+static void writeCapture(const byte *data, int length) {
+  fwrite(data, 1, length, captureOut);
+}
+
+// the capture is replayed relative to the start of the benchmark
+static void waitUntil(double time) {
+  double wait = time - nowMicros();
+  if(wait <= 0) return;
+  struct timespec ts;
+  ts.tv_sec = (time_t)(wait / 1e6);
+  ts.tv_nsec = (long)(wait - ts.tv_sec * 1e6) * 1000;
+  nanosleep(&ts, NULL);
+}
+
+static speed_t baudConstant(long baud) {
+  switch(baud) {
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 2000000: return B2000000;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *device = NULL;
+  const char *recordFile = NULL;
+  long baud = 500000; // Serial1 in polymod_main
+  bool isCapture = false, realtime = false;
+  int opt;
+
+  while((opt = getopt(argc, argv, "d:b:rTw:v")) != -1) {
+    switch(opt) {
+      case 'd': device = optarg; break;
+      case 'b': baud = atol(optarg); break;
+      case 'r': isCapture = true; break;
+      case 'T': realtime = true; break;
+      case 'w': recordFile = optarg; break;
+      case 'v': verbose = true; break;
+      default:
+        fprintf(stderr, "usage: %s [-d serial device] [-b baud] [-r] [-T] [-w capture file] [-v] [file]\n", argv[0]);
+        return 1;
+    }
+  }
+  if(isCapture && device) {
+    fprintf(stderr, "-r replays a capture file, not a device\n");
+    return 1;
+  }
+  realtime = realtime && isCapture;
+
+  int fd = 0;
+  if(device) {
+    struct termios tio;
+    fd = open(device, O_RDONLY | O_NOCTTY);
+    if(fd < 0 || tcgetattr(fd, &tio) < 0 || !baudConstant(baud)) {
+      fprintf(stderr, "can't open %s at %ld baud\n", device, baud);
+      return 1;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, baudConstant(baud));
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 2; // read() returns after 200 ms without data, to notice Ctrl-C
+    tcsetattr(fd, TCSANOW, &tio);
+  } else if(isCapture) {
+    captureIn = optind < argc ? fopen(argv[optind], "rb") : stdin;
+    replay.onRead = readCapture;
+    if(!captureIn || !replay.begin()) {
+      fprintf(stderr, "%s is not a link capture\n", optind < argc ? argv[optind] : "stdin");
+      return 1;
+    }
+  } else if(optind < argc) {
+    fd = open(argv[optind], O_RDONLY);
+    if(fd < 0) {
+      fprintf(stderr, "can't open %s\n", argv[optind]);
+      return 1;
+    }
+  }
+  if(recordFile) {
+    captureOut = fopen(recordFile, "wb");
+    if(!captureOut) {
+      fprintf(stderr, "can't write %s\n", recordFile);
+      return 1;
+    }
+    recorder.onWrite = writeCapture;
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  parser.onCableAdded = cableAdded;
+  parser.onCableRemoved = cableRemoved;
+  parser.onAnalog = analogReading;
+  parser.onModuleId = moduleId;
+  parser.onInput = moduleInput;
+  parser.onScanned = scanned;
+
+  byte buf[4096];
+  double start = nowMicros();
+  double lastData = start;
+  if(recordFile) recorder.begin(start);
+  while(!stopping) {
+    byte *data = buf;
+    ssize_t n;
+    if(isCapture) {
+      if(!replay.next()) break;
+      if(realtime) waitUntil(start + replay.time);
+      data = replay.data;
+      n = replay.length;
+    } else {
+      n = read(fd, buf, sizeof(buf));
+      if(n < 0) break; // pty closed by the writer
+      if(n == 0) {
+        if(device) continue;
+        break;
+      }
+    }
+    lastData = nowMicros();
+    if(recordFile) recorder.record(lastData, data, n);
+    feed(data, n);
+  }
+  if(recordFile) {
+    recorder.flush();
+    fclose(captureOut);
+    printf("recorded %lu bytes to %s (%lu bytes)\n", recorder.bytes, recordFile, recorder.written);
+  }
+  if(replay.bad) printf("capture damaged after %lu chunks\n", replay.chunks);
+  if(replay.overruns) printf("%lu receive buffer overruns in the capture, link bytes are missing there\n", replay.overruns);
+
+  // in real time, the rates are over the time data was coming in; from a file, over the parser time
+  bool timed = device || realtime;
+  double seconds = (timed ? lastData - start : stats.parseTime) / 1e6;
+  unsigned long events = stats.added + stats.removed + stats.analog + stats.moduleIds + stats.inputs;
+  if(timed) printf("%lu bytes, %lu messages, %lu errors in %.1f s\n", stats.bytes, parser.messages, parser.errors, seconds);
+  else printf("%lu bytes, %lu messages, %lu errors in %.2f ms of parser time\n", stats.bytes, parser.messages, parser.errors, seconds * 1e3);
+  printf("events: %lu cables added, %lu removed, %lu analog, %lu module IDs, %lu button edges, %.0f per second\n",
+    stats.added, stats.removed, stats.analog, stats.moduleIds, stats.inputs, seconds > 0 ? events / seconds : 0);
+  if(stats.scans) printf("scans: %lu, parser time avg %.1f us, max %.1f us\n", stats.scans, stats.scanSum / stats.scans, stats.scanMax);
+  if(stats.slices) printf("slices: %lu, parser time avg %.1f us, max %.1f us\n", stats.slices, stats.sliceSum / stats.slices, stats.sliceMax);
+  printf("largest stall: %.1f us (%s), %.3f us per byte\n", stats.maxStall,
+    stats.maxStallCompared ? "cable comparison" : "message", stats.bytes ? stats.parseTime / stats.bytes : 0);
+  return 0;
+}
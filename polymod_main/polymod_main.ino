@@ -20,6 +20,8 @@ uint32_t reporttime;
 #include "PhysicalPatchCable.h"
 #include "VirtualPatchCable.h"
 #include "Menu.h"
+#include "LinkParser.h"
+#include "LinkCapture.h"
 
 // include Constants
 #include "Constants.h"
@@ -38,16 +40,20 @@ uint32_t reporttime;
 #define INC_BUTTON_PIN 3
 #define YES_BUTTON_PIN 4
 #define NO_BUTTON_PIN 5
+#define SDCARD_CS_PIN 10 // audio board SD card slot (BUILTIN_SDCARD for the slot on a Teensy 3.6)
 
 // more definitions
-byte moduleIDReadings[MAX_MODULES];
-PhysicalPatchCable patchCableConnections[MAX_CABLES]; // main array of physically connected patch cables
-PhysicalPatchCable newPatchCableConnections[MAX_CABLES]; // most recently updated array of connected patch cables, to check for new connections/disconnections
-VirtualPatchCable virtualPatchCableConnections[MAX_CABLES];
-int newConnectionIndex = 0;
+LinkParser controllerLink; // controller link (Serial1), keeps the list of physically connected patch cables
+byte *moduleIDReadings = controllerLink.moduleIds;
+VirtualPatchCable virtualPatchCableConnections[MAX_CABLES]; // same index as controllerLink.cables
 PhysicalModule physicalModules[MAX_MODULES]; // all physical modules
 AudioControlSGTL5000 sgtl; // teensy audio board chip
 Menu menu = Menu();
+LinkCaptureWriter linkRecorder;
+LinkCaptureReader linkReplay;
+File linkCaptureFile;
+byte linkRxBuffer[LINK_RX_BUFFER];
+unsigned long linkOverruns = 0; // Serial1 receive buffer found full, link bytes may be lost
 
 // buttons
 Bounce incButton = Bounce();
@@ -56,8 +62,6 @@ Bounce yesButton = Bounce();
 Bounce noButton = Bounce();
 
 // serial stuff
-byte nextPosition = 0;
-byte currentCommand[8];
 float tempFreq = 100.0;
 unsigned long lastLoop;
 unsigned long thisLoop;
@@ -69,6 +73,7 @@ void setup() {
   reporttime = millis();
 
   Serial1.begin(500000);
+  Serial1.addMemoryForRead(linkRxBuffer, sizeof(linkRxBuffer));
   Serial.begin(500000);
   incButton.attach(INC_BUTTON_PIN,INPUT_PULLUP);
   decButton.attach(DEC_BUTTON_PIN,INPUT_PULLUP);
@@ -84,6 +89,12 @@ void setup() {
   sgtl.enable();
   sgtl.volume(0.3);
 
+  controllerLink.onCableAdded = cableAdded;
+  controllerLink.onCableRemoved = cableRemoved;
+  controllerLink.onAnalog = analogReading;
+  controllerLink.onInput = moduleInput;
+  beginLinkCapture();
+
   // init test modules
   physicalModules[0].virtualModule = new Master();
   physicalModules[8].virtualModule = new TestOscillator();
@@ -95,63 +106,34 @@ void loop() {
   if((time - reporttime) > 2000) {
     reporttime = time;
     //report_ram();
+    if(controllerLink.stats.analogDropped > 0 || controllerLink.stats.stalls > 0 || linkOverruns > 0) {
+      DEBUG_PRINT("LINK: queue ");
+      DEBUG_PRINT(controllerLink.stats.maxQueueDepth);
+      DEBUG_PRINT(" backlog ");
+      DEBUG_PRINT(controllerLink.stats.maxAnalogBacklog);
+      DEBUG_PRINT(" dropped ");
+      DEBUG_PRINT(controllerLink.stats.analogDropped);
+      DEBUG_PRINT(" stalls ");
+      DEBUG_PRINT(controllerLink.stats.stalls);
+      DEBUG_PRINT(" overruns ");
+      DEBUG_PRINTLN(linkOverruns);
+    }
+#if LINK_RECORD != LINK_RECORD_OFF
+    linkRecorder.flush();
+#endif
+#if LINK_RECORD == LINK_RECORD_SD
+    linkCaptureFile.flush();
+#elif LINK_RECORD == LINK_RECORD_USB
+    Serial.send_now();
+#endif
   };
   ram.run();
 
-  while(Serial1.available()) {
-    byte thisByte = Serial1.read();
-    if(nextPosition==0) {
-      // new command!
-      currentCommand[0] = thisByte;
-      if(thisByte>0) nextPosition ++; // don't increment position for command 0 because it doesn't have any other data expected
-      else {
-        updatePatchCableConnections();
-      }
-    } else {
-      currentCommand[nextPosition] = thisByte;
-      switch(currentCommand[0]) {
-        case 1:
-        nextPosition++;
-        if(nextPosition>6) {
-          nextPosition=0;
-          addNewPatchCableConnection((currentCommand[1]<<6)+(currentCommand[2]<<3)+currentCommand[3],(currentCommand[4]<<6)+(currentCommand[5]<<3)+currentCommand[6]);
-        }
-        break;
-
-        case 2:
-        // analog reading (currently 8-bit, upgrade to 10-bit at some point)
-        nextPosition++;
-        if(nextPosition>4) {
-          nextPosition=0;
-          /*Serial.print("ANALOG READING: ");
-          Serial.print(currentCommand[1]);
-          Serial.print("-");
-          Serial.print(currentCommand[2]);
-          Serial.print("-");
-          Serial.print(currentCommand[3]);
-          Serial.print(": ");
-          Serial.println(currentCommand[4]);*/
-          if(currentCommand[1]==0&&currentCommand[2]==0&&currentCommand[3]==0) tempFreq = 100.0 + 10*currentCommand[4];
-        }
-        break;
-
-        case 3:
-        // module ID reading
-        nextPosition++;
-        if(nextPosition>3) {
-          nextPosition=0;
-          moduleIDReadings[(currentCommand[1]<<3)+currentCommand[2]] = currentCommand[3];
-          /*Serial.print("MODULE ID READING: ");
-          Serial.print(currentCommand[1]);
-          Serial.print("-");
-          Serial.print(currentCommand[2]);
-          Serial.print(": ");
-          Serial.println(currentCommand[3]);*/
-        }
-        break;
-      }
-    }
-  }
+#if defined(LINK_REPLAY)
+  replayLink();
+#else
+  readLink();
+#endif
 
   // menu button update code (probably not the best place for this, remnant from earlier code, fix later)
   incButton.update();
@@ -272,65 +254,183 @@ void updatePhysicalPatchCables() {
   }
 }
 
-void addNewPatchCableConnection(int socket1, int socket2) {
-  newPatchCableConnections[newConnectionIndex].inUse = true;
-  newPatchCableConnections[newConnectionIndex].socket1 = socket1;
-  newPatchCableConnections[newConnectionIndex].socket2 = socket2;
-  newConnectionIndex ++;
+// module outputs (LEDs etc), one byte per module, sent to the controller only when they change
+byte moduleOutputs[MAX_MODULES];
+
+void setModuleOutputs(int module, byte data) {
+  if(moduleOutputs[module] == data) return;
+  moduleOutputs[module] = data;
+  Serial1.write(1); // module outputs message
+  Serial1.write(module>>3); // group
+  Serial1.write(module&7); // module
+  Serial1.write(data);
 }
 
-void updatePatchCableConnections() {
-  for(int i=0;i<MAX_CABLES;i++) {
-    boolean cableFound = false;
-    for(int j=0;j<newConnectionIndex&&!cableFound;j++) {
-      if(patchCableConnections[i].inUse) {
-        if(patchCableConnections[i].socket1==newPatchCableConnections[j].socket1&&patchCableConnections[i].socket2==newPatchCableConnections[j].socket2) {
-          newPatchCableConnections[j].inUse = false;
-          cableFound = true;
-        }
-      }
-    }
-    if(!cableFound&&patchCableConnections[i].inUse) {
-      // patch cable removed
-      patchCableConnections[i].inUse = false;
-      Serial.print("REMOVED ");
-      Serial.print(patchCableConnections[i].socket1);
-      Serial.print("->");
-      Serial.println(patchCableConnections[i].socket2);
-    }
+// socket LEDs: one output bit per socket of the module, lit while a cable is plugged in
+// (removed is the index of a cable about to be freed, -1 for none)
+void showPatchedSockets(int module, int removed) {
+  byte patched = 0;
+  for(int i=0; i<MAX_CABLES; i++) {
+    if(!controllerLink.cables[i].inUse || i == removed) continue;
+    if(controllerLink.cables[i].socket1>>3 == module) bitSet(patched, controllerLink.cables[i].socket1&7);
+    if(controllerLink.cables[i].socket2>>3 == module) bitSet(patched, controllerLink.cables[i].socket2&7);
   }
-  for(int i=0;i<newConnectionIndex;i++) {
-    if(newPatchCableConnections[i].inUse) {
-      // patch cable added, find space in list
-      boolean spaceFound = false;
-      for(int j=0;j<MAX_CABLES&&!spaceFound;j++) {
-        if(!patchCableConnections[j].inUse) {
-          patchCableConnections[j].inUse = true;
-          patchCableConnections[j].socket1 = newPatchCableConnections[i].socket1;
-          patchCableConnections[j].socket2 = newPatchCableConnections[i].socket2;
-          spaceFound = true;
-          createVirtualConnectionFromPhysical(j);
-          Serial.print("ADDED ");
-          Serial.print(patchCableConnections[j].socket1);
-          Serial.print("->");
-          Serial.println(patchCableConnections[j].socket2);
-        }
-      }
-    }
-  }
-  newConnectionIndex = 0;
+  setModuleOutputs(module, patched);
+}
+
+// link handlers
+
+void cableAdded(int i) {
+  createVirtualConnectionFromPhysical(i);
+  showPatchedSockets(controllerLink.cables[i].socket1>>3, -1);
+  showPatchedSockets(controllerLink.cables[i].socket2>>3, -1);
+  DEBUG_PRINT("ADDED ");
+  DEBUG_PRINT(controllerLink.cables[i].socket1);
+  DEBUG_PRINT("->");
+  DEBUG_PRINTLN(controllerLink.cables[i].socket2);
+}
+
+void cableRemoved(int i) {
+  showPatchedSockets(controllerLink.cables[i].socket1>>3, i);
+  showPatchedSockets(controllerLink.cables[i].socket2>>3, i);
+  DEBUG_PRINT("REMOVED ");
+  DEBUG_PRINT(controllerLink.cables[i].socket1);
+  DEBUG_PRINT("->");
+  DEBUG_PRINTLN(controllerLink.cables[i].socket2);
+}
+
+void analogReading(int module, int pin, int value) {
+  /*DEBUG_PRINT("ANALOG READING: ");
+  DEBUG_PRINT(module);
+  DEBUG_PRINT("-");
+  DEBUG_PRINT(pin);
+  DEBUG_PRINT(": ");
+  DEBUG_PRINTLN(value);*/
+  if(module==0&&pin==0) tempFreq = 100.0 + 2.5*value;
+}
+
+void moduleInput(int module, int input, bool pressed) {
+  DEBUG_PRINT(pressed ? "PRESSED " : "RELEASED ");
+  DEBUG_PRINT(module);
+  DEBUG_PRINT("-");
+  DEBUG_PRINTLN(input);
 }
 
 void createVirtualConnectionFromPhysical(int i) {
-  int socket1Module = patchCableConnections[i].socket1>>3;
-  int socket2Module = patchCableConnections[i].socket2>>3;
-  int socket1Pin = patchCableConnections[i].socket1 - (socket1Module<<3);
-  int socket2Pin = patchCableConnections[i].socket2 - (socket2Module<<3);
-  Serial.println(socket1Module);
-  Serial.println(socket1Pin);
-  Serial.println(socket2Module);
-  Serial.println(socket2Pin);
+  int socket1Module = controllerLink.cables[i].socket1>>3;
+  int socket2Module = controllerLink.cables[i].socket2>>3;
+  int socket1Pin = controllerLink.cables[i].socket1 - (socket1Module<<3);
+  int socket2Pin = controllerLink.cables[i].socket2 - (socket2Module<<3);
+  DEBUG_PRINTLN(socket1Module);
+  DEBUG_PRINTLN(socket1Pin);
+  DEBUG_PRINTLN(socket2Module);
+  DEBUG_PRINTLN(socket2Pin);
   VirtualSocket& socket1 = physicalModules[socket1Module].virtualModule->getSocket(socket1Pin);
   VirtualSocket& socket2 = physicalModules[socket1Module].virtualModule->getSocket(socket2Pin);
   virtualPatchCableConnections[i].initialise(socket1, socket2);
 }
+
+// controller link input, capture and replay
+
+// at most one capture chunk per loop(), what is left waits in the receive buffer
+void readLink() {
+  byte data[LINK_CAPTURE_MAX_CHUNK];
+  int length = 0;
+  unsigned long time = micros();
+  int available = Serial1.available();
+  if(available == 0) return;
+  bool overrun = available >= 64 + LINK_RX_BUFFER - 1; // one slot of the ring buffer stays empty
+  if(overrun) linkOverruns++;
+  while(Serial1.available() && length < LINK_CAPTURE_MAX_CHUNK) data[length++] = Serial1.read();
+#if LINK_RECORD != LINK_RECORD_OFF
+  if(overrun) linkRecorder.overrun(time);
+  linkRecorder.record(time, data, length);
+#endif
+  for(int i=0; i<length; i++) controllerLink.parse(data[i]);
+}
+
+void writeLinkCapture(const byte *data, int length) {
+#if LINK_RECORD == LINK_RECORD_SD
+  linkCaptureFile.write(data, length);
+#else
+  Serial.write(data, length);
+#endif
+}
+
+int readLinkCapture() {
+  return linkCaptureFile.read();
+}
+
+void beginLinkCapture() {
+#if LINK_RECORD == LINK_RECORD_SD || defined(LINK_REPLAY)
+  SPI.setMOSI(7); // audio board SD card pins
+  SPI.setSCK(14);
+  if(!SD.begin(SDCARD_CS_PIN)) {
+    DEBUG_PRINTLN("LINK CAPTURE: no SD card");
+    return;
+  }
+#endif
+#if defined(LINK_REPLAY)
+  linkCaptureFile = SD.open(LINK_CAPTURE_FILE, FILE_READ);
+  linkReplay.onRead = readLinkCapture;
+  if(!linkCaptureFile || !linkReplay.begin()) DEBUG_PRINTLN("LINK CAPTURE: can't replay " LINK_CAPTURE_FILE);
+#elif LINK_RECORD != LINK_RECORD_OFF
+#if LINK_RECORD == LINK_RECORD_SD
+  SD.remove(LINK_CAPTURE_FILE);
+  linkCaptureFile = SD.open(LINK_CAPTURE_FILE, FILE_WRITE);
+  if(!linkCaptureFile) {
+    DEBUG_PRINTLN("LINK CAPTURE: can't write " LINK_CAPTURE_FILE);
+    return;
+  }
+#endif
+  linkRecorder.onWrite = writeLinkCapture;
+  linkRecorder.begin(micros());
+#endif
+}
+
+// replay statistics, printed when the capture ends: the time in the parser and the handlers
+// (cable comparison, virtual patch cables) is what changes between firmware versions
+unsigned long replayStart;
+unsigned long replayParseTime;
+unsigned long replayMaxChunkTime;
+bool replayDone = false;
+bool replayPending = false; // chunk read, waiting for its time
+
+void replayLink() {
+  if(replayDone || !linkCaptureFile) return;
+  if(linkReplay.chunks == 0 && !replayPending) replayStart = micros();
+  while(true) {
+    if(!replayPending) {
+      if(!linkReplay.next()) break;
+      replayPending = true;
+    }
+    if(LINK_REPLAY_REALTIME && micros() - replayStart < linkReplay.time) return;
+    unsigned long start = micros();
+    for(int i=0; i<linkReplay.length; i++) controllerLink.parse(linkReplay.data[i]);
+    unsigned long time = micros() - start;
+    replayParseTime += time;
+    if(time > replayMaxChunkTime) replayMaxChunkTime = time;
+    replayPending = false;
+    if(LINK_REPLAY_REALTIME) return; // one chunk per loop(), like Serial1
+  }
+  replayDone = true;
+  linkCaptureFile.close();
+  DEBUG_PRINT("REPLAY: ");
+  DEBUG_PRINT(linkReplay.chunks);
+  DEBUG_PRINT(" chunks in ");
+  DEBUG_PRINT((micros() - replayStart) / 1000);
+  DEBUG_PRINT(" ms, parser ");
+  DEBUG_PRINT(replayParseTime);
+  DEBUG_PRINT(" us, max chunk ");
+  DEBUG_PRINT(replayMaxChunkTime);
+  DEBUG_PRINT(" us, messages ");
+  DEBUG_PRINT(controllerLink.messages);
+  DEBUG_PRINT(" errors ");
+  DEBUG_PRINT(controllerLink.errors);
+  if(linkReplay.overruns > 0) {
+    DEBUG_PRINT(" overruns ");
+    DEBUG_PRINT(linkReplay.overruns);
+  }
+  if(linkReplay.bad) DEBUG_PRINT(" (capture damaged)");
+  DEBUG_PRINTLN();
+}